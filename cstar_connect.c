@@ -23,6 +23,7 @@
 #include "utils/memutils.h"
 #include "commands/defrem.h"
 #include "storage/ipc.h"
+#include "utils/builtins.h"
 
 
 typedef struct ConnCacheKey
@@ -31,10 +32,23 @@ typedef struct ConnCacheKey
 	Oid			userid;			/* OID of local user whose mapping we use */
 } ConnCacheKey;
 
+/*
+ * A statement prepared on a cached connection, kept for the whole session.
+ */
+typedef struct ConnPreparedEntry
+{
+	struct ConnPreparedEntry *next;
+	char	   *query;			/* CQL text of the statement */
+	const CassPrepared *prepared;
+} ConnPreparedEntry;
+
 typedef struct ConnCacheEntry
 {
 	ConnCacheKey key;			/* hash key (must be first) */
 	CassSession *conn;			/* connection to foreign server, or NULL */
+	CassCluster *cluster;		/* its configuration, kept for reconnecting */
+	ConnPreparedEntry *prepared;	/* statements prepared on conn */
+	char	   *partitioner;	/* cluster's partitioner class, or NULL */
 	int			xact_depth;		/* 0 = no xact open, 1 = main xact open, 2 =
 								 * one level of subxact open, etc */
 	bool		have_prep_stmt; /* have we prepared any stmts in this xact? */
@@ -51,12 +65,12 @@ static HTAB *ConnectionHash = NULL;
 static bool xact_got_connection = false;
 
 /* prototypes of private functions */
-static CassSession *connect_cass_server(ForeignServer *server, UserMapping *user);
+static CassCluster *make_cass_cluster(ForeignServer *server, UserMapping *user);
+static CassSession *connect_cass_server(ForeignServer *server,
+										CassCluster *cluster);
 static int ExtractOptions(List *defelems, const char **keywords,
 						 const char **values);
-
-
-static CassCluster* cluster;
+static ConnCacheEntry *find_session_entry(CassSession *session);
 
 static void pgcass_close(int code, Datum arg);
 
@@ -84,6 +98,7 @@ pgcass_GetConnection(ForeignServer *server, UserMapping *user,
 									 &ctl,
 								   HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
 
+		on_proc_exit(pgcass_close, 0);
 	}
 
 	/* Set flag that we did GetConnection during the current transaction */
@@ -101,6 +116,9 @@ pgcass_GetConnection(ForeignServer *server, UserMapping *user,
 	{
 		/* initialize new hashtable entry (key is already filled in) */
 		entry->conn = NULL;
+		entry->cluster = NULL;
+		entry->prepared = NULL;
+		entry->partitioner = NULL;
 		entry->xact_depth = 0;
 		entry->have_prep_stmt = false;
 		entry->have_error = false;
@@ -122,7 +140,9 @@ pgcass_GetConnection(ForeignServer *server, UserMapping *user,
 		entry->xact_depth = 0;	/* just to be sure */
 		entry->have_prep_stmt = false;
 		entry->have_error = false;
-		entry->conn = connect_cass_server(server, user);
+		if (entry->cluster == NULL)
+			entry->cluster = make_cass_cluster(server, user);
+		entry->conn = connect_cass_server(server, entry->cluster);
 		elog(DEBUG3, CSTAR_FDW_NAME ": new connection %p for server \"%s\"",
 			 entry->conn, server->servername);
 	}
@@ -138,6 +158,97 @@ pgcass_GetConnection(ForeignServer *server, UserMapping *user,
 }
 
 
+/*
+ * Get the statement prepared for the given CQL text on a connection returned
+ * by pgcass_GetConnection, preparing it on first use.  The result belongs to
+ * the connection cache and must not be freed.
+ */
+const CassPrepared *
+pgcass_GetPrepared(CassSession *session, const char *query)
+{
+	ConnCacheEntry *entry = find_session_entry(session);
+	ConnPreparedEntry *prep;
+	CassFuture *future;
+
+	for (prep = entry->prepared; prep != NULL; prep = prep->next)
+	{
+		if (strcmp(prep->query, query) == 0)
+			return prep->prepared;
+	}
+
+	prep = (ConnPreparedEntry *)
+		MemoryContextAlloc(CacheMemoryContext, sizeof(ConnPreparedEntry));
+	prep->query = MemoryContextStrdup(CacheMemoryContext, query);
+
+	future = cass_session_prepare(session, query);
+	cass_future_wait(future);
+	if (cass_future_error_code(future) != CASS_OK)
+	{
+		pfree(prep->query);
+		pfree(prep);
+		pgcass_report_error(ERROR, future, true, query);
+	}
+
+	prep->prepared = cass_future_get_prepared(future);
+	cass_future_free(future);
+
+	prep->next = entry->prepared;
+	entry->prepared = prep;
+
+	elog(DEBUG3, CSTAR_FDW_NAME ": prepared statement for \"%s\"", query);
+
+	return prep->prepared;
+}
+
+
+/*
+ * Get the class name of the partitioner of the cluster behind a connection
+ * returned by pgcass_GetConnection, as reported by system.local.  It is read
+ * on first use and kept with the connection.  The result belongs to the
+ * connection cache and must not be freed.
+ */
+const char *
+pgcass_GetPartitioner(CassSession *session)
+{
+	ConnCacheEntry *entry = find_session_entry(session);
+	const char *query = "SELECT partitioner FROM system.local";
+	CassStatement *statement;
+	CassFuture *future;
+	const CassResult *result;
+	const CassRow *row;
+	const char *name = "";
+	size_t		name_length = 0;
+
+	if (entry->partitioner != NULL)
+		return entry->partitioner;
+
+	statement = cass_statement_new(query, 0);
+	future = cass_session_execute(session, statement);
+	cass_statement_free(statement);
+	cass_future_wait(future);
+	if (cass_future_error_code(future) != CASS_OK)
+		pgcass_report_error(ERROR, future, true, query);
+
+	result = cass_future_get_result(future);
+	cass_future_free(future);
+
+	row = cass_result_first_row(result);
+	if (row != NULL)
+		cass_value_get_string(cass_row_get_column(row, 0),
+							  &name, &name_length);
+	entry->partitioner = MemoryContextAlloc(CacheMemoryContext,
+											name_length + 1);
+	memcpy(entry->partitioner, name, name_length);
+	entry->partitioner[name_length] = '\0';
+	cass_result_free(result);
+
+	elog(DEBUG3, CSTAR_FDW_NAME ": cluster partitioner is \"%s\"",
+		 entry->partitioner);
+
+	return entry->partitioner;
+}
+
+
 /*
  * Release connection reference count created by calling GetConnection.
  */
@@ -161,22 +272,16 @@ pgcass_ReleaseConnection(CassSession *session)
 
 
 /*
- * Connect to remote server using specified server and user mapping properties.
+ * Build the cluster configuration of a server, using the specified server
+ * and user mapping properties.
  */
-static CassSession *
-connect_cass_server(ForeignServer *server, UserMapping *user)
+static CassCluster *
+make_cass_cluster(ForeignServer *server, UserMapping *user)
 {
-	CassFuture* conn_future = NULL;
-	CassSession* session = NULL;
-
-	if (!cluster)
-	{
-		cluster = cass_cluster_new();
-		on_proc_exit(pgcass_close, 0);
-	}
+	CassCluster *cluster = cass_cluster_new();
 
 	/*
-	 * Use PG_TRY block to ensure closing connection on error.
+	 * Use PG_TRY block to ensure freeing the cluster on error.
 	 */
 	PG_TRY();
 	{
@@ -189,6 +294,17 @@ connect_cass_server(ForeignServer *server, UserMapping *user)
 		int			svr_proto = 0;
 		const char		*svr_username = NULL;
 		const char		*svr_password = NULL;
+		bool		svr_token_aware = true;
+		bool		svr_latency_aware = false;
+		const char		*svr_local_dc = NULL;
+		int			svr_remote_hosts = 0;
+		const char		*svr_whitelist = NULL;
+		const char		*svr_blacklist = NULL;
+		int			svr_io_threads = 0;
+		int			svr_core_connections = 0;
+		int			svr_connect_timeout = 0;
+		int			svr_request_timeout = 0;
+		CassError	rc = CASS_OK;
 
 		/*
 		 * Construct connection params from generic options of ForeignServer
@@ -229,6 +345,46 @@ connect_cass_server(ForeignServer *server, UserMapping *user)
 			{
 				svr_password = values[i];
 			}
+			else if (strcmp(keywords[i], "token_aware") == 0)
+			{
+				(void) parse_bool(values[i], &svr_token_aware);
+			}
+			else if (strcmp(keywords[i], "latency_aware") == 0)
+			{
+				(void) parse_bool(values[i], &svr_latency_aware);
+			}
+			else if (strcmp(keywords[i], "local_dc") == 0)
+			{
+				svr_local_dc = values[i];
+			}
+			else if (strcmp(keywords[i], "used_hosts_per_remote_dc") == 0)
+			{
+				svr_remote_hosts = atoi(values[i]);
+			}
+			else if (strcmp(keywords[i], "whitelist") == 0)
+			{
+				svr_whitelist = values[i];
+			}
+			else if (strcmp(keywords[i], "blacklist") == 0)
+			{
+				svr_blacklist = values[i];
+			}
+			else if (strcmp(keywords[i], "io_threads") == 0)
+			{
+				svr_io_threads = atoi(values[i]);
+			}
+			else if (strcmp(keywords[i], "core_connections") == 0)
+			{
+				svr_core_connections = atoi(values[i]);
+			}
+			else if (strcmp(keywords[i], "connect_timeout") == 0)
+			{
+				svr_connect_timeout = atoi(values[i]);
+			}
+			else if (strcmp(keywords[i], "request_timeout") == 0)
+			{
+				svr_request_timeout = atoi(values[i]);
+			}
 		}
 
 		if (svr_host)
@@ -240,6 +396,71 @@ connect_cass_server(ForeignServer *server, UserMapping *user)
 		if (svr_username && svr_password)
 			cass_cluster_set_credentials(cluster, svr_username, svr_password);
 
+		/* Load balancing */
+		if (svr_local_dc)
+			rc = cass_cluster_set_load_balance_dc_aware(cluster, svr_local_dc,
+														svr_remote_hosts,
+														cass_false);
+		if (rc != CASS_OK)
+			ereport(ERROR,
+					(errcode(ERRCODE_SQLCLIENT_UNABLE_TO_ESTABLISH_SQLCONNECTION),
+					 errmsg("could not set local data center \"%s\" for server \"%s\"",
+							svr_local_dc, server->servername),
+					 errdetail_internal("%s", cass_error_desc(rc))));
+		cass_cluster_set_token_aware_routing(cluster,
+											 svr_token_aware ? cass_true : cass_false);
+		cass_cluster_set_latency_aware_routing(cluster,
+											   svr_latency_aware ? cass_true : cass_false);
+		if (svr_whitelist)
+			cass_cluster_set_whitelist_filtering(cluster, svr_whitelist);
+		if (svr_blacklist)
+			cass_cluster_set_blacklist_filtering(cluster, svr_blacklist);
+
+		/* Threads, connections and timeouts */
+		if (svr_io_threads)
+			rc = cass_cluster_set_num_threads_io(cluster, svr_io_threads);
+		if (rc == CASS_OK && svr_core_connections)
+			rc = cass_cluster_set_core_connections_per_host(cluster,
+															svr_core_connections);
+		if (rc != CASS_OK)
+			ereport(ERROR,
+					(errcode(ERRCODE_SQLCLIENT_UNABLE_TO_ESTABLISH_SQLCONNECTION),
+					 errmsg("could not configure connections to server \"%s\"",
+							server->servername),
+					 errdetail_internal("%s", cass_error_desc(rc))));
+		if (svr_connect_timeout)
+			cass_cluster_set_connect_timeout(cluster, svr_connect_timeout);
+		if (svr_request_timeout)
+			cass_cluster_set_request_timeout(cluster, svr_request_timeout);
+
+		pfree(keywords);
+		pfree(values);
+	}
+	PG_CATCH();
+	{
+		cass_cluster_free(cluster);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return cluster;
+}
+
+
+/*
+ * Connect to remote server using the given cluster configuration.
+ */
+static CassSession *
+connect_cass_server(ForeignServer *server, CassCluster *cluster)
+{
+	CassFuture* conn_future = NULL;
+	CassSession* session = NULL;
+
+	/*
+	 * Use PG_TRY block to ensure closing connection on error.
+	 */
+	PG_TRY();
+	{
 		session = cass_session_new();
 
 		/* Provide the cluster object as configuration to connect the session */
@@ -260,9 +481,6 @@ connect_cass_server(ForeignServer *server, UserMapping *user)
 		}
 
 		cass_future_free(conn_future);
-
-		pfree(keywords);
-		pfree(values);
 	}
 	PG_CATCH();
 	{
@@ -282,12 +500,27 @@ connect_cass_server(ForeignServer *server, UserMapping *user)
 
 /*
  * pgcass_close
- *		Shuts down the Connection.
+ *		Frees the prepared statements and cluster configurations of all
+ *		cached connections.
  */
 static void
 pgcass_close(int code, Datum arg)
 {
-	cass_cluster_free(cluster);
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		ConnPreparedEntry *prep;
+
+		for (prep = entry->prepared; prep != NULL; prep = prep->next)
+			cass_prepared_free(prep->prepared);
+		entry->prepared = NULL;
+		if (entry->cluster)
+			cass_cluster_free(entry->cluster);
+		entry->cluster = NULL;
+	}
 }
 
 
@@ -340,6 +573,32 @@ pgcass_report_error(int elevel, CassFuture* result_future,
 }
 
 
+/*
+ * Find the cache entry of a connection returned by pgcass_GetConnection.
+ */
+static ConnCacheEntry *
+find_session_entry(CassSession *session)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	/* There are only a few connections; look the session up among them. */
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->conn == session)
+		{
+			hash_seq_term(&scan);
+			break;
+		}
+	}
+	if (entry == NULL)
+		elog(ERROR, "no cached connection for Cassandra session %p", session);
+
+	return entry;
+}
+
+
 /*
  * Generate key-value arrays which include only libpq options from the
  * given list (which can contain any kind of options).  Caller must have
@@ -15,6 +15,7 @@
 #include "postgres.h"
 
 #include <cassandra.h>
+#include <float.h>
 #include <inttypes.h>
 #include <time.h>
 
@@ -23,7 +24,9 @@
 	#include "access/table.h"
 #endif
 #include "access/htup_details.h"
+#include "access/parallel.h"
 #include "access/reloptions.h"
+#include "access/stratnum.h"
 #include "access/sysattr.h"
 #include "executor/spi.h"
 #include "foreign/fdwapi.h"
@@ -31,8 +34,12 @@
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "mb/pg_wchar.h"
+#if PG_VERSION_NUM >= 140000
+	#include "optimizer/appendinfo.h"
+#endif
 #include "optimizer/cost.h"
 #include "optimizer/restrictinfo.h"
+#include "catalog/pg_am.h"
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
 #include "catalog/pg_user_mapping.h"
@@ -43,37 +50,61 @@
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "optimizer/planmain.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
 #if PG_VERSION_NUM < 120000
 	#include "optimizer/var.h"
 #else
 	#include "optimizer/optimizer.h"
 #endif
 #include "parser/parsetree.h"
+#include "parser/scansup.h"
+#include "port/atomics.h"
 #include "storage/fd.h"
 #include "storage/ipc.h"
 #include "utils/acl.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#if PG_VERSION_NUM >= 140000
+	#include "common/hashfn.h"
+#endif
 #include "utils/guc.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#include "utils/pg_locale.h"
+#include "utils/inet.h"
+#include "utils/selfuncs.h"
+#include "utils/syscache.h"
 #include "utils/timestamp.h"
+#include "utils/typcache.h"
+#include "utils/uuid.h"
+#if PG_VERSION_NUM >= 100000
+	#include "utils/varlena.h"
+#endif
 
 PG_MODULE_MAGIC;
 
-/* Default CPU cost to start up a foreign query. */
-#define DEFAULT_FDW_STARTUP_COST	100.0
+/* Default number of pages requested ahead of the one being returned. */
+#define DEFAULT_PREFETCH			1
 
-/* Default CPU cost to process 1 row (above and beyond cpu_tuple_cost). */
-#define DEFAULT_FDW_TUPLE_COST		0.01
+/* Default number of rows a COPY into a foreign table keeps in flight. */
+#define DEFAULT_COPY_CONCURRENCY	64
 
 /* The PRIMARY KEY OPTION name */
 /* TODO: Add support for multiple comma-separated PK columns */
 #define OPT_PK						"primary_key"
 
+/* The partition key OPTION name, a comma-separated list of columns */
+#define OPT_PARTITION_KEY			"partition_key"
+
+/* The clustering key OPTION name, a comma-separated list of columns */
+#define OPT_CLUSTERING_KEY			"clustering_key"
+
 #define SMALLINT_NULL_SET_ISSUE_URL	"https://groups.google.com/a/lists.datastax.com/forum/#!topic/cpp-driver-user/b1XRQdnVH6A"
 
 struct CassFdwOption
@@ -88,6 +119,29 @@ static struct CassFdwOption valid_options[] =
 	{ "host",			ForeignServerRelationId },
 	{ "port",			ForeignServerRelationId },
 	{ "protocol",		ForeignServerRelationId },
+	{ "fetch_size",		ForeignServerRelationId },
+	{ "prefetch",		ForeignServerRelationId },
+	{ "max_concurrent_requests",	ForeignServerRelationId },
+	{ "join_batch_size",	ForeignServerRelationId },
+	{ "token_ranges",	ForeignServerRelationId },
+	{ "batch_size",		ForeignServerRelationId },
+	{ "batch_type",		ForeignServerRelationId },
+	{ "write_concurrency",	ForeignServerRelationId },
+	{ "copy_concurrency",	ForeignServerRelationId },
+	{ "copy_consistency",	ForeignServerRelationId },
+	{ "copy_max_errors",	ForeignServerRelationId },
+	/* Load balancing options */
+	{ "token_aware",	ForeignServerRelationId },
+	{ "local_dc",		ForeignServerRelationId },
+	{ "used_hosts_per_remote_dc",	ForeignServerRelationId },
+	{ "latency_aware",	ForeignServerRelationId },
+	{ "whitelist",		ForeignServerRelationId },
+	{ "blacklist",		ForeignServerRelationId },
+	/* Driver threads, connections and timeouts */
+	{ "io_threads",		ForeignServerRelationId },
+	{ "core_connections",	ForeignServerRelationId },
+	{ "connect_timeout",	ForeignServerRelationId },
+	{ "request_timeout",	ForeignServerRelationId },
 	{ "username",		UserMappingRelationId },
 	{ "password",		UserMappingRelationId },
 	{ "query",			ForeignTableRelationId },
@@ -95,8 +149,29 @@ static struct CassFdwOption valid_options[] =
 	{ "table_name",	ForeignTableRelationId },
 	/* Pre-req for UPDATE and DELETE support */
 	{ OPT_PK,	ForeignTableRelationId },
+	/* Enables pushdown of partition key restrictions */
+	{ OPT_PARTITION_KEY,	ForeignTableRelationId },
+	/* Enables pushdown of clustering key restrictions */
+	{ OPT_CLUSTERING_KEY,	ForeignTableRelationId },
 	{ "read_consistency",	ForeignTableRelationId },
 	{ "write_consistency",	ForeignTableRelationId },
+	{ "fetch_size",		ForeignTableRelationId },
+	{ "prefetch",		ForeignTableRelationId },
+	{ "max_concurrent_requests",	ForeignTableRelationId },
+	{ "join_batch_size",	ForeignTableRelationId },
+	/* Splits whole-table scans into concurrent token range reads */
+	{ "token_ranges",	ForeignTableRelationId },
+	/* Groups the rows of an INSERT into batches */
+	{ "batch_size",		ForeignTableRelationId },
+	{ "batch_type",		ForeignTableRelationId },
+	/* Keeps several writes in flight */
+	{ "write_concurrency",	ForeignTableRelationId },
+	/* Tunes COPY into the table */
+	{ "copy_concurrency",	ForeignTableRelationId },
+	{ "copy_consistency",	ForeignTableRelationId },
+	{ "copy_max_errors",	ForeignTableRelationId },
+	/* Caps the rows read from each partition */
+	{ "per_partition_limit",	ForeignTableRelationId },
 	/* Sentinel */
 	{ NULL,			InvalidOid }
 };
@@ -134,10 +209,41 @@ typedef struct CassFdwModifyState
 
 	/* for remote query execution */
 	CassSession   *cass_conn; /* connection for the modify */
-	bool           sql_sent;
-	CassStatement *statement;
+	const CassPrepared *prepared;	/* the command, prepared on cass_conn */
+	CassStatement *statement;	/* statement of the current row, or NULL */
 	CassConsistency write_consistency;
 
+	/* batching of INSERTs, on Postgres 14+ */
+	int			batch_size;		/* rows per batch, 1 for no batching */
+	CassBatchType batch_type;	/* type of the batches sent */
+	CassBatch  *batch;			/* batch being built and sent, or NULL */
+
+	/*
+	 * Writes sent without waiting for them, when write_concurrency is above
+	 * 1: a ring of their futures, oldest first, and the descriptions and
+	 * numbers of the rows they write, for reporting errors.
+	 */
+	int			write_concurrency;	/* max # of writes in flight */
+	CassFuture **inflight;
+	char	  **inflight_rows;
+	int		   *inflight_nrows;
+	int			inflight_head;	/* index of oldest write in ring */
+	int			num_inflight;	/* # of writes in ring */
+	CassFuture *queuing;		/* write waiting for room in ring, or NULL */
+	MemoryContext rows_cxt;		/* context for inflight_rows */
+	List	   *partition_attrs;	/* partition key columns, for INSERT */
+	List	   *key_attrs;		/* primary key columns, for INSERT */
+	const char *key_name;		/* key column, for UPDATE and DELETE */
+	const char *opname;			/* INSERT, UPDATE or DELETE, for messages */
+
+	/* for COPY into the foreign table */
+	bool		is_copy;
+	int			max_errors;		/* failed writes reported as warnings */
+	int			num_errors;		/* # of failed writes so far */
+	int64		rows_written;	/* # of rows written successfully */
+	int64		rows_failed;	/* # of rows of the failed writes */
+	TimestampTz start_time;		/* when the COPY began */
+
 	/* extracted fdw_private data */
 	char	   *query;			/* text of INSERT/UPDATE/DELETE command */
 	List	   *target_attrs;	/* list of target attribute numbers */
@@ -154,23 +260,34 @@ typedef struct CassFdwModifyState
 } CassFdwModifyState;
 
 /*
- * FDW-specific information for RelOptInfo.fdw_private.
+ * One statement of a foreign scan, paged through independently of the
+ * others.  A scan normally has a single stream; a partition key compared
+ * with "= ANY" gets one per partition.
  */
-typedef struct CassFdwPlanState
+typedef struct CassScanStream
 {
-	/* baserestrictinfo clauses, broken down into safe and unsafe subsets. */
-	List	   *remote_conds;
-	List	   *local_conds;
+	CassStatement *statement;	/* statement reading this stream's rows */
+	CassFuture *pending;		/* in-flight page request, or NULL */
+	bool		finished;		/* true once its final page has arrived */
+} CassScanStream;
 
-	/* Bitmap of attr numbers we need to fetch from the remote server. */
-	Bitmapset  *attrs_used;
+/*
+ * Shared memory state of a parallel scan, whose participants each read the
+ * token ranges they take from it.
+ */
+typedef struct CassParallelScanState
+{
+	pg_atomic_uint32 next_range;	/* next token range to hand out */
+} CassParallelScanState;
 
-	/* Estimated size and cost for a scan with baserestrictinfo quals. */
-	double		rows;
-	int			width;
-	Cost		startup_cost;
-	Cost		total_cost;
-} CassFdwPlanState;
+/*
+ * Callback argument for ec_member_matches_partition_key
+ */
+typedef struct
+{
+	Expr	   *current;		/* current expr, or NULL if not yet found */
+	List	   *already_used;	/* expressions already dealt with */
+} ec_member_foreign_arg;
 
 /*
  * FDW-specific information for ForeignScanState.fdw_state.
@@ -180,30 +297,77 @@ typedef struct CassFdwScanState
 	Relation	rel;			/* relcache entry for the foreign table */
 	AttInMetadata *attinmeta;	/* attribute datatype conversion metadata */
 
+	TupleDesc	tupdesc;		/* descriptor of the tuples returned */
+
 	/* extracted fdw_private data */
 	char	   *query;			/* text of SELECT command */
 	List	   *retrieved_attrs;	/* list of retrieved attribute numbers */
+	List	   *agg_counts;		/* which aggregates are counts, or NIL */
+	List	   *empty_nulls;	/* aggregates that are NULL over no values */
 
+	/* values bound to the statement's parameters */
+	int			numParams;		/* number of parameters */
+	List	   *param_exprs;	/* executable expressions for their values */
+	Oid		   *param_types;	/* their type OIDs */
+	List	   *param_strategies;	/* how each one is compared */
+
+	/* per-column conversion plan, built from the first page received */
+	CassColumnPlan *colplan;
 	int		NumberOfColumns;
 
 	/* for remote query execution */
 	CassSession	   *cass_conn;			/* connection for the scan */
 	bool			sql_sended;
-	CassStatement  *statement;
 	CassConsistency read_consistency;
+	int				fetch_size;		/* number of rows per remote page */
+	int				max_concurrent;	/* max # of requests in flight */
+
+	/* statement prepared once its parameters change on rescan, or NULL */
+	const CassPrepared *prepared;
+	bool			prepare;		/* prepare it at the next cursor */
+
+	/* statements whose pages make up the scan */
+	CassScanStream *streams;		/* array of streams */
+	int				num_streams;	/* # of streams in use */
+	int				max_streams;	/* allocated length of streams */
+	int				first_open;		/* lowest index of an unfinished stream */
+	int				num_unfinished;	/* # of streams with pages to come */
+	int			   *inflight;		/* indexes of streams with a request out */
+	int				num_pending;	/* # of entries in inflight */
+	int				concurrency;	/* max # of requests in flight */
+
+	/* pages requested ahead of the one being returned */
+	int				prefetch;		/* # of pages wanted ahead per stream */
+	const CassResult **pages;		/* ring of received, unconsumed pages */
+	int				ring_size;		/* max # of pages queued or in flight */
+	int				ring_capacity;	/* allocated length of pages */
+	int				page_head;		/* index of oldest page in ring */
+	int				num_pages;		/* # of pages in ring */
+
+	/* page whose rows are being returned */
+	const CassResult *result;	/* current page, or NULL */
+	CassIterator *rows;			/* iterator over its rows */
+
+	/*
+	 * For a scan split into token ranges, the number of ranges of the
+	 * ring, and for a parallel scan, where the next one to read comes from:
+	 * the shared state, or without one, a local counter.  token_ranges is 0
+	 * for other scans.
+	 */
+	int			token_ranges;
+	CassParallelScanState *pscan;
+	int			next_range;
+	int			cur_range;		/* range read by the cursor, or -1 */
 
-	/* for storing result tuples */
-	HeapTuple  *tuples;			/* array of currently-retrieved tuples */
-	int			num_tuples;		/* # of tuples in array */
-	int			next_tuple;		/* index of next one to return */
+	/* LIMIT/OFFSET pushed down into the scan, or -1 */
+	int			limit_count;	/* # of rows to return */
+	int			limit_offset;	/* # of leading rows to skip */
+	int			num_skipped;	/* # of leading rows skipped so far */
+	int			num_returned;	/* # of rows returned so far */
 
 	/* batch-level state, for optimizing rewinds and avoiding useless fetch */
 	int			fetch_ct_2;		/* Min(# of fetches done, 2) */
 	bool		eof_reached;	/* true if last fetch reached EOF */
-
-	/* working memory contexts */
-	MemoryContext batch_cxt;	/* context holding current batch of tuples */
-	MemoryContext temp_cxt;		/* context for per-tuple temporary data */
 } CassFdwScanState;
 
 enum CassFdwScanPrivateIndex
@@ -211,7 +375,43 @@ enum CassFdwScanPrivateIndex
 	/* SQL statement to execute remotely (as a String node) */
 	CassFdwScanPrivateSelectSql,
 	/* Integer list of attribute numbers retrieved by the SELECT */
-	CassFdwScanPrivateRetrievedAttrs
+	CassFdwScanPrivateRetrievedAttrs,
+	/* Integer list of the btree strategy each parameter is compared with */
+	CassFdwScanPrivateParamStrategies,
+	/* LIMIT and OFFSET applied by the scan, or -1 (as Integer nodes) */
+	CassFdwScanPrivateLimitCount,
+	CassFdwScanPrivateLimitOffset,
+	/*
+	 * Integer list with one entry per aggregate computed remotely, true for
+	 * counts; NIL for a scan of the table's rows or of groups
+	 */
+	CassFdwScanPrivateAggCounts,
+	/*
+	 * Integer list of the sums and averages, whose argument counts follow
+	 * the other columns of the result
+	 */
+	CassFdwScanPrivateEmptyNulls,
+	/*
+	 * Number of token ranges read one at a time by a parallel scan, whose
+	 * last two parameters are the bounds of the range, or 0 (as an Integer
+	 * node)
+	 */
+	CassFdwScanPrivateTokenRanges
+};
+
+/*
+ * Similarly, this enum describes what's kept in the fdw_private list for
+ * a ForeignPath.  It is empty for a plain scan of the foreign table.
+ */
+enum CassFdwPathPrivateIndex
+{
+	/* LIMIT and OFFSET to apply, or -1 (as Integer nodes) */
+	CassFdwPathPrivateLimitCount,
+	CassFdwPathPrivateLimitOffset,
+	/* Whether to read the clustering order backwards (as an Integer node) */
+	CassFdwPathPrivateReverse,
+	/* Whether to return distinct partition keys (as an Integer node) */
+	CassFdwPathPrivateDistinct
 };
 
 /*
@@ -223,6 +423,8 @@ extern Datum cstar_fdw_validator(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(cstar_fdw_handler);
 PG_FUNCTION_INFO_V1(cstar_fdw_validator);
 
+void		_PG_init(void);
+
 static CassConsistency consistency_from_string(const char *s);
 
 /*
@@ -239,17 +441,59 @@ static ForeignScan *cassGetForeignPlan(
 							List *scan_clauses,
 							Plan *outer_plan
 );
+static void cassGetForeignUpperPaths(PlannerInfo *root,
+							UpperRelationKind stage,
+							RelOptInfo *input_rel,
+							RelOptInfo *output_rel,
+							void *extra);
+#if PG_VERSION_NUM >= 120000
+static void add_foreign_grouping_paths(PlannerInfo *root,
+							RelOptInfo *input_rel,
+							RelOptInfo *grouped_rel,
+							GroupPathExtraData *extra);
+static void add_foreign_distinct_paths(PlannerInfo *root,
+							RelOptInfo *input_rel,
+							RelOptInfo *distinct_rel);
+static void add_foreign_ordered_paths(PlannerInfo *root,
+							RelOptInfo *input_rel,
+							RelOptInfo *ordered_rel);
+static void add_foreign_final_paths(PlannerInfo *root,
+							RelOptInfo *input_rel,
+							RelOptInfo *final_rel,
+							FinalPathExtraData *extra);
+#endif
 static void cassExplainForeignScan(ForeignScanState *node, ExplainState *es);
 static void cassBeginForeignScan(ForeignScanState *node, int eflags);
 static TupleTableSlot *cassIterateForeignScan(ForeignScanState *node);
 static void cassReScanForeignScan(ForeignScanState *node);
 static void cassEndForeignScan(ForeignScanState *node);
+static bool cassIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
+							  RangeTblEntry *rte);
+static Size cassEstimateDSMForeignScan(ForeignScanState *node,
+						   ParallelContext *pcxt);
+static void cassInitializeDSMForeignScan(ForeignScanState *node,
+							 ParallelContext *pcxt,
+							 void *coordinate);
+static void cassReInitializeDSMForeignScan(ForeignScanState *node,
+							   ParallelContext *pcxt,
+							   void *coordinate);
+static void cassInitializeWorkerForeignScan(ForeignScanState *node,
+								shm_toc *toc,
+								void *coordinate);
 static List *cassImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid);
 
+#if PG_VERSION_NUM < 140000
 static void
 cassAddForeignUpdateTargets(Query *parsetree,
 							RangeTblEntry *target_rte,
 							Relation target_relation);
+#else
+static void
+cassAddForeignUpdateTargets(PlannerInfo *root,
+							Index rtindex,
+							RangeTblEntry *target_rte,
+							Relation target_relation);
+#endif
 static List *
 cassPlanForeignModify(PlannerInfo *root, ModifyTable *plan,
 					  Index resultRelation, int subplan_index);
@@ -260,6 +504,14 @@ static TupleTableSlot *cassExecForeignInsert(EState *estate,
 					  ResultRelInfo *resultRelInfo,
 					  TupleTableSlot *slot,
 					  TupleTableSlot *planSlot);
+#if PG_VERSION_NUM >= 140000
+static int	cassGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo);
+static TupleTableSlot **cassExecForeignBatchInsert(EState *estate,
+					  ResultRelInfo *resultRelInfo,
+					  TupleTableSlot **slots,
+					  TupleTableSlot **planSlots,
+					  int *numSlots);
+#endif
 static TupleTableSlot *cassExecForeignUpdate(EState *estate,
 					  ResultRelInfo *resultRelInfo,
 					  TupleTableSlot *slot,
@@ -269,6 +521,12 @@ static TupleTableSlot *cassExecForeignDelete(EState *estate,
 					  TupleTableSlot *slot,
 					  TupleTableSlot *planSlot);
 static void cassEndForeignModify(EState *estate, ResultRelInfo *rinfo);
+#if PG_VERSION_NUM >= 110000
+static void cassBeginForeignInsert(ModifyTableState *mtstate,
+					   ResultRelInfo *resultRelInfo);
+static void cassEndForeignInsert(EState *estate,
+					 ResultRelInfo *resultRelInfo);
+#endif
 static void cassExplainForeignModify(ModifyTableState *mtstate,
 						 ResultRelInfo *resultRelInfo, List *fdw_private,
 						 int subplan_index,
@@ -293,34 +551,105 @@ static void
 cassGetPKOption(Oid foreigntableid,
 				const char **primarykey);
 static void
-cassGetReadConsistencyOption(Oid foreigntableid,
-				CassConsistency *read_consistency);
-static void
 cassGetWriteConsistencyOption(Oid foreigntableid,
 				CassConsistency *write_consistency);
+static void cassValidateIntOption(DefElem *def, int minval);
+static bool batch_type_from_string(const char *s, CassBatchType *type);
+static CassBatchType cassGetBatchTypeOption(Oid foreigntableid);
+static char *cassGetStringOption(Oid foreigntableid, const char *optname);
+static Index scan_relation_index(ForeignScanState *node);
+static Oid	scan_relation_id(ForeignScanState *node);
 static void create_cursor(ForeignScanState *node);
+static void prepare_scan_statement(CassFdwScanState *fsstate);
+static int	claim_token_range(CassFdwScanState *fsstate);
+static void cassTokenRangeBounds(int range, int nranges,
+					 int64 *lower, int64 *upper);
 static void close_cursor(CassFdwScanState *fsstate);
+static void release_current_page(CassFdwScanState *fsstate);
+static void cleanup_cursor_callback(void *arg);
+static bool bind_scan_params(CassFdwScanState *fsstate,
+				 CassStatement *statement, Datum *values,
+				 int array_param, Oid elem_type, Datum elem);
+static int	dedup_array_elements(Datum *elems, bool *nulls, int nelems,
+					 int16 typlen, bool typbyval);
+static void request_pages(CassFdwScanState *fsstate, int window);
+static void collect_pages(CassFdwScanState *fsstate, bool wait);
 static void fetch_more_data(ForeignScanState *node);
+static void store_empty_aggregates(CassFdwScanState *fsstate,
+					   TupleTableSlot *slot);
 static void pgcass_transferValue(StringInfo buf, const CassValue* value);
 static void pgcass_transformDataType(StringInfo buf, CassValueType type);
-static HeapTuple make_tuple_from_result_row(const CassRow* row,
-										   int ncolumn,
-										   Relation rel,
-										   AttInMetadata *attinmeta,
-										   List *retrieved_attrs,
-										   MemoryContext temp_context);
-
-static void cassClassifyConditions(PlannerInfo *root,
-				   RelOptInfo *baserel,
-				   List *input_conds,
-				   List **remote_conds,
-				   List **local_conds);
+static const char *pgcass_typeName(CassValueType type);
+static int cassListIndexInt(List *list, int value);
+static bool cassPathkeysMatchClustering(PlannerInfo *root, RelOptInfo *baserel,
+							List *pathkeys, bool *reverse);
+static Var *cassFindPathkeyVar(EquivalenceClass *ec, RelOptInfo *baserel);
+static List *cassPinnedKeyAttrs(PlannerInfo *root, RelOptInfo *baserel);
+static void cassAddParamPaths(PlannerInfo *root, RelOptInfo *baserel);
+static void cassAddParallelPath(PlannerInfo *root, RelOptInfo *baserel);
+static void cassAddParamPathInfo(PlannerInfo *root, RelOptInfo *baserel,
+					 RestrictInfo *rinfo, List **ppi_list);
+static bool ec_member_matches_partition_key(PlannerInfo *root,
+								RelOptInfo *rel,
+								EquivalenceClass *ec,
+								EquivalenceMember *em,
+								void *arg);
+#if PG_VERSION_NUM >= 120000
+static bool cassIsGroupingColumn(RelOptInfo *baserel, Expr *expr,
+					 SortGroupClause *sgc);
+static bool cassGroupingKeyAttrs(PlannerInfo *root, RelOptInfo *baserel,
+					 List *grouped, List **group_attrs);
+#endif
+static List *cassMakePathPrivate(int limit_count, int limit_offset,
+					bool reverse, bool distinct);
+static bool cassTimestampBound(Timestamp ts, int strategy, int64 *msecs);
+static List *cassGetKeyColumns(Oid foreigntableid, bool partition,
+				  List **descending);
+static bool cassSplitKeyList(const char *value, List **names,
+				 List **descending);
+static List *cassParseColumnList(Oid foreigntableid, const char *optname,
+					const char *value, List **descending);
+static List *cassGetKeyFromMetadata(Oid foreigntableid, bool partition,
+					   List **descending);
+static void cassReadKeyMetadata(Oid foreigntableid, List **partition_attrs,
+					List **clustering_attrs, List **clustering_desc);
+static bool cassIsKeyTypeMatch(Oid type, CassValueType cass_type);
+static bool cassHasMurmur3Tokens(Oid foreigntableid);
+static void cassInvalidateKeyCache(Datum arg, Oid relid);
+static void cassInvalidateKeyCacheAll(Datum arg, int cacheid,
+						  uint32 hashvalue);
 static void
-cassStatementBindNull(const CassStatement * stmt,
-					  int pindex, Oid ptypeid, const char *opname,
-					  EState *estate, ResultRelInfo *resultRelInfo);
+cassBindModifyParam(CassFdwModifyState *fmstate, int pindex,
+					Datum value, bool isnull, const char *opname,
+					EState *estate, ResultRelInfo *resultRelInfo);
 static void releaseCassResources(EState *estate, ResultRelInfo *resultRelInfo);
-static void
+static void release_writes(CassFdwModifyState *fmstate);
+static void cleanup_modify_callback(void *arg);
+static CassFdwModifyState *create_foreign_modify(EState *estate,
+					  ResultRelInfo *resultRelInfo,
+					  CmdType operation, Plan *subplan, Oid userid,
+					  char *query, List *target_attrs, bool has_returning,
+					  List *retrieved_attrs);
+static void set_write_concurrency(CassFdwModifyState *fmstate, EState *estate,
+					  int write_concurrency);
+static void cassBindInsertRow(CassFdwModifyState *fmstate,
+							  TupleTableSlot *slot, EState *estate,
+							  ResultRelInfo *resultRelInfo);
+static char *cassDescribeWrite(CassFdwModifyState *fmstate,
+							   TupleTableSlot *slot, TupleTableSlot *planSlot,
+							   int nrows);
+static void cassHandleWrite(CassFdwModifyState *fmstate, CassFuture *future,
+							TupleTableSlot *slot, TupleTableSlot *planSlot,
+							int nrows, EState *estate,
+							ResultRelInfo *resultRelInfo);
+static void cassReapWrites(CassFdwModifyState *fmstate, int nwait,
+						   EState *estate, ResultRelInfo *resultRelInfo);
+static int64 cassNextWriteTimestamp(void);
+static void cassReportWriteError(CassFdwModifyState *fmstate,
+								 CassFuture *future, const char *row,
+								 EState *estate,
+								 ResultRelInfo *resultRelInfo);
+static CassError
 bind_cass_statement_param(Oid type, Datum value,
 						  CassStatement * statement, int pindex);
 static TupleTableSlot *
@@ -330,6 +659,15 @@ cassExecPKPredWrite(EState *estate,
 					TupleTableSlot *planSlot,
                     const char *cqlOpName);
 
+/*
+ * Library load-time initialization.
+ */
+void
+_PG_init(void)
+{
+	cassInitBatchJoin();
+}
+
 /*
  * Foreign-data wrapper handler function: return a struct with pointers
  * to my callback routines.
@@ -342,6 +680,7 @@ cstar_fdw_handler(PG_FUNCTION_ARGS)
 	fdwroutine->GetForeignRelSize = cassGetForeignRelSize;
 	fdwroutine->GetForeignPaths = cassGetForeignPaths;
 	fdwroutine->GetForeignPlan = cassGetForeignPlan;
+	fdwroutine->GetForeignUpperPaths = cassGetForeignUpperPaths;
 
 	fdwroutine->ExplainForeignScan = cassExplainForeignScan;
 	fdwroutine->BeginForeignScan = cassBeginForeignScan;
@@ -349,15 +688,28 @@ cstar_fdw_handler(PG_FUNCTION_ARGS)
 	fdwroutine->ReScanForeignScan = cassReScanForeignScan;
 	fdwroutine->EndForeignScan = cassEndForeignScan;
 	fdwroutine->AnalyzeForeignTable = NULL;
+	fdwroutine->IsForeignScanParallelSafe = cassIsForeignScanParallelSafe;
+	fdwroutine->EstimateDSMForeignScan = cassEstimateDSMForeignScan;
+	fdwroutine->InitializeDSMForeignScan = cassInitializeDSMForeignScan;
+	fdwroutine->ReInitializeDSMForeignScan = cassReInitializeDSMForeignScan;
+	fdwroutine->InitializeWorkerForeignScan = cassInitializeWorkerForeignScan;
 	fdwroutine->ImportForeignSchema = cassImportForeignSchema;
 
 	fdwroutine->AddForeignUpdateTargets = cassAddForeignUpdateTargets;
 	fdwroutine->PlanForeignModify = cassPlanForeignModify;
 	fdwroutine->BeginForeignModify = cassBeginForeignModify;
 	fdwroutine->ExecForeignInsert = cassExecForeignInsert;
+#if PG_VERSION_NUM >= 140000
+	fdwroutine->GetForeignModifyBatchSize = cassGetForeignModifyBatchSize;
+	fdwroutine->ExecForeignBatchInsert = cassExecForeignBatchInsert;
+#endif
 	fdwroutine->ExecForeignUpdate = cassExecForeignUpdate;
 	fdwroutine->ExecForeignDelete = cassExecForeignDelete;
 	fdwroutine->EndForeignModify = cassEndForeignModify;
+#if PG_VERSION_NUM >= 110000
+	fdwroutine->BeginForeignInsert = cassBeginForeignInsert;
+	fdwroutine->EndForeignInsert = cassEndForeignInsert;
+#endif
 	fdwroutine->ExplainForeignModify = cassExplainForeignModify;
 	fdwroutine->IsForeignRelUpdatable = cassIsForeignRelUpdatable;
 	PG_RETURN_POINTER(fdwroutine);
@@ -382,6 +734,8 @@ cstar_fdw_validator(PG_FUNCTION_ARGS)
 	char		*svr_schema = NULL;
 	char		*svr_table = NULL;
 	char		*primary_key = NULL;
+	bool		svr_local_dc = false;
+	bool		svr_remote_hosts = false;
 	ListCell	*cell;
 
 	CassConsistency	read_consistency = DEFAULT_CONSISTENCY_LEVEL;
@@ -510,7 +864,8 @@ cstar_fdw_validator(PG_FUNCTION_ARGS)
 				        (errcode(ERRCODE_SYNTAX_ERROR),
 				         errmsg("ANY is only supported as a write consistency level, it is not a valid read consistency level")));
 		}
-		if (strcmp(def->defname, "write_consistency") == 0)
+		if (strcmp(def->defname, "write_consistency") == 0 ||
+			strcmp(def->defname, "copy_consistency") == 0)
 		{
 			write_consistency = consistency_from_string(defGetString(def));
 			if (write_consistency == CASS_CONSISTENCY_UNKNOWN)
@@ -518,8 +873,74 @@ cstar_fdw_validator(PG_FUNCTION_ARGS)
 				        (errcode(ERRCODE_SYNTAX_ERROR),
 				         errmsg("unknown write consistency level")));
 		}
+		if (strcmp(def->defname, OPT_PARTITION_KEY) == 0 ||
+			strcmp(def->defname, OPT_CLUSTERING_KEY) == 0)
+		{
+			List	   *names;
+			List	   *descending;
+
+			if (!cassSplitKeyList(defGetString(def), &names,
+								  strcmp(def->defname, OPT_CLUSTERING_KEY) == 0 ?
+								  &descending : NULL))
+				ereport(ERROR,
+				        (errcode(ERRCODE_SYNTAX_ERROR),
+				         errmsg("invalid list syntax in option \"%s\"",
+				                def->defname)));
+		}
+		if (strcmp(def->defname, "fetch_size") == 0)
+			cassValidateIntOption(def, 1);
+		if (strcmp(def->defname, "prefetch") == 0)
+			cassValidateIntOption(def, 0);
+		if (strcmp(def->defname, "max_concurrent_requests") == 0)
+			cassValidateIntOption(def, 1);
+		if (strcmp(def->defname, "per_partition_limit") == 0)
+			cassValidateIntOption(def, 1);
+		if (strcmp(def->defname, "join_batch_size") == 0)
+			cassValidateIntOption(def, 1);
+		if (strcmp(def->defname, "token_ranges") == 0)
+			cassValidateIntOption(def, 1);
+		if (strcmp(def->defname, "batch_size") == 0)
+			cassValidateIntOption(def, 1);
+		if (strcmp(def->defname, "write_concurrency") == 0 ||
+			strcmp(def->defname, "copy_concurrency") == 0)
+			cassValidateIntOption(def, 1);
+		if (strcmp(def->defname, "copy_max_errors") == 0)
+			cassValidateIntOption(def, 0);
+		if (strcmp(def->defname, "batch_type") == 0 &&
+			!batch_type_from_string(defGetString(def), NULL))
+			ereport(ERROR,
+			        (errcode(ERRCODE_SYNTAX_ERROR),
+			         errmsg("invalid value for option \"%s\": \"%s\"",
+			                def->defname, defGetString(def)),
+			         errhint("Valid values are \"unlogged\" and \"logged\".")));
+		if (strcmp(def->defname, "io_threads") == 0 ||
+			strcmp(def->defname, "core_connections") == 0 ||
+			strcmp(def->defname, "connect_timeout") == 0 ||
+			strcmp(def->defname, "request_timeout") == 0)
+			cassValidateIntOption(def, 1);
+		if (strcmp(def->defname, "token_aware") == 0 ||
+			strcmp(def->defname, "latency_aware") == 0)
+			(void) defGetBoolean(def);
+		if (strcmp(def->defname, "local_dc") == 0)
+		{
+			if (defGetString(def)[0] == '\0')
+				ereport(ERROR,
+				        (errcode(ERRCODE_SYNTAX_ERROR),
+				         errmsg("local_dc must not be empty")));
+			svr_local_dc = true;
+		}
+		if (strcmp(def->defname, "used_hosts_per_remote_dc") == 0)
+		{
+			cassValidateIntOption(def, 0);
+			svr_remote_hosts = true;
+		}
 	}
 
+	if (svr_remote_hosts && !svr_local_dc)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("used_hosts_per_remote_dc requires local_dc")));
+
 	if (catalog == ForeignServerRelationId && svr_host == NULL)
 		ereport(ERROR,
 				(errcode(ERRCODE_SYNTAX_ERROR),
@@ -551,6 +972,28 @@ consistency_from_string(const char *s)
 	else return CASS_CONSISTENCY_UNKNOWN;
 }
 
+/*
+ * Check that an integer-valued option is a number no smaller than minval.
+ */
+static void
+cassValidateIntOption(DefElem *def, int minval)
+{
+	char	   *value = defGetString(def);
+	char	   *endp;
+	long		ival;
+
+	errno = 0;
+	ival = strtol(value, &endp, 10);
+	if (endp == value || *endp != '\0' || errno != 0 ||
+		ival < minval || ival > PG_INT32_MAX)
+		ereport(ERROR,
+		        (errcode(ERRCODE_SYNTAX_ERROR),
+		         errmsg("invalid value for option \"%s\": \"%s\"",
+		                def->defname, value),
+		         errhint("Valid values are integers no smaller than %d.",
+		                 minval)));
+}
+
 
 /*
  * Check if the provided option is one of the valid options.
@@ -673,7 +1116,7 @@ cassGetPKOption(Oid foreigntableid,
  * Fetch the read_consistency option for a FOREIGN TABLE without returning the
  * remaining options; the read_consistency is the only one needed for certain calls
  */
-static void
+void
 cassGetReadConsistencyOption(Oid foreigntableid,
                 CassConsistency *read_consistency)
 {
@@ -729,476 +1172,1929 @@ cassGetWriteConsistencyOption(Oid foreigntableid,
 	}
 }
 
-
 /*
- * cassGetForeignRelSize
- *		Obtain relation size estimates for a foreign table
+ * Fetch an integer-valued option for a FOREIGN TABLE.  Such options may be
+ * set on the SERVER and overridden on the FOREIGN TABLE; defval is returned
+ * when neither sets it.
  */
-static void
-cassGetForeignRelSize(PlannerInfo *root,
-					  RelOptInfo *baserel,
-					  Oid foreigntableid)
+int
+cassGetIntOption(Oid foreigntableid, const char *optname, int defval)
 {
-	CassFdwPlanState *fpinfo;
-	ListCell   *lc;
-
-	elog(DEBUG1, CSTAR_FDW_NAME
-	     ": get foreign rel size for relation ID %d", foreigntableid);
+	ForeignTable  *table;
+	ForeignServer *server;
+	List          *options;
+	ListCell      *lc;
+	int            value = defval;
 
-	fpinfo = (CassFdwPlanState *) palloc0(sizeof(CassFdwPlanState));
-	baserel->fdw_private = (void *) fpinfo;
+	table = GetForeignTable(foreigntableid);
+	server = GetForeignServer(table->serverid);
 
-	/*
-	 * Identify which baserestrictinfo clauses can be sent to the remote
-	 * server and which can't.
-	 */
-	cassClassifyConditions(root, baserel, baserel->baserestrictinfo,
-					   &fpinfo->remote_conds, &fpinfo->local_conds);
+	/* Table options come last so that they take precedence. */
+	options = NIL;
+	options = list_concat(options, server->options);
+	options = list_concat(options, table->options);
 
-	fpinfo->attrs_used = NULL;
-	pull_varattnos((Node *) baserel->reltarget->exprs, baserel->relid,
-				   &fpinfo->attrs_used);
-	foreach(lc, fpinfo->local_conds)
+	foreach(lc, options)
 	{
-		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		DefElem *def = (DefElem *) lfirst(lc);
 
-		pull_varattnos((Node *) rinfo->clause, baserel->relid,
-					   &fpinfo->attrs_used);
+		if (strcmp(def->defname, optname) == 0)
+		{
+			value = strtol(defGetString(def), NULL, 10);
+		}
 	}
 
-	/* Fetch options  */
+	return value;
+}
 
-	/* Estimate relation size */
-	{
-		/*
-		 * If the foreign table has never been ANALYZEd, it will have relpages
-		 * and reltuples equal to zero, which most likely has nothing to do
-		 * with reality.  We can't do a whole lot about that if we're not
-		 * allowed to consult the remote server, but we can use a hack similar
-		 * to plancat.c's treatment of empty relations: use a minimum size
-		 * estimate of 10 pages, and divide by the column-datatype-based width
-		 * estimate to get the corresponding number of tuples.
-		 */
-		if (baserel->pages == 0 && baserel->tuples == 0)
-		{
-			baserel->pages = 10;
-			baserel->tuples =
-				(10 * BLCKSZ) / (baserel->reltarget->width + sizeof(HeapTupleHeaderData));
+/*
+ * Fetch a string-valued option for a FOREIGN TABLE, which may be set on the
+ * SERVER and overridden on the FOREIGN TABLE.  Returns NULL when neither
+ * sets it.
+ */
+static char *
+cassGetStringOption(Oid foreigntableid, const char *optname)
+{
+	ForeignTable  *table;
+	ForeignServer *server;
+	List          *options;
+	ListCell      *lc;
+	char          *value = NULL;
 
-		}
+	table = GetForeignTable(foreigntableid);
+	server = GetForeignServer(table->serverid);
 
-		/* Estimate baserel size as best we can with local statistics. */
-		set_baserel_size_estimates(root, baserel);
+	/* Table options come last so that they take precedence. */
+	options = NIL;
+	options = list_concat(options, server->options);
+	options = list_concat(options, table->options);
 
-		/* Fill in basically-bogus cost estimates for use later. */
-		estimate_path_cost_size(root, baserel, NIL,
-								&fpinfo->rows, &fpinfo->width,
-								&fpinfo->startup_cost, &fpinfo->total_cost);
+	foreach(lc, options)
+	{
+		DefElem *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, optname) == 0)
+			value = defGetString(def);
 	}
-}
 
-static void
-estimate_path_cost_size(PlannerInfo *root,
-						RelOptInfo *baserel,
-						List *join_conds,
-						double *p_rows, int *p_width,
-						Cost *p_startup_cost, Cost *p_total_cost)
-{
-	*p_rows = baserel->rows;
-	*p_width = baserel->reltarget->width;
-	*p_startup_cost = DEFAULT_FDW_STARTUP_COST;
-	*p_total_cost = DEFAULT_FDW_TUPLE_COST * 100;
+	return value;
 }
 
 /*
- * cassGetForeignPaths
- *		(9.2+) Get the foreign paths
+ * Parse a batch_type option value, case-insensitively.  Returns false if it
+ * is not one; otherwise stores the batch type in *type unless it is NULL.
  */
-static void
-cassGetForeignPaths(PlannerInfo *root,
-					RelOptInfo *baserel,
-					Oid foreigntableid)
+static bool
+batch_type_from_string(const char *s, CassBatchType *type)
 {
-	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
-	ForeignPath *path;
+	CassBatchType result;
 
-	elog(DEBUG1, CSTAR_FDW_NAME
-	     ": get foreign paths for relation ID %d", foreigntableid);
-
-	/*
-	 * Create simplest ForeignScan path node and add it to baserel.  This path
-	 * corresponds to SeqScan path of regular tables (though depending on what
-	 * baserestrict conditions we were able to send to remote, there might
-	 * actually be an indexscan happening there).  We already did all the work
-	 * to estimate cost and size of this path.
-	 */
-	path = create_foreignscan_path(root, baserel,
-								   NULL,
-	                               fpinfo->rows + baserel->rows,
-	                               fpinfo->startup_cost,
-	                               fpinfo->total_cost,
-	                               NIL, /* no pathkeys */
-	                               NULL,		/* no outer rel either */
-	                               NULL,		/* no outer path either */
-	                               NIL);		/* no fdw_private list */
-	add_path(baserel, (Path *) path);
+	if (pg_strcasecmp(s, "unlogged") == 0)
+		result = CASS_BATCH_TYPE_UNLOGGED;
+	else if (pg_strcasecmp(s, "logged") == 0)
+		result = CASS_BATCH_TYPE_LOGGED;
+	else
+		return false;
 
+	if (type)
+		*type = result;
+	return true;
 }
 
 /*
- * cassGetForeignPlan
- *		Create ForeignScan plan node which implements selected best path
+ * Fetch the batch_type option for a FOREIGN TABLE, which may also be set on
+ * the SERVER.  Batches are unlogged by default.
  */
-static ForeignScan *
-cassGetForeignPlan(PlannerInfo *root,
-					   RelOptInfo *baserel,
-					   Oid foreigntableid,
-					   ForeignPath *best_path,
-					   List *tlist,
-					   List *scan_clauses,
-					   Plan *outer_plan
-)
+static CassBatchType
+cassGetBatchTypeOption(Oid foreigntableid)
 {
-	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
-	Index		scan_relid = baserel->relid;
-	List	   *fdw_private;
-	List	   *local_exprs = NIL;
-	StringInfoData sql;
-	List	   *retrieved_attrs;
+	ForeignTable  *table;
+	ForeignServer *server;
+	List          *options;
+	ListCell      *lc;
+	CassBatchType  type = CASS_BATCH_TYPE_UNLOGGED;
 
-	elog(DEBUG1, CSTAR_FDW_NAME
-	     ": get foreign plan for relation ID %d", foreigntableid);
+	table = GetForeignTable(foreigntableid);
+	server = GetForeignServer(table->serverid);
 
-	local_exprs = extract_actual_clauses(scan_clauses, false);
+	/* Table options come last so that they take precedence. */
+	options = NIL;
+	options = list_concat(options, server->options);
+	options = list_concat(options, table->options);
 
-	/*
-	 * Build the query string to be sent for execution, and identify
-	 * expressions to be sent as parameters.
-	 */
-	initStringInfo(&sql);
-	cassDeparseSelectSql(&sql, root, baserel, fpinfo->attrs_used,
-					 &retrieved_attrs);
+	foreach(lc, options)
+	{
+		DefElem *def = (DefElem *) lfirst(lc);
 
-	/*
-	 * Build the fdw_private list that will be available to the executor.
-	 * Items in the list must match enum CassFdwScanPrivateIndex, above.
-	 */
-	fdw_private = list_make2(makeString(sql.data),
-							 retrieved_attrs);
+		if (strcmp(def->defname, "batch_type") == 0)
+			(void) batch_type_from_string(defGetString(def), &type);
+	}
 
-	/*
-	 * Create the ForeignScan node from target list, local filtering
-	 * expressions, remote parameter expressions, and FDW private information.
-	 *
-	 * Note that the remote parameter expressions are stored in the fdw_exprs
-	 * field of the finished plan node; we can't keep them in private state
-	 * because then they wouldn't be subject to later planner processing.
-	 */
-	return make_foreignscan(tlist,
-	                        local_exprs,
-	                        scan_relid,
-	                        NIL,
-	                        fdw_private,
-	                        NIL,
-	                        NIL,
-							NULL);
+	return type;
 }
 
+
 /*
- * cassExplainForeignScan
- *		Produce extra output for EXPLAIN
+ * Fetch the partition key (or, if partition is false, the clustering key)
+ * of a FOREIGN TABLE as an integer List of attribute numbers, in key order.
+ * For the clustering key, *descending receives a parallel integer List that
+ * is true for the columns stored in descending order.
+ *
+ * The partition_key and clustering_key options name the key columns.
+ * Without them, the key is read from the Cassandra schema metadata and
+ * mapped back to the columns of the FOREIGN TABLE.  NIL means the key is
+ * unknown or not fully mapped.
  */
-static void
-cassExplainForeignScan(ForeignScanState *node, ExplainState *es)
+static List *
+cassGetKeyColumns(Oid foreigntableid, bool partition, List **descending)
 {
-	List	   *fdw_private;
-	char	   *sql;
-
-	char	*svr_host = NULL;
-	int		svr_port = 0;
-	char	*svr_username = NULL;
-	char	*svr_password = NULL;
-	char	*svr_query = NULL;
-	char	*svr_table = NULL;
-	char	*primary_key = NULL;
-
-	CassConsistency	read_consistency = DEFAULT_CONSISTENCY_LEVEL;
-	CassConsistency	write_consistency = DEFAULT_CONSISTENCY_LEVEL;
-
+	ForeignTable *table;
+	const char   *optname;
+	ListCell     *lc;
 
-	elog(DEBUG1, CSTAR_FDW_NAME ": explain foreign scan for relation ID %d",
-	     RelationGetRelid(node->ss.ss_currentRelation));
+	table = GetForeignTable(foreigntableid);
+	optname = partition ? OPT_PARTITION_KEY : OPT_CLUSTERING_KEY;
 
-	if (es->verbose)
+	foreach(lc, table->options)
 	{
-		/* Fetch options  */
-		cassGetOptions(RelationGetRelid(node->ss.ss_currentRelation),
-					   &svr_host, &svr_port,
-					   &svr_username, &svr_password,
-					   &svr_query, &svr_table, &primary_key, &read_consistency, &write_consistency);
+		DefElem *def = (DefElem *) lfirst(lc);
 
-		fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
-		sql = strVal(list_nth(fdw_private, CassFdwScanPrivateSelectSql));
-		ExplainPropertyText("Remote SQL", sql, es);
+		if (strcmp(def->defname, optname) == 0)
+			return cassParseColumnList(foreigntableid, def->defname,
+									   defGetString(def), descending);
 	}
-}
 
+	return cassGetKeyFromMetadata(foreigntableid, partition, descending);
+}
 
 /*
- * cassBeginForeignScan
- *		Initiate access to the database
+ * Split a comma-separated list of key columns given in an option into its
+ * column names, downcased unless quoted.  If descending is not NULL, each
+ * name may be followed by ASC or DESC, and *descending receives a parallel
+ * integer List that is true for the DESC columns.
+ *
+ * Returns false on a syntax error.
  */
-static void
-cassBeginForeignScan(ForeignScanState *node, int eflags)
+static bool
+cassSplitKeyList(const char *value, List **names, List **descending)
 {
-	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
-	EState	   *estate = node->ss.ps.state;
-	CassFdwScanState   *fsstate;
-	RangeTblEntry *rte;
-	Oid			userid;
-	ForeignTable *table;
-	ForeignServer *server;
-	UserMapping *user;
-
-	elog(DEBUG1, CSTAR_FDW_NAME ": begin foreign scan for relation ID %d",
-	     RelationGetRelid(node->ss.ss_currentRelation));
+	char	   *item = pstrdup(value);
 
-	/*
-	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
-	 */
-	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-		return;
+	*names = NIL;
+	if (descending)
+		*descending = NIL;
 
-	/*
-	 * We'll save private state in node->fdw_state.
-	 */
-	fsstate = (CassFdwScanState *) palloc0(sizeof(CassFdwScanState));
-	node->fdw_state = (void *) fsstate;
+	for (;;)
+	{
+		char	   *next = strchr(item, ',');
+		char	   *word;
+		List	   *itemnames;
+		bool		desc = false;
+		int			len;
+
+		if (next)
+			*next++ = '\0';
+
+		/* Look for a trailing ASC or DESC, separated by whitespace. */
+		len = strlen(item);
+		while (len > 0 && scanner_isspace(item[len - 1]))
+			len--;
+		item[len] = '\0';
+		word = item + len;
+		while (word > item && !scanner_isspace(word[-1]))
+			word--;
+		if (descending && word > item)
+		{
+			if (pg_strcasecmp(word, "desc") == 0)
+			{
+				desc = true;
+				*word = '\0';
+			}
+			else if (pg_strcasecmp(word, "asc") == 0)
+				*word = '\0';
+		}
 
-	/*
-	 * Identify which user to do the remote access as.  This should match what
-	 * ExecCheckRTEPerms() does.
-	 */
-	rte = rt_fetch(fsplan->scan.scanrelid, estate->es_range_table);
-	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+		if (!SplitIdentifierString(item, ',', &itemnames) ||
+			list_length(itemnames) != 1)
+			return false;
+		*names = list_concat(*names, itemnames);
+		if (descending)
+			*descending = lappend_int(*descending, desc);
 
-	/* Get info about foreign table. */
-	fsstate->rel = node->ss.ss_currentRelation;
-	table = GetForeignTable(RelationGetRelid(fsstate->rel));
-	server = GetForeignServer(table->serverid);
-	user = GetUserMapping(userid, server->serverid);
+		if (next == NULL)
+			break;
+		item = next;
+	}
 
-	/*
-	 * Get connection to the foreign server.  Connection manager will
-	 * establish new connection if necessary.
-	 */
-	fsstate->cass_conn = pgcass_GetConnection(server, user, false);
-	fsstate->sql_sended = false;
+	return true;
+}
 
-	cassGetReadConsistencyOption(RelationGetRelid(fsstate->rel), &fsstate->read_consistency);
+/*
+ * Turn a comma-separated list of column names given in an option into an
+ * integer List of attribute numbers.  See cassSplitKeyList() for the syntax.
+ */
+static List *
+cassParseColumnList(Oid foreigntableid, const char *optname, const char *value,
+					List **descending)
+{
+	List	   *names;
+	List	   *attnums = NIL;
+	ListCell   *lc;
 
-	/* Get private info created by planner functions. */
-	fsstate->query = strVal(list_nth(fsplan->fdw_private,
-									 CassFdwScanPrivateSelectSql));
-	fsstate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
-											   CassFdwScanPrivateRetrievedAttrs);
+	if (!cassSplitKeyList(value, &names, descending))
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("invalid list syntax in option \"%s\"", optname)));
 
-	/* Create contexts for batches of tuples and per-tuple temp workspace. */
-	fsstate->batch_cxt = AllocSetContextCreate(estate->es_query_cxt,
-											   "cassandra_fdw tuple data",
-											   ALLOCSET_DEFAULT_MINSIZE,
-											   ALLOCSET_DEFAULT_INITSIZE,
-											   ALLOCSET_DEFAULT_MAXSIZE);
+	foreach(lc, names)
+	{
+		char	   *name = (char *) lfirst(lc);
+		AttrNumber	attnum = get_attnum(foreigntableid, name);
 
-	fsstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
-											  "cassandra_fdw temporary data",
-											  ALLOCSET_SMALL_MINSIZE,
-											  ALLOCSET_SMALL_INITSIZE,
-											  ALLOCSET_SMALL_MAXSIZE);
+		if (attnum == InvalidAttrNumber)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" named in option \"%s\" does not exist",
+							name, optname)));
+		attnums = lappend_int(attnums, attnum);
+	}
 
-	/* Get info we'll need for input data conversion. */
-	fsstate->attinmeta = TupleDescGetAttInMetadata(RelationGetDescr(fsstate->rel));
+	return attnums;
 }
 
-
 /*
- * cassIterateForeignScan
- *		Read next record from the data file and store it into the
- *		ScanTupleSlot as a virtual tuple
+ * Key columns of the foreign tables read from the Cassandra schema metadata,
+ * kept for the session until the FOREIGN TABLE changes (initialized on first
+ * use).  Planning thus reaches Cassandra at most once per table.
  */
-static TupleTableSlot*
-cassIterateForeignScan(ForeignScanState *node)
+typedef struct CassKeyCacheEntry
 {
-	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
-	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	Oid			relid;			/* hash key (must be first) */
+	List	   *partition_attrs;
+	List	   *clustering_attrs;
+	List	   *clustering_desc;
+} CassKeyCacheEntry;
 
-	/*
-	 * If this is the first call after Begin or ReScan, we need to create the
-	 * cursor on the remote side.
-	 */
-	if (!fsstate->sql_sended)
-		create_cursor(node);
+static HTAB *KeyCache = NULL;
 
-	/*
-	 * Get some more tuples, if we've run out.
-	 */
-	if (fsstate->next_tuple >= fsstate->num_tuples)
+/*
+ * Look up the partition key (or, if partition is false, the clustering key
+ * and its order) of the remote table in the key cache, reading the Cassandra
+ * schema metadata the first time.  Returns NIL if the key is unknown.
+ */
+static List *
+cassGetKeyFromMetadata(Oid foreigntableid, bool partition, List **descending)
+{
+	CassKeyCacheEntry *entry;
+
+	/* First time through, initialize the key cache hashtable */
+	if (KeyCache == NULL)
 	{
-		/* No point in another fetch if we already detected EOF, though. */
-		if (!fsstate->eof_reached)
-			fetch_more_data(node);
-		/* If we didn't get any tuples, must be end of data. */
-		if (fsstate->next_tuple >= fsstate->num_tuples)
-			return ExecClearTuple(slot);
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(CassKeyCacheEntry);
+		ctl.hcxt = CacheMemoryContext;
+		KeyCache = hash_create("cassandra_fdw key columns", 64, &ctl,
+							   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		CacheRegisterRelcacheCallback(cassInvalidateKeyCache, (Datum) 0);
+		CacheRegisterSyscacheCallback(FOREIGNTABLEREL,
+									  cassInvalidateKeyCacheAll, (Datum) 0);
 	}
 
-	/*
-	 * Return the next tuple.
-	 */
-#if PG_VERSION_NUM < 120000
-	ExecStoreTuple(
-		fsstate->tuples[fsstate->next_tuple++],
-		slot, InvalidBuffer, false);
-#else
-	ExecStoreHeapTuple(
-		fsstate->tuples[fsstate->next_tuple++],
-		slot, false);
-#endif
+	entry = (CassKeyCacheEntry *) hash_search(KeyCache, &foreigntableid,
+											  HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		List	   *partition_attrs;
+		List	   *clustering_attrs;
+		List	   *clustering_desc;
+		MemoryContext oldcontext;
+
+		/* Only add the entry once the metadata has been read successfully. */
+		cassReadKeyMetadata(foreigntableid, &partition_attrs,
+							&clustering_attrs, &clustering_desc);
+
+		entry = (CassKeyCacheEntry *) hash_search(KeyCache, &foreigntableid,
+												  HASH_ENTER, NULL);
+		oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
+		entry->partition_attrs = list_copy(partition_attrs);
+		entry->clustering_attrs = list_copy(clustering_attrs);
+		entry->clustering_desc = list_copy(clustering_desc);
+		MemoryContextSwitchTo(oldcontext);
+	}
 
-	return slot;
+	if (descending)
+		*descending = partition ? NIL : list_copy(entry->clustering_desc);
+	return list_copy(partition ? entry->partition_attrs :
+					 entry->clustering_attrs);
 }
 
 /*
- * cassReScanForeignScan
- *		Rescan table, possibly with new parameters
+ * Drop the cached key of a relation that changed, or of all of them.
  */
 static void
-cassReScanForeignScan(ForeignScanState *node)
+cassInvalidateKeyCache(Datum arg, Oid relid)
 {
-	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
-
-	elog(DEBUG1, CSTAR_FDW_NAME ": re-scan for foreign relation ID %d",
-	     RelationGetRelid(node->ss.ss_currentRelation));
-
-	/* If we haven't created the cursor yet, nothing to do. */
-	if (!fsstate->sql_sended)
-		return;
+	HASH_SEQ_STATUS scan;
+	CassKeyCacheEntry *entry;
 
+	hash_seq_init(&scan, KeyCache);
+	while ((entry = (CassKeyCacheEntry *) hash_seq_search(&scan)) != NULL)
 	{
-		/* Easy: just rescan what we already have in memory, if anything */
-		fsstate->next_tuple = 0;
-		return;
-	}
+		if (OidIsValid(relid) && entry->relid != relid)
+			continue;
 
-	/* Now force a fresh FETCH. */
-	fsstate->tuples = NULL;
-	fsstate->num_tuples = 0;
-	fsstate->next_tuple = 0;
-	fsstate->fetch_ct_2 = 0;
-	fsstate->eof_reached = false;
+		list_free(entry->partition_attrs);
+		list_free(entry->clustering_attrs);
+		list_free(entry->clustering_desc);
+		hash_search(KeyCache, &entry->relid, HASH_REMOVE, NULL);
+	}
 }
 
 /*
- * cassEndForeignScan
- *		Finish scanning foreign table and dispose objects used for this scan
+ * Drop all cached keys when the options of a FOREIGN TABLE change, since
+ * they name the remote table.
  */
 static void
-cassEndForeignScan(ForeignScanState *node)
+cassInvalidateKeyCacheAll(Datum arg, int cacheid, uint32 hashvalue)
 {
-	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
-
-	elog(DEBUG1, CSTAR_FDW_NAME ": end foreign scan for relation ID %d",
-	     RelationGetRelid(node->ss.ss_currentRelation));
-
-	/* if fsstate is NULL, we are in EXPLAIN; nothing to do */
-	if (fsstate == NULL)
-		return;
-
-	/* Close the cursor if open, to prevent accumulation of cursors */
-	if (fsstate->sql_sended)
-		close_cursor(fsstate);
-
-	/* Release remote connection */
-	pgcass_ReleaseConnection(fsstate->cass_conn);
-	fsstate->cass_conn = NULL;
+	cassInvalidateKeyCache(arg, InvalidOid);
+}
 
-	/* MemoryContexts will be deleted automatically. */
+/*
+ * Whether values of a PostgreSQL type are bound with the encoding Cassandra
+ * expects for a key column of cass_type, and compare the same way there.
+ * Types that only convert on reading, like int over bigint, or that
+ * Cassandra validates further, like ascii and timeuuid, don't qualify.
+ */
+static bool
+cassIsKeyTypeMatch(Oid type, CassValueType cass_type)
+{
+	switch (type)
+	{
+		case INT2OID:
+			return cass_type == CASS_VALUE_TYPE_SMALL_INT;
+		case INT4OID:
+			return cass_type == CASS_VALUE_TYPE_INT;
+		case INT8OID:
+			return cass_type == CASS_VALUE_TYPE_BIGINT;
+		case FLOAT4OID:
+			return cass_type == CASS_VALUE_TYPE_FLOAT;
+		case FLOAT8OID:
+			return cass_type == CASS_VALUE_TYPE_DOUBLE;
+		case BOOLOID:
+			return cass_type == CASS_VALUE_TYPE_BOOLEAN;
+		case TEXTOID:
+		case VARCHAROID:
+			return cass_type == CASS_VALUE_TYPE_TEXT ||
+				cass_type == CASS_VALUE_TYPE_VARCHAR;
+		case UUIDOID:
+			return cass_type == CASS_VALUE_TYPE_UUID;
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			return cass_type == CASS_VALUE_TYPE_TIMESTAMP;
+		default:
+			return false;
+	}
 }
 
 /*
- * cassAddForeignUpdateTargets
- * 		Add the PRIMARY KEY column as resjunk entry.
+ * Read the partition key, and the clustering key and its order, of the
+ * remote table from the Cassandra schema metadata, and map each column to
+ * the attribute of the same name.  The partition key is returned as NIL if
+ * the table is not found or a key column is not part of the FOREIGN TABLE.
+ * The clustering key is cut short at the first such column.
+ *
+ * Restrictions on key columns are sent to Cassandra as bound values of the
+ * column's PostgreSQL type, so a column whose type does not match the
+ * Cassandra one exactly counts as missing: its restrictions stay local.
  */
 static void
-cassAddForeignUpdateTargets(Query *parsetree,
-							RangeTblEntry *target_rte,
-							Relation target_relation)
+cassReadKeyMetadata(Oid foreigntableid, List **partition_attrs,
+					List **clustering_attrs, List **clustering_desc)
 {
-	Oid         relid        = RelationGetRelid(target_relation);
-	TupleDesc   tupdesc      = target_relation->rd_att;
-	const char *primary_key = NULL;
-	bool		has_PK       = false;
-	int         i;
+	ForeignTable *table;
+	ForeignServer *server;
+	UserMapping *user;
+	CassSession *session;
+	const CassSchemaMeta *schema_meta;
+	const CassKeyspaceMeta *keyspace_meta;
+	const CassTableMeta *table_meta = NULL;
+	const char *nspname = NULL;
+	const char *relname = NULL;
+	Relation	rel;
+	TupleDesc	tupdesc;
+	int			pass;
+	ListCell   *lc;
 
-	elog(DEBUG1, CSTAR_FDW_NAME
-	     ": add target column(s) for write on relation ID %d", relid);
+	*partition_attrs = NIL;
+	*clustering_attrs = NIL;
+	*clustering_desc = NIL;
 
-	cassGetPKOption(relid, &primary_key);
+	table = GetForeignTable(foreigntableid);
+	server = GetForeignServer(table->serverid);
+	user = GetUserMapping(GetUserId(), server->serverid);
 
-	if (primary_key == NULL)
+	foreach(lc, table->options)
 	{
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				 errmsg("No PRIMARY KEY specified for the FOREIGN TABLE "
-						"'%s.%s'.",
-						pstrdup(get_namespace_name(RelationGetNamespace(
-														  target_relation))),
-						pstrdup(RelationGetRelationName(target_relation))),
-				 errdetail("For UPDATE or DELETE, a PRIMARY KEY must be "
-						   "defined for the FOREIGN TABLE."),
-				 errhint("Set the FOREIGN TABLE OPTION '%s' to a "
-						 "PRIMARY KEY column.",
-						 OPT_PK)));
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "schema_name") == 0)
+			nspname = defGetString(def);
+		else if (strcmp(def->defname, "table_name") == 0)
+			relname = defGetString(def);
 	}
+	if (nspname == NULL)
+		nspname = get_namespace_name(get_rel_namespace(foreigntableid));
+	if (relname == NULL)
+		relname = get_rel_name(foreigntableid);
 
-	/*
-	 * Loop through all columns of the FOREIGN TABLE to determine the PK
-	 * attribute to be added as hidden target column for UPDATE and DELETE
-	 * statements.
-	 */
-	for (i = 0; i < tupdesc->natts; ++i)
+	session = pgcass_GetConnection(server, user, false);
+	schema_meta = cass_session_get_schema_meta(session);
+
+	keyspace_meta = cass_schema_meta_keyspace_by_name(schema_meta, nspname);
+	if (keyspace_meta)
+		table_meta = cass_keyspace_meta_table_by_name(keyspace_meta, relname);
+	if (table_meta == NULL)
 	{
-#if PG_VERSION_NUM < 110000
-		Form_pg_attribute att = tupdesc->attrs[i];
+		cass_schema_meta_free(schema_meta);
+		return;
+	}
+
+#if PG_VERSION_NUM < 120000
+	rel = heap_open(foreigntableid, NoLock);
 #else
-		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+	rel = table_open(foreigntableid, NoLock);
 #endif
-		AttrNumber attrno = att->attnum;
+	tupdesc = RelationGetDescr(rel);
 
-		if (strncmp(NameStr(att->attname), primary_key, strlen(primary_key))
-			== 0)
+	/* The partition key first, then the clustering key. */
+	for (pass = 0; pass < 2; pass++)
+	{
+		bool		partition = (pass == 0);
+		List	   *attnums = NIL;
+		List	   *desc = NIL;
+		size_t		nkeys;
+		size_t		k;
+
+		nkeys = partition ? cass_table_meta_partition_key_count(table_meta) :
+			cass_table_meta_clustering_key_count(table_meta);
+		for (k = 0; k < nkeys; k++)
 		{
-			Var *var;
-			TargetEntry *tle;
+			const CassColumnMeta *column_meta;
+			const char *keyname;
+			size_t		keyname_length;
+			CassValueType cass_type;
+			AttrNumber	attnum = InvalidAttrNumber;
+			int			i;
+
+			column_meta = partition ? cass_table_meta_partition_key(table_meta, k) :
+				cass_table_meta_clustering_key(table_meta, k);
+			cass_column_meta_name(column_meta, &keyname, &keyname_length);
+			cass_type = cass_data_type_type(cass_column_meta_data_type(column_meta));
+
+			for (i = 1; i <= tupdesc->natts && attnum == InvalidAttrNumber; i++)
+			{
+#if PG_VERSION_NUM < 110000
+				Form_pg_attribute attr = tupdesc->attrs[i - 1];
+#else
+				Form_pg_attribute attr = TupleDescAttr(tupdesc, i - 1);
+#endif
+				const char *colname = NameStr(attr->attname);
 
-			/* Make a Var representing the desired value */
-			var = makeVar(parsetree->resultRelation,
-			              attrno,
-			              att->atttypid,
-			              att->atttypmod,
-			              att->attcollation,
-			              0);
+				if (attr->attisdropped)
+					continue;
 
-			/* Wrap it in a resjunk TLE with the right name ... */
-			tle = makeTargetEntry((Expr *)var,
-			                      list_length(parsetree->targetList) + 1,
-			                      pstrdup(NameStr(att->attname)),
-			                      true);
+				if (strlen(colname) == keyname_length &&
+					strncmp(colname, keyname, keyname_length) == 0 &&
+					cassIsKeyTypeMatch(attr->atttypid, cass_type))
+					attnum = i;
+			}
 
-			/* ... and add it to the query's targetlist */
-			parsetree->targetList = lappend(parsetree->targetList, tle);
+			if (attnum == InvalidAttrNumber)
+			{
+				/* A leading part of the clustering key is still usable. */
+				if (partition)
+					attnums = NIL;
+				break;
+			}
+			attnums = lappend_int(attnums, attnum);
+			desc = lappend_int(desc,
+							   !partition &&
+							   cass_table_meta_clustering_key_order(table_meta, k) ==
+							   CASS_CLUSTERING_ORDER_DESC);
+		}
 
-			has_PK = true;
+		if (partition)
+			*partition_attrs = attnums;
+		else
+		{
+			*clustering_attrs = attnums;
+			*clustering_desc = desc;
+		}
+	}
+
+#if PG_VERSION_NUM < 120000
+	heap_close(rel, NoLock);
+#else
+	table_close(rel, NoLock);
+#endif
+	cass_schema_meta_free(schema_meta);
+}
+
+/*
+ * cassHasMurmur3Tokens
+ *		Whether the cluster holding a foreign table uses Murmur3Partitioner,
+ *		whose token ring cassTokenRangeBounds splits.
+ *
+ * This asks the cluster, once per connection, so it is only called for
+ * tables that set token_ranges.
+ */
+static bool
+cassHasMurmur3Tokens(Oid foreigntableid)
+{
+	ForeignTable *table = GetForeignTable(foreigntableid);
+	ForeignServer *server = GetForeignServer(table->serverid);
+	UserMapping *user = GetUserMapping(GetUserId(), server->serverid);
+	CassSession *session = pgcass_GetConnection(server, user, false);
+	const char *partitioner = pgcass_GetPartitioner(session);
+	const char *name = strrchr(partitioner, '.');
+
+	return strcmp(name ? name + 1 : partitioner, "Murmur3Partitioner") == 0;
+}
+
+/*
+ * cassGetForeignRelSize
+ *		Obtain relation size estimates for a foreign table
+ */
+static void
+cassGetForeignRelSize(PlannerInfo *root,
+					  RelOptInfo *baserel,
+					  Oid foreigntableid)
+{
+	CassFdwPlanState *fpinfo;
+	ListCell   *lc;
+
+	elog(DEBUG1, CSTAR_FDW_NAME
+	     ": get foreign rel size for relation ID %d", foreigntableid);
+
+	fpinfo = (CassFdwPlanState *) palloc0(sizeof(CassFdwPlanState));
+	baserel->fdw_private = (void *) fpinfo;
+
+	/*
+	 * Identify which baserestrictinfo clauses can be sent to the remote
+	 * server and which can't.
+	 */
+	fpinfo->partition_attrs = cassGetKeyColumns(foreigntableid, true, NULL);
+	fpinfo->clustering_attrs = cassGetKeyColumns(foreigntableid, false,
+												 &fpinfo->clustering_desc);
+	fpinfo->per_partition_limit = cassGetIntOption(foreigntableid,
+												   "per_partition_limit", 0);
+	fpinfo->token_ranges = cassGetIntOption(foreigntableid,
+											"token_ranges", 0);
+
+	/*
+	 * The token ranges split the Murmur3 token ring.  Under any other
+	 * partitioner, token() takes values outside of them and a scan by
+	 * ranges would miss rows, so the table is then only read whole.
+	 */
+	if (fpinfo->token_ranges > 0 && fpinfo->partition_attrs != NIL &&
+		!cassHasMurmur3Tokens(foreigntableid))
+	{
+		elog(DEBUG1, CSTAR_FDW_NAME
+			 ": ignoring token_ranges of relation ID %d, whose cluster does "
+			 "not use Murmur3Partitioner", foreigntableid);
+		fpinfo->token_ranges = 0;
+	}
+
+	cassClassifyConditions(root, baserel, baserel->baserestrictinfo,
+					   fpinfo->partition_attrs, fpinfo->clustering_attrs,
+					   &fpinfo->remote_conds, &fpinfo->local_conds);
+
+	fpinfo->attrs_used = NULL;
+	pull_varattnos((Node *) baserel->reltarget->exprs, baserel->relid,
+				   &fpinfo->attrs_used);
+	foreach(lc, fpinfo->local_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		pull_varattnos((Node *) rinfo->clause, baserel->relid,
+					   &fpinfo->attrs_used);
+	}
+
+	/* Fetch options  */
+
+	/* Estimate relation size */
+	{
+		/*
+		 * If the foreign table has never been ANALYZEd, it will have relpages
+		 * and reltuples equal to zero (reltuples < 0, meaning "unknown", as
+		 * of Postgres 14), which most likely has nothing to do with reality.
+		 * We can't do a whole lot about that if we're not allowed to consult
+		 * the remote server, but we can use a hack similar to plancat.c's
+		 * treatment of empty relations: use a minimum size estimate of 10
+		 * pages, and divide by the column-datatype-based width estimate to
+		 * get the corresponding number of tuples.
+		 */
+#if PG_VERSION_NUM >= 140000
+		if (baserel->tuples < 0)
+#else
+		if (baserel->pages == 0 && baserel->tuples == 0)
+#endif
+		{
+			baserel->pages = 10;
+			baserel->tuples =
+				(10 * BLCKSZ) / (baserel->reltarget->width + sizeof(HeapTupleHeaderData));
+
+		}
+
+		/* Estimate baserel size as best we can with local statistics. */
+		set_baserel_size_estimates(root, baserel);
+
+		/* Fill in basically-bogus cost estimates for use later. */
+		estimate_path_cost_size(root, baserel, NIL,
+								&fpinfo->rows, &fpinfo->width,
+								&fpinfo->startup_cost, &fpinfo->total_cost);
+	}
+}
+
+static void
+estimate_path_cost_size(PlannerInfo *root,
+						RelOptInfo *baserel,
+						List *join_conds,
+						double *p_rows, int *p_width,
+						Cost *p_startup_cost, Cost *p_total_cost)
+{
+	*p_rows = baserel->rows;
+	*p_width = baserel->reltarget->width;
+	*p_startup_cost = DEFAULT_FDW_STARTUP_COST;
+	*p_total_cost = *p_startup_cost +
+		(cpu_tuple_cost + DEFAULT_FDW_TUPLE_COST) * baserel->rows;
+}
+
+/*
+ * cassGetForeignPaths
+ *		(9.2+) Get the foreign paths
+ */
+static void
+cassGetForeignPaths(PlannerInfo *root,
+					RelOptInfo *baserel,
+					Oid foreigntableid)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
+	ForeignPath *path;
+
+	elog(DEBUG1, CSTAR_FDW_NAME
+	     ": get foreign paths for relation ID %d", foreigntableid);
+
+	/*
+	 * Create simplest ForeignScan path node and add it to baserel.  This path
+	 * corresponds to SeqScan path of regular tables (though depending on what
+	 * baserestrict conditions we were able to send to remote, there might
+	 * actually be an indexscan happening there).  We already did all the work
+	 * to estimate cost and size of this path.
+	 */
+	path = create_foreignscan_path(root, baserel,
+								   NULL,
+	                               fpinfo->rows + baserel->rows,
+	                               fpinfo->startup_cost,
+	                               fpinfo->total_cost,
+	                               NIL, /* no pathkeys */
+	                               NULL,		/* no outer rel either */
+	                               NULL,		/* no outer path either */
+	                               NIL);		/* no fdw_private list */
+	add_path(baserel, (Path *) path);
+
+	/*
+	 * Within a single partition, rows come back in clustering order, or in
+	 * reverse with ORDER BY.  If that is the order the query wants, offer a
+	 * path saying so, which spares a local Sort.
+	 */
+	{
+		bool		reverse;
+
+		if (cassPathkeysMatchClustering(root, baserel, root->query_pathkeys,
+										&reverse))
+		{
+			path = create_foreignscan_path(root, baserel,
+										   NULL,
+										   fpinfo->rows + baserel->rows,
+										   fpinfo->startup_cost,
+										   fpinfo->total_cost,
+										   root->query_pathkeys,
+										   NULL,
+										   NULL,
+										   cassMakePathPrivate(-1, -1, reverse, false));
+			add_path(baserel, (Path *) path);
+		}
+	}
+
+	/* Offer to read just the partitions a join asks for. */
+	cassAddParamPaths(root, baserel);
+
+	/* Offer to split a scan of the whole table among parallel workers. */
+	cassAddParallelPath(root, baserel);
+}
+
+/*
+ * Whether rel is a foreign table of this FDW.
+ */
+bool
+cassIsForeignRel(RelOptInfo *rel)
+{
+	return rel->reloptkind == RELOPT_BASEREL &&
+		rel->fdwroutine != NULL &&
+		rel->fdwroutine->GetForeignRelSize == cassGetForeignRelSize;
+}
+
+/*
+ * cassGetForeignUpperPaths
+ *		Add paths for post-join operations like aggregation, grouping etc. if
+ *		corresponding operations are safe to push down.
+ */
+static void
+cassGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+						 RelOptInfo *input_rel, RelOptInfo *output_rel,
+						 void *extra)
+{
+	/*
+	 * If input rel is not safe to pushdown, then simply return as we cannot
+	 * perform any post-join operations on the foreign server.
+	 */
+	if (!input_rel->fdw_private)
+		return;
+
+	switch (stage)
+	{
+#if PG_VERSION_NUM >= 120000
+		case UPPERREL_GROUP_AGG:
+			add_foreign_grouping_paths(root, input_rel, output_rel,
+									   (GroupPathExtraData *) extra);
+			break;
+		case UPPERREL_DISTINCT:
+			add_foreign_distinct_paths(root, input_rel, output_rel);
+			break;
+		case UPPERREL_ORDERED:
+			add_foreign_ordered_paths(root, input_rel, output_rel);
+			break;
+		case UPPERREL_FINAL:
+			add_foreign_final_paths(root, input_rel, output_rel,
+									(FinalPathExtraData *) extra);
+			break;
+#endif
+		default:
+			break;
+	}
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * add_foreign_grouping_paths
+ *		Add a ForeignPath that has Cassandra compute the query's aggregates,
+ *		if it can compute all of them.
+ *
+ * Cassandra must see every row the query aggregates, so all of the table's
+ * conditions have to be pushed down.  Without GROUP BY, they must select a
+ * single statement's rows.  CQL only groups by a prefix of the primary key
+ * that covers the partition key; the groups of a partition key compared
+ * with "= ANY" then come from one statement per partition.
+ */
+static void
+add_foreign_grouping_paths(PlannerInfo *root, RelOptInfo *input_rel,
+						   RelOptInfo *grouped_rel,
+						   GroupPathExtraData *extra)
+{
+	Query	   *parse = root->parse;
+	PathTarget *grouping_target = grouped_rel->reltarget;
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) input_rel->fdw_private;
+	CassFdwPlanState *gfpinfo;
+	List	   *tlist = NIL;
+	List	   *grouped = NIL;
+	List	   *group_exprs = NIL;
+	List	   *group_attrs = NIL;
+	double		rows = 1;
+	ForeignPath *grouppath;
+	ListCell   *lc;
+	int			i;
+
+	if (!IS_SIMPLE_REL(input_rel) || fpinfo->scan_rel != NULL)
+		return;
+	if (extra->patype == PARTITIONWISE_AGGREGATE_PARTIAL)
+		return;
+
+	/* Cassandra would limit the groups, not the rows aggregated. */
+	if (fpinfo->per_partition_limit > 0)
+		return;
+	if (parse->groupingSets != NIL || parse->havingQual != NULL)
+		return;
+
+	if (fpinfo->local_conds != NIL)
+		return;
+
+	/* The grouping columns are returned as they are. */
+	i = 0;
+	foreach(lc, grouping_target->exprs)
+	{
+		Expr	   *expr = (Expr *) lfirst(lc);
+		Index		sgref = get_pathtarget_sortgroupref(grouping_target, i);
+		SortGroupClause *sgc;
+
+		i++;
+		if (sgref == 0 ||
+			(sgc = get_sortgroupref_clause_noerr(sgref,
+												 parse->groupClause)) == NULL)
+			continue;
+		if (!cassIsGroupingColumn(input_rel, expr, sgc))
+			return;
+		grouped = lappend_int(grouped, ((Var *) expr)->varattno);
+		group_exprs = lappend(group_exprs, expr);
+		tlist = add_to_flat_tlist(tlist, list_make1(expr));
+	}
+
+	if (parse->groupClause != NIL)
+	{
+		if (list_length(grouped) != list_length(parse->groupClause) ||
+			!cassGroupingKeyAttrs(root, input_rel, grouped, &group_attrs))
+			return;
+	}
+	else
+	{
+		/* An "= ANY" condition is run as one statement per partition. */
+		foreach(lc, fpinfo->remote_conds)
+		{
+			RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+			if (IsA(rinfo->clause, ScalarArrayOpExpr))
+				return;
+		}
+	}
+
+	/*
+	 * The scan returns the aggregates; anything computed from them or from
+	 * the grouping columns is left to the plan's target list.  Any other
+	 * column has no single value to return.
+	 */
+	foreach(lc, pull_var_clause((Node *) grouping_target->exprs,
+								PVC_INCLUDE_AGGREGATES |
+								PVC_RECURSE_PLACEHOLDERS))
+	{
+		Expr	   *expr = (Expr *) lfirst(lc);
+
+		if (IsA(expr, Var))
+		{
+			if (!tlist_member(expr, tlist))
+				return;
+			continue;
+		}
+		if (!IsA(expr, Aggref) ||
+			!cassIsPushableAggregate(input_rel, (Aggref *) expr))
+			return;
+		tlist = add_to_flat_tlist(tlist, list_make1(expr));
+	}
+	if (tlist == NIL)
+		return;
+
+	gfpinfo = (CassFdwPlanState *) palloc(sizeof(CassFdwPlanState));
+	memcpy(gfpinfo, fpinfo, sizeof(CassFdwPlanState));
+	gfpinfo->scan_rel = input_rel;
+	gfpinfo->grouped_tlist = tlist;
+	gfpinfo->group_attrs = group_attrs;
+	grouped_rel->fdw_private = (void *) gfpinfo;
+
+	/*
+	 * Cassandra still reads the rows, but only one per group comes back,
+	 * where a local HashAggregate would have to receive them all.
+	 */
+	if (group_exprs != NIL)
+#if PG_VERSION_NUM < 140000
+		rows = estimate_num_groups(root, group_exprs, fpinfo->rows, NULL);
+#else
+		rows = estimate_num_groups(root, group_exprs, fpinfo->rows, NULL,
+								   NULL);
+#endif
+
+	grouppath = create_foreign_upper_path(root,
+										  grouped_rel,
+										  grouping_target,
+										  rows,
+										  fpinfo->startup_cost,
+										  fpinfo->total_cost +
+										  DEFAULT_FDW_TUPLE_COST * rows,
+										  NIL,	/* no pathkeys */
+										  NULL,	/* no extra plan */
+										  NIL);	/* no fdw_private */
+
+	add_path(grouped_rel, (Path *) grouppath);
+}
+
+/*
+ * add_foreign_distinct_paths
+ *		Add a ForeignPath that has Cassandra return each partition key once,
+ *		for a SELECT DISTINCT of exactly the partition key columns.
+ *
+ * Cassandra answers that from the partition index, without reading the
+ * rows.  It accepts conditions on the partition key only, and a partition
+ * key compared with "= ANY" yields different keys from each statement.
+ */
+static void
+add_foreign_distinct_paths(PlannerInfo *root, RelOptInfo *input_rel,
+						   RelOptInfo *distinct_rel)
+{
+	Query	   *parse = root->parse;
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) input_rel->fdw_private;
+	CassFdwPlanState *dfpinfo;
+	List	   *distinct_attrs = NIL;
+	List	   *distinct_exprs = NIL;
+	ForeignPath *distinct_path;
+	double		rows;
+	ListCell   *lc;
+	int			i;
+
+	if (input_rel->reloptkind != RELOPT_BASEREL ||
+		fpinfo->partition_attrs == NIL)
+		return;
+	if (parse->distinctClause == NIL || parse->hasDistinctOn ||
+		parse->hasTargetSRFs)
+		return;
+	if (fpinfo->per_partition_limit > 0)
+		return;
+	if (fpinfo->local_conds != NIL)
+		return;
+
+	foreach(lc, parse->distinctClause)
+	{
+		SortGroupClause *sgc = (SortGroupClause *) lfirst(lc);
+		Expr	   *expr = (Expr *) get_sortgroupclause_expr(sgc,
+															 root->processed_tlist);
+
+		if (!cassIsGroupingColumn(input_rel, expr, sgc) ||
+			!list_member_int(fpinfo->partition_attrs,
+							 ((Var *) expr)->varattno))
+			return;
+		distinct_attrs = list_append_unique_int(distinct_attrs,
+												((Var *) expr)->varattno);
+		distinct_exprs = lappend(distinct_exprs, expr);
+	}
+	if (list_length(distinct_attrs) != list_length(fpinfo->partition_attrs))
+		return;
+
+	/* Nothing but the partition key may be fetched... */
+	i = -1;
+	while ((i = bms_next_member(fpinfo->attrs_used, i)) >= 0)
+	{
+		if (!list_member_int(fpinfo->partition_attrs,
+							 i + FirstLowInvalidHeapAttributeNumber))
+			return;
+	}
+
+	/* ... or restricted. */
+	foreach(lc, fpinfo->remote_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		AttrNumber	attnum;
+		int			strategy;
+		Expr	   *value;
+
+		if (!cassIsKeyRestriction(root, input_rel, rinfo->clause,
+								  &attnum, &strategy, &value) ||
+			!list_member_int(fpinfo->partition_attrs, attnum))
+			return;
+	}
+
+#if PG_VERSION_NUM < 140000
+	rows = estimate_num_groups(root, distinct_exprs, fpinfo->rows, NULL);
+#else
+	rows = estimate_num_groups(root, distinct_exprs, fpinfo->rows, NULL,
+							   NULL);
+#endif
+
+	/* A LIMIT is applied to the distinct keys; see add_foreign_final_paths. */
+	dfpinfo = (CassFdwPlanState *) palloc(sizeof(CassFdwPlanState));
+	memcpy(dfpinfo, fpinfo, sizeof(CassFdwPlanState));
+	dfpinfo->scan_rel = input_rel;
+	dfpinfo->distinct = true;
+	dfpinfo->rows = rows;
+	distinct_rel->fdw_private = (void *) dfpinfo;
+
+	distinct_path = create_foreign_upper_path(root,
+											  input_rel,
+											  root->upper_targets[UPPERREL_DISTINCT],
+											  rows,
+											  fpinfo->startup_cost,
+											  fpinfo->total_cost +
+											  DEFAULT_FDW_TUPLE_COST * rows,
+											  NIL,	/* no pathkeys */
+											  NULL,	/* no extra plan */
+											  cassMakePathPrivate(-1, -1,
+																  false,
+																  true));
+
+	add_path(distinct_rel, (Path *) distinct_path);
+}
+
+/*
+ * add_foreign_ordered_paths
+ *		Add a ForeignPath returning the rows in the query's ORDER BY order,
+ *		if a single-partition scan can do so.
+ *
+ * The final stage looks for the fdw_private we leave on ordered_rel, to
+ * push a LIMIT down on top of the ordering.
+ */
+static void
+add_foreign_ordered_paths(PlannerInfo *root, RelOptInfo *input_rel,
+						  RelOptInfo *ordered_rel)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) input_rel->fdw_private;
+	CassFdwPlanState *ofpinfo;
+	ForeignPath *ordered_path;
+	bool		reverse;
+
+	/* Only the rows of the scan itself can be ordered remotely. */
+	if (input_rel->reloptkind != RELOPT_BASEREL)
+		return;
+	if (root->parse->hasTargetSRFs)
+		return;
+
+	if (!cassPathkeysMatchClustering(root, input_rel, root->sort_pathkeys,
+									 &reverse))
+		return;
+
+	ofpinfo = (CassFdwPlanState *) palloc(sizeof(CassFdwPlanState));
+	memcpy(ofpinfo, fpinfo, sizeof(CassFdwPlanState));
+	ofpinfo->scan_rel = input_rel;
+	ofpinfo->reverse_order = reverse;
+	ordered_rel->fdw_private = (void *) ofpinfo;
+
+	ordered_path = create_foreign_upper_path(root,
+											 input_rel,
+											 root->upper_targets[UPPERREL_ORDERED],
+											 fpinfo->rows,
+											 fpinfo->startup_cost,
+											 fpinfo->total_cost,
+											 root->sort_pathkeys,
+											 NULL,	/* no extra plan */
+											 cassMakePathPrivate(-1, -1, reverse, false));
+
+	add_path(ordered_rel, (Path *) ordered_path);
+}
+
+/*
+ * add_foreign_final_paths
+ *		Add a ForeignPath that applies the query's LIMIT/OFFSET in the scan.
+ *
+ * CQL has a LIMIT but no OFFSET, so Cassandra is asked for LIMIT + OFFSET
+ * rows and the scan drops the leading OFFSET rows itself.  This is only
+ * correct when the scan's output is the final result, i.e. there is no
+ * grouping, sorting or locally checked condition between them.
+ */
+static void
+add_foreign_final_paths(PlannerInfo *root, RelOptInfo *input_rel,
+						RelOptInfo *final_rel, FinalPathExtraData *extra)
+{
+	Query	   *parse = root->parse;
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) input_rel->fdw_private;
+	RelOptInfo *scan_rel = input_rel;
+	List	   *pathkeys = NIL;
+	bool		reverse = false;
+	bool		distinct = false;
+	int64		count = -1;
+	int64		offset = -1;
+	double		rows;
+	Cost		startup_cost;
+	Cost		total_cost;
+	ForeignPath *final_path;
+
+	/* Only a plain SELECT of the foreign table's rows qualifies. */
+	if (parse->commandType != CMD_SELECT || !extra->limit_needed)
+		return;
+
+	/*
+	 * The input is either the foreign table itself, or the ordered relation
+	 * for which add_foreign_ordered_paths() found the scan's order usable,
+	 * or the distinct relation of add_foreign_distinct_paths().
+	 */
+	if (fpinfo->grouped_tlist != NIL)
+		return;
+	if (input_rel->reloptkind == RELOPT_UPPER_REL && fpinfo->scan_rel)
+	{
+		scan_rel = fpinfo->scan_rel;
+		pathkeys = root->sort_pathkeys;
+		reverse = fpinfo->reverse_order;
+		distinct = fpinfo->distinct;
+	}
+	else if (input_rel->reloptkind != RELOPT_BASEREL)
+		return;
+	if (parse->hasTargetSRFs || parse->rowMarks)
+		return;
+#if PG_VERSION_NUM >= 130000
+	if (parse->limitOption == LIMIT_OPTION_WITH_TIES)
+		return;
+#endif
+
+	/* Every row Cassandra returns must be part of the result. */
+	if (fpinfo->local_conds != NIL)
+		return;
+
+	/* The LIMIT and OFFSET must be known now; CQL can't take them later. */
+	if (parse->limitCount)
+	{
+		Const	   *c = (Const *) parse->limitCount;
+
+		if (!IsA(c, Const))
+			return;
+		if (!c->constisnull)
+		{
+			count = DatumGetInt64(c->constvalue);
+			if (count < 0)
+				return;
+		}
+	}
+	if (parse->limitOffset)
+	{
+		Const	   *c = (Const *) parse->limitOffset;
+
+		if (!IsA(c, Const))
+			return;
+		if (!c->constisnull)
+		{
+			offset = DatumGetInt64(c->constvalue);
+			if (offset < 0)
+				return;
+		}
+	}
+
+	/*
+	 * Nothing to do for LIMIT ALL.  Invalid values are left for the executor
+	 * to complain about, and CQL only takes a positive 32-bit LIMIT.
+	 */
+	if (count < 0)
+		return;
+	if (count + Max(offset, 0) <= 0 ||
+		count + Max(offset, 0) > PG_INT32_MAX)
+		return;
+
+	/*
+	 * Start from what a local Limit over the scan would cost, less the rows
+	 * that are no longer transferred.
+	 */
+	rows = fpinfo->rows;
+	startup_cost = fpinfo->startup_cost;
+	total_cost = fpinfo->total_cost;
+	adjust_limit_rows_costs(&rows, &startup_cost, &total_cost,
+							extra->offset_est, extra->count_est);
+	total_cost = Max(total_cost -
+					 DEFAULT_FDW_TUPLE_COST * Max(fpinfo->rows - rows, 0),
+					 startup_cost);
+
+	final_path = create_foreign_upper_path(root,
+										   scan_rel,
+										   root->upper_targets[UPPERREL_FINAL],
+										   rows,
+										   startup_cost,
+										   total_cost,
+										   pathkeys,
+										   NULL,	/* no extra plan */
+										   cassMakePathPrivate((int) count,
+															   (int) offset,
+															   reverse,
+															   distinct));
+
+	add_path(final_rel, (Path *) final_path);
+}
+#endif
+
+/*
+ * cassGetForeignPlan
+ *		Create ForeignScan plan node which implements selected best path
+ */
+static ForeignScan *
+cassGetForeignPlan(PlannerInfo *root,
+					   RelOptInfo *baserel,
+					   Oid foreigntableid,
+					   ForeignPath *best_path,
+					   List *tlist,
+					   List *scan_clauses,
+					   Plan *outer_plan
+)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
+	RelOptInfo *scanrel = baserel;
+	Index		scan_relid = baserel->relid;
+	List	   *remote_conds;
+	List	   *fdw_private;
+	List	   *fdw_scan_tlist = NIL;
+	List	   *local_exprs = NIL;
+	List	   *params_list = NIL;
+	List	   *param_strategies = NIL;
+	List	   *agg_counts = NIL;
+	List	   *empty_nulls = NIL;
+	StringInfoData sql;
+	List	   *retrieved_attrs;
+	int			limit_count = -1;
+	int			limit_offset = -1;
+	bool		reverse = false;
+	bool		distinct = false;
+	int			token_ranges = 0;
+	ListCell   *lc;
+
+	elog(DEBUG1, CSTAR_FDW_NAME
+	     ": get foreign plan for relation ID %d", foreigntableid);
+
+	/* The participants of a parallel scan share out the token ring. */
+	if (best_path->path.parallel_aware)
+		token_ranges = fpinfo->token_ranges;
+
+	/* A path for the final relation carries the LIMIT to push down. */
+	if (best_path->fdw_private != NIL)
+	{
+		limit_count = intVal(list_nth(best_path->fdw_private,
+									  CassFdwPathPrivateLimitCount));
+		limit_offset = intVal(list_nth(best_path->fdw_private,
+									   CassFdwPathPrivateLimitOffset));
+		reverse = intVal(list_nth(best_path->fdw_private,
+								  CassFdwPathPrivateReverse)) != 0;
+		distinct = intVal(list_nth(best_path->fdw_private,
+								   CassFdwPathPrivateDistinct)) != 0;
+	}
+
+	/*
+	 * A parameterized path also restricts the key columns by the join
+	 * clauses it was built for, which changes what can be sent.
+	 */
+	remote_conds = fpinfo->remote_conds;
+	if (best_path->path.param_info != NULL)
+	{
+		List	   *param_local_conds;
+
+		cassClassifyConditions(root, baserel, scan_clauses,
+							   fpinfo->partition_attrs,
+							   fpinfo->clustering_attrs,
+							   &remote_conds, &param_local_conds);
+	}
+
+	/*
+	 * Separate the scan_clauses into those that are sent to Cassandra and
+	 * those that must be checked locally.  Pseudoconstant clauses are
+	 * handled elsewhere by the executor.
+	 */
+	foreach(lc, scan_clauses)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		Assert(IsA(rinfo, RestrictInfo));
+
+		if (rinfo->pseudoconstant)
+			continue;
+
+		if (!list_member_ptr(remote_conds, rinfo))
+			local_exprs = lappend(local_exprs, rinfo->clause);
+	}
+
+	/*
+	 * Build the query string to be sent for execution, and identify
+	 * expressions to be sent as parameters.  For aggregates computed by
+	 * Cassandra, the scan returns their values rather than a table row, and
+	 * the conditions are those of the underlying foreign table.
+	 */
+	initStringInfo(&sql);
+	if (IS_UPPER_REL(baserel))
+	{
+		scanrel = fpinfo->scan_rel;
+		scan_relid = 0;
+		fdw_scan_tlist = fpinfo->grouped_tlist;
+		cassDeparseAggregateSql(&sql, root, scanrel, fdw_scan_tlist,
+								fpinfo->group_attrs, fpinfo->remote_conds,
+								&retrieved_attrs, &params_list,
+								&agg_counts, &empty_nulls);
+	}
+	else
+		cassDeparseSelectSql(&sql, root, baserel, fpinfo->attrs_used,
+							 remote_conds, distinct,
+							 &retrieved_attrs, &params_list);
+
+	/*
+	 * Otherwise, a scan of the whole table may be split into token ranges
+	 * read concurrently by this backend alone.  A LIMIT is better served by
+	 * reading the ring in order, as only its first rows are needed.
+	 */
+	if (!best_path->path.parallel_aware && fpinfo->token_ranges > 1 &&
+		!IS_UPPER_REL(baserel) && best_path->fdw_private == NIL &&
+		best_path->path.param_info == NULL &&
+		fpinfo->partition_attrs != NIL && remote_conds == NIL)
+		token_ranges = fpinfo->token_ranges;
+
+	if (token_ranges > 0)
+	{
+		Assert(remote_conds == NIL);
+		cassAppendTokenRangeClause(&sql, root, baserel,
+								   fpinfo->partition_attrs);
+	}
+
+	/*
+	 * Rows come in clustering order by default; reversing the direction of
+	 * the first clustering column reverses them all.
+	 */
+	if (reverse)
+		cassAppendOrderByClause(&sql, root, baserel,
+								linitial_int(fpinfo->clustering_attrs),
+								!linitial_int(fpinfo->clustering_desc));
+
+	/*
+	 * The per-partition cap is part of the table's definition, and so comes
+	 * before any LIMIT of the query.
+	 */
+	if (fpinfo->per_partition_limit > 0)
+		appendStringInfo(&sql, " PER PARTITION LIMIT %d",
+						 fpinfo->per_partition_limit);
+
+	/*
+	 * Cassandra has no OFFSET, so ask for the skipped rows too and drop them
+	 * on our side.
+	 */
+	if (limit_count >= 0)
+		appendStringInfo(&sql, " LIMIT %d",
+						 limit_count + Max(limit_offset, 0));
+
+	/*
+	 * Remember how each parameter is compared, which the executor needs to
+	 * round timestamps to Cassandra's precision.  The remote conditions are
+	 * deparsed in order, one parameter each.
+	 */
+	foreach(lc, remote_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		AttrNumber	attnum;
+		int			strategy;
+		Expr	   *value;
+
+		if (!cassIsKeyRestriction(root, scanrel, rinfo->clause,
+								  &attnum, &strategy, &value))
+			elog(ERROR, "unexpected remote condition");
+		param_strategies = lappend_int(param_strategies, strategy);
+	}
+
+	/*
+	 * Build the fdw_private list that will be available to the executor.
+	 * Items in the list must match enum CassFdwScanPrivateIndex, above.
+	 */
+	fdw_private = list_make3(makeString(sql.data),
+							 retrieved_attrs,
+							 param_strategies);
+	fdw_private = lappend(fdw_private, makeInteger(limit_count));
+	fdw_private = lappend(fdw_private, makeInteger(limit_offset));
+	fdw_private = lappend(fdw_private, agg_counts);
+	fdw_private = lappend(fdw_private, empty_nulls);
+	fdw_private = lappend(fdw_private, makeInteger(token_ranges));
+
+	/*
+	 * Create the ForeignScan node from target list, local filtering
+	 * expressions, remote parameter expressions, and FDW private information.
+	 *
+	 * Note that the remote parameter expressions are stored in the fdw_exprs
+	 * field of the finished plan node; we can't keep them in private state
+	 * because then they wouldn't be subject to later planner processing.
+	 */
+	return make_foreignscan(tlist,
+	                        local_exprs,
+	                        scan_relid,
+	                        params_list,
+	                        fdw_private,
+	                        fdw_scan_tlist,
+	                        NIL,
+							NULL);
+}
+
+/*
+ * cassExplainForeignScan
+ *		Produce extra output for EXPLAIN
+ */
+static void
+cassExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+	List	   *fdw_private;
+	char	   *sql;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": explain foreign scan for relation ID %d",
+	     scan_relation_id(node));
+
+	if (es->verbose)
+	{
+		fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
+		sql = strVal(list_nth(fdw_private, CassFdwScanPrivateSelectSql));
+		ExplainPropertyText("Remote SQL", sql, es);
+	}
+}
+
+
+/*
+ * cassBeginForeignScan
+ *		Initiate access to the database
+ */
+static void
+cassBeginForeignScan(ForeignScanState *node, int eflags)
+{
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+	EState	   *estate = node->ss.ps.state;
+	CassFdwScanState   *fsstate;
+	RangeTblEntry *rte;
+	Index		rtindex;
+	Oid			userid;
+	ForeignTable *table;
+	ForeignServer *server;
+	UserMapping *user;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": begin foreign scan for relation ID %d",
+	     scan_relation_id(node));
+
+	/*
+	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
+	 */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	/*
+	 * We'll save private state in node->fdw_state.
+	 */
+	fsstate = (CassFdwScanState *) palloc0(sizeof(CassFdwScanState));
+	node->fdw_state = (void *) fsstate;
+
+	/*
+	 * Identify which user to do the remote access as.  This should match what
+	 * ExecCheckRTEPerms() does.  A scan computing aggregates has no scan
+	 * relation of its own; the foreign table is the only one it covers.
+	 */
+	rtindex = scan_relation_index(node);
+	rte = rt_fetch(rtindex, estate->es_range_table);
+	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+
+	/* Get info about foreign table. */
+	if (fsplan->scan.scanrelid > 0)
+		fsstate->rel = node->ss.ss_currentRelation;
+	else
+		fsstate->rel = ExecOpenScanRelation(estate, rtindex, eflags);
+	table = GetForeignTable(RelationGetRelid(fsstate->rel));
+	server = GetForeignServer(table->serverid);
+	user = GetUserMapping(userid, server->serverid);
+
+	/*
+	 * Get connection to the foreign server.  Connection manager will
+	 * establish new connection if necessary.
+	 */
+	fsstate->cass_conn = pgcass_GetConnection(server, user, false);
+	fsstate->sql_sended = false;
+
+	cassGetReadConsistencyOption(RelationGetRelid(fsstate->rel), &fsstate->read_consistency);
+	fsstate->fetch_size = cassGetIntOption(RelationGetRelid(fsstate->rel),
+	                                       "fetch_size", DEFAULT_FETCH_SIZE);
+	fsstate->prefetch = cassGetIntOption(RelationGetRelid(fsstate->rel),
+	                                     "prefetch", DEFAULT_PREFETCH);
+	fsstate->max_concurrent = cassGetIntOption(RelationGetRelid(fsstate->rel),
+	                                           "max_concurrent_requests",
+	                                           DEFAULT_MAX_CONCURRENT_REQUESTS);
+
+	/* Get private info created by planner functions. */
+	fsstate->query = strVal(list_nth(fsplan->fdw_private,
+									 CassFdwScanPrivateSelectSql));
+	fsstate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
+											   CassFdwScanPrivateRetrievedAttrs);
+	fsstate->param_strategies = (List *) list_nth(fsplan->fdw_private,
+											CassFdwScanPrivateParamStrategies);
+	fsstate->limit_count = intVal(list_nth(fsplan->fdw_private,
+										   CassFdwScanPrivateLimitCount));
+	fsstate->limit_offset = intVal(list_nth(fsplan->fdw_private,
+											CassFdwScanPrivateLimitOffset));
+	fsstate->agg_counts = (List *) list_nth(fsplan->fdw_private,
+											CassFdwScanPrivateAggCounts);
+	fsstate->empty_nulls = (List *) list_nth(fsplan->fdw_private,
+											 CassFdwScanPrivateEmptyNulls);
+	fsstate->token_ranges = intVal(list_nth(fsplan->fdw_private,
+											CassFdwScanPrivateTokenRanges));
+	fsstate->cur_range = -1;
+
+	/* No page needs to be larger than the rows the LIMIT lets through. */
+	if (fsstate->limit_count >= 0)
+		fsstate->fetch_size = Max(Min(fsstate->fetch_size,
+									  fsstate->limit_count +
+									  Max(fsstate->limit_offset, 0)), 1);
+
+	/*
+	 * Get info we'll need for input data conversion.  Scanned rows are the
+	 * foreign table's, while aggregates are returned as fdw_scan_tlist says.
+	 */
+	if (fsplan->scan.scanrelid > 0)
+		fsstate->tupdesc = RelationGetDescr(fsstate->rel);
+	else
+		fsstate->tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+	fsstate->attinmeta = TupleDescGetAttInMetadata(fsstate->tupdesc);
+
+	/* Prepare for evaluation of the values bound to the statement. */
+	fsstate->numParams = list_length(fsplan->fdw_exprs);
+	if (fsstate->numParams > 0)
+	{
+		ListCell   *lc;
+		int			i = 0;
+
+		fsstate->param_exprs = ExecInitExprList(fsplan->fdw_exprs,
+												(PlanState *) node);
+		fsstate->param_types = (Oid *) palloc(fsstate->numParams * sizeof(Oid));
+		foreach(lc, fsplan->fdw_exprs)
+			fsstate->param_types[i++] = exprType((Node *) lfirst(lc));
+	}
+
+	/*
+	 * Driver objects are not palloc'd, so make sure an in-flight request and
+	 * any queued pages are released even if the query fails.
+	 */
+	{
+		MemoryContextCallback *cb;
+
+		cb = (MemoryContextCallback *)
+			MemoryContextAlloc(estate->es_query_cxt,
+							   sizeof(MemoryContextCallback));
+		cb->func = cleanup_cursor_callback;
+		cb->arg = (void *) fsstate;
+		MemoryContextRegisterResetCallback(estate->es_query_cxt, cb);
+	}
+}
+
+
+/*
+ * cassIterateForeignScan
+ *		Read next record from the data file and store it into the
+ *		ScanTupleSlot as a virtual tuple
+ */
+static TupleTableSlot*
+cassIterateForeignScan(ForeignScanState *node)
+{
+	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+
+	/*
+	 * If this is the first call after Begin or ReScan, we need to create the
+	 * cursor on the remote side.
+	 */
+	if (!fsstate->sql_sended)
+		create_cursor(node);
+
+	/*
+	 * Move already-completed page requests into the ring, which lets the
+	 * following requests start while we are still returning this page.
+	 */
+	if (fsstate->num_pending > 0 && fsstate->ring_size > 1)
+		collect_pages(fsstate, false);
+
+	/*
+	 * Once a pushed-down LIMIT is satisfied, stop without touching the
+	 * remaining pages; nothing more is requested from Cassandra.
+	 */
+	if (fsstate->limit_count >= 0 &&
+		fsstate->num_returned >= fsstate->limit_count)
+		return ExecClearTuple(slot);
+
+	for (;;)
+	{
+		/*
+		 * Get the next page, if we've run out of rows.
+		 */
+		while (fsstate->rows == NULL || !cass_iterator_next(fsstate->rows))
+		{
+			/* No point in another fetch if we already detected EOF, though. */
+			if (fsstate->eof_reached)
+			{
+				/* A parallel scan moves on to the next token range it gets. */
+				if (fsstate->token_ranges > 0 && fsstate->cur_range >= 0)
+				{
+					close_cursor(fsstate);
+					create_cursor(node);
+					continue;
+				}
+
+				/*
+				 * Aggregates yield a row even over no rows, which is what
+				 * we get when the parameters rule out every row.
+				 */
+				if (fsstate->agg_counts != NIL && fsstate->num_returned == 0)
+				{
+					fsstate->num_returned++;
+					store_empty_aggregates(fsstate, slot);
+					return slot;
+				}
+				return ExecClearTuple(slot);
+			}
+			fetch_more_data(node);
+		}
+
+		/* Skip the rows covered by a pushed-down OFFSET without decoding. */
+		if (fsstate->num_skipped >= fsstate->limit_offset)
+			break;
+		fsstate->num_skipped++;
+	}
+	fsstate->num_returned++;
+
+	/*
+	 * Decode the current row straight into the slot.  We are called in the
+	 * per-tuple memory context, which is where pass-by-reference values go.
+	 */
+	ExecClearTuple(slot);
+	cassDecodeRow(cass_iterator_get_row(fsstate->rows),
+				  fsstate->colplan, fsstate->NumberOfColumns,
+				  slot->tts_tupleDescriptor->natts,
+				  slot->tts_values, slot->tts_isnull);
+
+	/*
+	 * Cassandra sums and averages no values to 0; the counts of their
+	 * arguments that follow the other columns tell when PostgreSQL's NULL
+	 * is due instead.
+	 */
+	if (fsstate->empty_nulls != NIL)
+	{
+		const CassRow *row = cass_iterator_get_row(fsstate->rows);
+		ListCell   *lc;
+		int			j = fsstate->NumberOfColumns -
+			list_length(fsstate->empty_nulls);
+
+		foreach(lc, fsstate->empty_nulls)
+		{
+			cass_int64_t n = 0;
+
+			cass_value_get_int64(cass_row_get_column(row, j++), &n);
+			if (n == 0)
+				slot->tts_isnull[lfirst_int(lc) - 1] = true;
+		}
+	}
+	ExecStoreVirtualTuple(slot);
+
+	return slot;
+}
+
+/*
+ * Store into slot the aggregates of no rows: 0 for counts, NULL otherwise.
+ */
+static void
+store_empty_aggregates(CassFdwScanState *fsstate, TupleTableSlot *slot)
+{
+	ListCell   *lc;
+	int			i = 0;
+
+	ExecClearTuple(slot);
+	memset(slot->tts_isnull, true,
+		   slot->tts_tupleDescriptor->natts * sizeof(bool));
+	foreach(lc, fsstate->agg_counts)
+	{
+		slot->tts_values[i] = Int64GetDatum(0);
+		slot->tts_isnull[i] = !lfirst_int(lc);
+		i++;
+	}
+	ExecStoreVirtualTuple(slot);
+}
+
+/*
+ * cassReScanForeignScan
+ *		Rescan table, possibly with new parameters
+ */
+static void
+cassReScanForeignScan(ForeignScanState *node)
+{
+	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": re-scan for foreign relation ID %d",
+	     scan_relation_id(node));
+
+	/* If we haven't created the cursor yet, nothing to do. */
+	if (!fsstate->sql_sended)
+		return;
+
+	/*
+	 * If any internal parameters affecting this node have changed, we'd
+	 * better destroy and recreate the cursor.  Otherwise, if we've only
+	 * fetched zero or one page, just rescan what we already have in memory;
+	 * the paging state still points just past that page.  Otherwise the
+	 * statements must be executed again from the first page.
+	 */
+	fsstate->num_skipped = 0;
+	fsstate->num_returned = 0;
+
+	fsstate->next_range = 0;
+
+	if (node->ss.ps.chgParam == NULL && fsstate->fetch_ct_2 <= 1 &&
+		!node->ss.ps.plan->parallel_aware)
+	{
+		if (fsstate->result)
+		{
+			cass_iterator_free(fsstate->rows);
+			fsstate->rows = cass_iterator_from_result(fsstate->result);
+		}
+		return;
+	}
+
+	/*
+	 * Now force a fresh FETCH by re-creating the cursor.  New parameter
+	 * values are likely to keep coming, so bind them to a prepared statement
+	 * from now on.
+	 */
+	if (node->ss.ps.chgParam != NULL && fsstate->numParams > 0)
+		fsstate->prepare = true;
+	close_cursor(fsstate);
+	fsstate->sql_sended = false;
+	fsstate->fetch_ct_2 = 0;
+	fsstate->eof_reached = false;
+}
+
+/*
+ * cassEndForeignScan
+ *		Finish scanning foreign table and dispose objects used for this scan
+ */
+static void
+cassEndForeignScan(ForeignScanState *node)
+{
+	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": end foreign scan for relation ID %d",
+	     scan_relation_id(node));
+
+	/* if fsstate is NULL, we are in EXPLAIN; nothing to do */
+	if (fsstate == NULL)
+		return;
+
+	/* Close the cursor if open, to prevent accumulation of cursors */
+	if (fsstate->sql_sended)
+		close_cursor(fsstate);
+	fsstate->sql_sended = false;
+
+	if (fsstate->prepared)
+		cass_prepared_free(fsstate->prepared);
+	fsstate->prepared = NULL;
+
+	/* Release remote connection */
+	pgcass_ReleaseConnection(fsstate->cass_conn);
+	fsstate->cass_conn = NULL;
+
+	/* MemoryContexts will be deleted automatically. */
+}
+
+/*
+ * cassIsForeignScanParallelSafe
+ *		Each participant of a parallel query opens its own session, so a
+ *		scan can run in any of them.
+ */
+static bool
+cassIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
+							  RangeTblEntry *rte)
+{
+	return true;
+}
+
+/*
+ * cassEstimateDSMForeignScan
+ *		Size of the shared state of a parallel scan
+ */
+static Size
+cassEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt)
+{
+	return sizeof(CassParallelScanState);
+}
+
+/*
+ * cassInitializeDSMForeignScan
+ *		Set up the shared state of a parallel scan, before any token range
+ *		has been handed out
+ */
+static void
+cassInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+							 void *coordinate)
+{
+	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
+	CassParallelScanState *pscan = (CassParallelScanState *) coordinate;
+
+	pg_atomic_init_u32(&pscan->next_range, 0);
+	fsstate->pscan = pscan;
+}
+
+/*
+ * cassReInitializeDSMForeignScan
+ *		Hand out the token ranges again for a rescan
+ */
+static void
+cassReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+							   void *coordinate)
+{
+	CassParallelScanState *pscan = (CassParallelScanState *) coordinate;
+
+	pg_atomic_write_u32(&pscan->next_range, 0);
+}
+
+/*
+ * cassInitializeWorkerForeignScan
+ *		Attach a parallel worker to the shared state of the scan
+ */
+static void
+cassInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc,
+								void *coordinate)
+{
+	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
+
+	fsstate->pscan = (CassParallelScanState *) coordinate;
+}
+
+/*
+ * cassAddForeignUpdateTargets
+ * 		Add the PRIMARY KEY column as resjunk entry.
+ */
+#if PG_VERSION_NUM < 140000
+static void
+cassAddForeignUpdateTargets(Query *parsetree,
+							RangeTblEntry *target_rte,
+							Relation target_relation)
+#else
+static void
+cassAddForeignUpdateTargets(PlannerInfo *root,
+							Index rtindex,
+							RangeTblEntry *target_rte,
+							Relation target_relation)
+#endif
+{
+	Oid         relid        = RelationGetRelid(target_relation);
+	TupleDesc   tupdesc      = target_relation->rd_att;
+	const char *primary_key = NULL;
+	bool		has_PK       = false;
+	int         i;
+
+	elog(DEBUG1, CSTAR_FDW_NAME
+	     ": add target column(s) for write on relation ID %d", relid);
+
+	cassGetPKOption(relid, &primary_key);
+
+	if (primary_key == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				 errmsg("No PRIMARY KEY specified for the FOREIGN TABLE "
+						"'%s.%s'.",
+						pstrdup(get_namespace_name(RelationGetNamespace(
+														  target_relation))),
+						pstrdup(RelationGetRelationName(target_relation))),
+				 errdetail("For UPDATE or DELETE, a PRIMARY KEY must be "
+						   "defined for the FOREIGN TABLE."),
+				 errhint("Set the FOREIGN TABLE OPTION '%s' to a "
+						 "PRIMARY KEY column.",
+						 OPT_PK)));
+	}
+
+	/*
+	 * Loop through all columns of the FOREIGN TABLE to determine the PK
+	 * attribute to be added as hidden target column for UPDATE and DELETE
+	 * statements.
+	 */
+	for (i = 0; i < tupdesc->natts; ++i)
+	{
+#if PG_VERSION_NUM < 110000
+		Form_pg_attribute att = tupdesc->attrs[i];
+#else
+		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+#endif
+		AttrNumber attrno = att->attnum;
+
+		if (strncmp(NameStr(att->attname), primary_key, strlen(primary_key))
+			== 0)
+		{
+			Var *var;
+#if PG_VERSION_NUM < 140000
+			TargetEntry *tle;
+
+			/* Make a Var representing the desired value */
+			var = makeVar(parsetree->resultRelation,
+			              attrno,
+			              att->atttypid,
+			              att->atttypmod,
+			              att->attcollation,
+			              0);
+
+			/* Wrap it in a resjunk TLE with the right name ... */
+			tle = makeTargetEntry((Expr *)var,
+			                      list_length(parsetree->targetList) + 1,
+			                      pstrdup(NameStr(att->attname)),
+			                      true);
+
+			/* ... and add it to the query's targetlist */
+			parsetree->targetList = lappend(parsetree->targetList, tle);
+#else
+			/* Make a Var representing the desired value ... */
+			var = makeVar(rtindex,
+			              attrno,
+			              att->atttypid,
+			              att->atttypmod,
+			              att->attcollation,
+			              0);
+
+			/* ... and register it as a row identity column */
+			add_row_identity_var(root, var, rtindex,
+			                     pstrdup(NameStr(att->attname)));
+#endif
+
+			has_PK = true;
 		}
 	}
 
@@ -1206,943 +3102,3287 @@ cassAddForeignUpdateTargets(Query *parsetree,
 	{
 		ereport(ERROR,
 		        (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-		         errmsg("The specified PRIMARY KEY '%s' does not exist in the "
-		                "FOREIGN TABLE '%s.%s'.", primary_key,
-		                pstrdup(get_namespace_name(RelationGetNamespace(
-			                                           target_relation))),
-		                pstrdup(RelationGetRelationName(target_relation))),
-		         errdetail("For UPDATE or DELETE, a valid PRIMARY KEY must be "
-		                   "defined for the FOREIGN TABLE."),
-		         errhint("Set the FOREIGN TABLE OPTION '%s' to a "
-		                 "valid PRIMARY KEY column.",
-		                 OPT_PK)));
+		         errmsg("The specified PRIMARY KEY '%s' does not exist in the "
+		                "FOREIGN TABLE '%s.%s'.", primary_key,
+		                pstrdup(get_namespace_name(RelationGetNamespace(
+			                                           target_relation))),
+		                pstrdup(RelationGetRelationName(target_relation))),
+		         errdetail("For UPDATE or DELETE, a valid PRIMARY KEY must be "
+		                   "defined for the FOREIGN TABLE."),
+		         errhint("Set the FOREIGN TABLE OPTION '%s' to a "
+		                 "valid PRIMARY KEY column.",
+		                 OPT_PK)));
+	}
+}
+
+
+/*
+ * cassPlanForeignModify
+ *		Plan an INSERT/UPDATE/DELETE operation on a FOREIGN TABLE
+ *
+ * Note: currently, the plan tree generated for UPDATE/DELETE will always
+ * include a ForeignScan that retrieves PKs and then the ModifyTable node will
+ * have to execute individual remote UPDATE/DELETE commands.
+ */
+static List *
+cassPlanForeignModify(PlannerInfo *root,
+					  ModifyTable *plan,
+					  Index resultRelation,
+					  int subplan_index)
+{
+	CmdType		operation       = plan->operation;
+	RangeTblEntry  *rte             = planner_rt_fetch(resultRelation, root);
+	Relation        rel;
+	StringInfoData  sql;
+	List           *targetAttrs     = NIL;
+	List           *retrieved_attrs = NIL;
+	bool            doNothing       = false;
+	const char	   *primaryKey;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": plan foreign modify");
+
+	initStringInfo(&sql);
+
+	/*
+	 * Core code already has some lock on each rel being planned, so we can
+	 * use NoLock here.
+	 */
+
+#if PG_VERSION_NUM < 120000
+	rel = heap_open(rte->relid, NoLock);
+#else
+	rel = table_open(rte->relid, NoLock);
+#endif
+
+	/*
+	 * In an INSERT, we transmit all columns that are defined in the FOREIGN
+	 * TABLE.  In an UPDATE, we transmit only columns that were explicitly
+	 * targets of the UPDATE, so as to avoid unnecessary data transmission.
+	 * (We can't do that for INSERT since we would miss sending default values
+	 * for columns not listed in the source statement.)
+	 */
+	if (operation == CMD_INSERT)
+	{
+		TupleDesc	tupdesc = RelationGetDescr(rel);
+		int			attnum;
+
+		for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+		{
+#if PG_VERSION_NUM < 110000
+			Form_pg_attribute attr = tupdesc->attrs[attnum - 1];
+#else
+			Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+#endif
+
+			if (!attr->attisdropped)
+				targetAttrs = lappend_int(targetAttrs, attnum);
+		}
+	}
+	else if (operation == CMD_UPDATE)
+	{
+		int			col;
+		Bitmapset		*updatedCols = rte->updatedCols;
+
+		col = -1;
+		while ((col = bms_next_member(updatedCols, col)) >= 0)
+		{
+			/* bit numbers are offset by FirstLowInvalidHeapAttributeNumber */
+			AttrNumber	attno = col + FirstLowInvalidHeapAttributeNumber;
+
+			if (attno <= InvalidAttrNumber)		/* shouldn't happen */
+				elog(ERROR, "system-column update is not supported");
+			targetAttrs = lappend_int(targetAttrs, attno);
+		}
+	}
+
+	/*
+	 * ON CONFLICT DO UPDATE and DO NOTHING case with inference specification
+	 * should have already been rejected in the optimizer, as presently there
+	 * is no way to recognize an arbiter index on a foreign table.  Only DO
+	 * NOTHING is supported without an inference specification.
+	 */
+	if (plan->onConflictAction == ONCONFLICT_NOTHING)
+		doNothing = true;
+	else if (plan->onConflictAction != ONCONFLICT_NONE)
+		elog(ERROR, "unexpected ON CONFLICT specification: %d",
+			 (int) plan->onConflictAction);
+
+	cassGetPKOption(rte->relid, &primaryKey);
+	/*
+	 * Construct the SQL command string.
+	 */
+	switch (operation)
+	{
+		case CMD_INSERT:
+				cassDeparseInsertSql(&sql, root, resultRelation, rel,
+									 targetAttrs, doNothing);
+				break;
+		case CMD_UPDATE:
+				cassDeparseUpdateSql(&sql, root, resultRelation, rel,
+									 targetAttrs, primaryKey);
+				break;
+		case CMD_DELETE:
+				cassDeparseDeleteSql(&sql, root, resultRelation, rel,
+									 &retrieved_attrs, primaryKey);
+			break;
+		default:
+			elog(ERROR, "unexpected operation: %d", (int) operation);
+			break;
+	}
+#if PG_VERSION_NUM < 120000
+	heap_close(rel, NoLock);
+#else
+	table_close(rel, NoLock);
+#endif
+
+	/*
+	 * Build the fdw_private list that will be available to the executor.
+	 * Items in the list must match enum FdwModifyPrivateIndex, above.
+	 */
+	return list_make4(makeString(sql.data),
+					  targetAttrs,
+					  makeInteger((retrieved_attrs != NIL)),
+					  retrieved_attrs);
+}
+
+/*
+ * cassBeginForeignModify
+ *		Begin an INSERT/UPDATE/DELETE operation on a foreign table
+ */
+static void cassBeginForeignModify(ModifyTableState *mtstate,
+                                   ResultRelInfo *resultRelInfo,
+                                   List *fdw_private, int subplan_index,
+                                   int eflags)
+{
+	EState             *estate    = mtstate->ps.state;
+	CmdType             operation = mtstate->operation;
+	RangeTblEntry      *rte;
+	Oid                 userid;
+	Plan               *subplan   = NULL;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": begin foreign modify on relation ID %d",
+		RelationGetRelid(resultRelInfo->ri_RelationDesc));
+
+	/*
+	 * Do nothing in EXPLAIN (no ANALYZE) case.  resultRelInfo->ri_FdwState
+	 * stays NULL.
+	 */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	/*
+	 * Identify which user to do the remote access as.  This should match what
+	 * ExecCheckRTEPerms() does.
+	 */
+	rte = rt_fetch(resultRelInfo->ri_RangeTableIndex, estate->es_range_table);
+	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+
+	/* UPDATE and DELETE find the key resjunk column in the subplan's result */
+	if (operation == CMD_UPDATE || operation == CMD_DELETE)
+#if PG_VERSION_NUM < 140000
+		subplan = mtstate->mt_plans[subplan_index]->plan;
+#else
+		subplan = outerPlanState(mtstate)->plan;
+#endif
+
+	/* Construct an execution state from fdw_private data. */
+	resultRelInfo->ri_FdwState =
+		create_foreign_modify(estate, resultRelInfo, operation, subplan,
+		                      userid,
+		                      strVal(list_nth(fdw_private,
+		                                      FdwModifyPrivateUpdateSql)),
+		                      (List *) list_nth(fdw_private,
+		                                        FdwModifyPrivateTargetAttnums),
+		                      intVal(list_nth(fdw_private,
+		                                      FdwModifyPrivateHasReturning)),
+		                      (List *) list_nth(fdw_private,
+		                                        FdwModifyPrivateRetrievedAttrs));
+}
+
+/*
+ * create_foreign_modify
+ *		Construct an execution state of a foreign INSERT/UPDATE/DELETE
+ *		operation, for the remote access to be done as userid.
+ */
+static CassFdwModifyState *
+create_foreign_modify(EState *estate, ResultRelInfo *resultRelInfo,
+                      CmdType operation, Plan *subplan, Oid userid,
+                      char *query, List *target_attrs, bool has_returning,
+                      List *retrieved_attrs)
+{
+	CassFdwModifyState *fmstate;
+	Relation            rel       = resultRelInfo->ri_RelationDesc;
+	ForeignTable       *table;
+	ForeignServer      *server;
+	UserMapping        *user;
+	AttrNumber          n_params;
+	ListCell           *lc;
+	const char         *primaryKey;
+
+	/* Begin constructing CassFdwModifyState. */
+	fmstate = (CassFdwModifyState *) palloc0(sizeof(CassFdwModifyState));
+	fmstate->rel = rel;
+
+	/* Get info about foreign table. */
+	table = GetForeignTable(RelationGetRelid(rel));
+	server = GetForeignServer(table->serverid);
+	user = GetUserMapping(userid, server->serverid);
+
+	/*
+	 * Get connection to the foreign server.  Connection manager will
+	 * establish new connection if necessary.
+	 */
+	fmstate->cass_conn = pgcass_GetConnection(server, user, true);
+
+	cassGetWriteConsistencyOption(RelationGetRelid(fmstate->rel), &fmstate->write_consistency);
+
+	switch (operation)
+	{
+		case CMD_INSERT:
+			fmstate->opname = "INSERT";
+			break;
+		case CMD_UPDATE:
+			fmstate->opname = "UPDATE";
+			break;
+		default:
+			fmstate->opname = "DELETE";
+			break;
+	}
+
+	/* Only INSERTs are ever sent in batches. */
+	fmstate->batch_size = 1;
+	fmstate->batch_type = CASS_BATCH_TYPE_UNLOGGED;
+	if (operation == CMD_INSERT)
+	{
+		fmstate->batch_size = cassGetIntOption(RelationGetRelid(rel),
+		                                       "batch_size", 1);
+		fmstate->batch_type = cassGetBatchTypeOption(RelationGetRelid(rel));
+
+		/*
+		 * Batched rows are grouped by partition, and rows are identified by
+		 * their primary key in error reports.
+		 */
+		fmstate->partition_attrs = cassGetKeyColumns(RelationGetRelid(rel),
+		                                             true, NULL);
+		if (fmstate->partition_attrs != NIL)
+			fmstate->key_attrs =
+				list_concat(list_copy(fmstate->partition_attrs),
+				            cassGetKeyColumns(RelationGetRelid(rel), false,
+				                              NULL));
+	}
+
+	set_write_concurrency(fmstate, estate,
+	                      cassGetIntOption(RelationGetRelid(rel),
+	                                       "write_concurrency", 1));
+
+	/*
+	 * Driver objects are not palloc'd, so make sure the writes in flight
+	 * and a statement or batch being built are released even if the
+	 * statement fails before End*.
+	 */
+	{
+		MemoryContextCallback *cb;
+
+		cb = (MemoryContextCallback *)
+			MemoryContextAlloc(estate->es_query_cxt,
+			                   sizeof(MemoryContextCallback));
+		cb->func = cleanup_modify_callback;
+		cb->arg = (void *) fmstate;
+		MemoryContextRegisterResetCallback(estate->es_query_cxt, cb);
+	}
+
+	fmstate->query = query;
+	fmstate->target_attrs = target_attrs;
+	fmstate->has_returning = has_returning;
+	fmstate->retrieved_attrs = retrieved_attrs;
+
+	/*
+	 * The command is prepared once per session and kept by the connection
+	 * cache, so each row only sends its values, checked against the types
+	 * of the target columns, and goes to a replica of its partition.
+	 */
+	fmstate->prepared = pgcass_GetPrepared(fmstate->cass_conn, fmstate->query);
+
+	/* Create context for per-tuple temp workspace. */
+	fmstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
+	                                          "cassandra_fdw temporary data",
+	                                          ALLOCSET_SMALL_MINSIZE,
+	                                          ALLOCSET_SMALL_INITSIZE,
+	                                          ALLOCSET_SMALL_MAXSIZE);
+
+	/* Prepare for input conversion of RETURNING results. */
+	if (fmstate->has_returning)
+		fmstate->attinmeta = TupleDescGetAttInMetadata(RelationGetDescr(rel));
+
+	/* Prepare for output conversion of parameters used in modify stmt. */
+	n_params = list_length(fmstate->target_attrs) + 1;
+	fmstate->p_type_oids = (Oid *) palloc0(sizeof(Oid) * n_params);
+	fmstate->p_nums = 0;
+
+	if (operation == CMD_INSERT || operation == CMD_UPDATE)
+	{
+		/* Set up for remaining transmittable parameters */
+		foreach(lc, fmstate->target_attrs)
+		{
+			int			attnum = lfirst_int(lc);
+#if PG_VERSION_NUM < 110000
+			Form_pg_attribute attr = RelationGetDescr(rel)->attrs[attnum - 1];
+#else
+			Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
+#endif
+
+			Assert(!attr->attisdropped);
+
+			fmstate->p_type_oids[fmstate->p_nums] = attr->atttypid;
+			fmstate->p_nums++;
+		}
+	}
+
+	if (operation == CMD_UPDATE || operation == CMD_DELETE)
+	{
+		/* Find the key resjunk column in the subplan's result */
+		Form_pg_attribute  attr;
+		AttrNumber         attnum;
+
+		cassGetPKOption(rel->rd_id, &primaryKey);
+		fmstate->key_name = primaryKey;
+
+		fmstate->keyAttno = ExecFindJunkAttributeInTlist(subplan->targetlist,
+		                                                 primaryKey);
+
+		if (!AttributeNumberIsValid(fmstate->keyAttno))
+			ereport(ERROR,
+			        (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+			         errmsg("%s: Internal error -- could not find the "
+			                "junk attribute in the target list "
+			                "and modifying without a key is not possible",
+			                CSTAR_FDW_NAME)));
+
+		attnum = get_attnum(rel->rd_id, primaryKey);
+		elog(DEBUG5, CSTAR_FDW_NAME ": The PK attribute number is %d", attnum);
+
+#if PG_VERSION_NUM < 110000
+		attr = RelationGetDescr(rel)->attrs[attnum - 1];
+#else
+		attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
+#endif
+
+
+		Assert(strncmp(NameStr(attr->attname), primaryKey, strlen(primaryKey))
+		       == 0);
+
+		elog(DEBUG5, CSTAR_FDW_NAME
+		     ": The PK attribute name after mapping is %s",
+		     NameStr(attr->attname));
+
+		fmstate->p_type_oids[fmstate->p_nums] = attr->atttypid;
+		fmstate->p_nums++;
+	}
+
+	Assert(fmstate->p_nums <= n_params);
+
+	return fmstate;
+}
+
+/*
+ * set_write_concurrency
+ *		Set the number of writes that may be in flight, and set up the ring
+ *		for them if they are not waited for.
+ */
+static void
+set_write_concurrency(CassFdwModifyState *fmstate, EState *estate,
+                      int write_concurrency)
+{
+	fmstate->write_concurrency = write_concurrency;
+	if (write_concurrency > 1)
+	{
+		fmstate->inflight = (CassFuture **)
+			MemoryContextAlloc(estate->es_query_cxt,
+			                   write_concurrency * sizeof(CassFuture *));
+		fmstate->inflight_rows = (char **)
+			MemoryContextAlloc(estate->es_query_cxt,
+			                   write_concurrency * sizeof(char *));
+		fmstate->inflight_nrows = (int *)
+			MemoryContextAlloc(estate->es_query_cxt,
+			                   write_concurrency * sizeof(int));
+		if (fmstate->rows_cxt == NULL)
+			fmstate->rows_cxt = AllocSetContextCreate(estate->es_query_cxt,
+			                                          "cassandra_fdw rows in flight",
+			                                          ALLOCSET_SMALL_MINSIZE,
+			                                          ALLOCSET_SMALL_INITSIZE,
+			                                          ALLOCSET_SMALL_MAXSIZE);
+	}
+}
+
+
+/*
+ * releaseCassResources
+ *		Release in-use Cassandra statement and connection resources if any.
+ */
+static
+void releaseCassResources(EState *estate, ResultRelInfo *resultRelInfo)
+{
+	CassFdwModifyState *fmstate = (CassFdwModifyState *)
+		resultRelInfo->ri_FdwState;
+
+	/* if fmstate is NULL, we are in EXPLAIN; nothing to do */
+	if (fmstate == NULL)
+		return;
+
+	elog(DEBUG2, CSTAR_FDW_NAME ": release resources");
+
+	release_writes(fmstate);
+
+	/* Release remote connection */
+	pgcass_ReleaseConnection(fmstate->cass_conn);
+	fmstate->cass_conn = NULL;
+}
+
+/*
+ * release_writes
+ *		Free the statement and batch being built, if any, and the futures of
+ *		the writes in flight.
+ */
+static void
+release_writes(CassFdwModifyState *fmstate)
+{
+	/* Close the statement if open */
+	if (fmstate->statement)
+		cass_statement_free(fmstate->statement);
+	fmstate->statement = NULL;
+
+	/* Free the batch if one was being sent */
+	if (fmstate->batch)
+		cass_batch_free(fmstate->batch);
+	fmstate->batch = NULL;
+
+	/* Forget the writes in flight; freeing them does not cancel them */
+	while (fmstate->num_inflight > 0)
+	{
+		cass_future_free(fmstate->inflight[fmstate->inflight_head]);
+		fmstate->inflight_head = (fmstate->inflight_head + 1) %
+			fmstate->write_concurrency;
+		fmstate->num_inflight--;
+	}
+	if (fmstate->queuing)
+		cass_future_free(fmstate->queuing);
+	fmstate->queuing = NULL;
+}
+
+/*
+ * cleanup_modify_callback
+ *		Release the driver objects of a modify when its query memory goes
+ *		away, which covers statements aborted before End* runs.
+ */
+static void
+cleanup_modify_callback(void *arg)
+{
+	release_writes((CassFdwModifyState *) arg);
+}
+
+/*
+ * cassBindModifyParam
+ *		Bind a value, or NULL, to a param position of the current statement
+ *		while checking for errors and releasing resources upon error.
+ */
+static
+void cassBindModifyParam(CassFdwModifyState *fmstate, int pindex,
+                         Datum value, bool isnull, const char *opname,
+                         EState *estate, ResultRelInfo *resultRelInfo)
+{
+	Oid         ptypeid = fmstate->p_type_oids[pindex];
+	CassError   rc;
+
+	if (isnull && ptypeid == INT2OID)
+	{
+		releaseCassResources(estate, resultRelInfo);
+
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				 errmsg("Failed to execute %s into Cassandra: \n  "
+						"Unable to bind NULL to a SMALLINT COLUMN because of "
+						"%s", opname, SMALLINT_NULL_SET_ISSUE_URL)));
+	}
+
+	if (isnull)
+		rc = cass_statement_bind_null(fmstate->statement, pindex);
+	else
+		rc = bind_cass_statement_param(ptypeid, value, fmstate->statement,
+		                               pindex);
+
+	/* A prepared statement checks the value against its column's type. */
+	if (rc != CASS_OK)
+	{
+		releaseCassResources(estate, resultRelInfo);
+
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+				 errmsg("Failed to execute %s into Cassandra: \n  "
+						"Unable to bind parameter %d of type %s",
+						opname, pindex + 1, format_type_be(ptypeid)),
+				 errdetail_internal("%s", cass_error_desc(rc))));
+	}
+}
+
+/*
+ * cassBindInsertRow
+ *		Make the statement inserting the row of slot, bound to its values, the
+ *		current statement.
+ */
+static
+void cassBindInsertRow(CassFdwModifyState *fmstate, TupleTableSlot *slot,
+                       EState *estate, ResultRelInfo *resultRelInfo)
+{
+	int         pindex = 0;
+
+	fmstate->statement = cass_prepared_bind(fmstate->prepared);
+
+	if (slot != NULL && fmstate->target_attrs != NIL)
+	{
+		ListCell   *lc;
+
+		foreach(lc, fmstate->target_attrs)
+		{
+			int   attnum = lfirst_int(lc);
+			Datum value;
+			bool  isnull;
+
+			value = slot_getattr(slot, attnum, &isnull);
+			cassBindModifyParam(fmstate, pindex, value, isnull, "INSERT",
+			                    estate, resultRelInfo);
+
+			pindex++;
+		}
+
+		Assert(pindex == fmstate->p_nums);
+	}
+}
+
+/*
+ * cassDescribeWrite
+ *		Describe the row written from slot (INSERT) or planSlot (UPDATE and
+ *		DELETE) by its key, for error reports.  nrows is the size of the
+ *		batch it starts, if above 1.  Returns NULL if the key is unknown.
+ */
+static
+char *cassDescribeWrite(CassFdwModifyState *fmstate, TupleTableSlot *slot,
+                        TupleTableSlot *planSlot, int nrows)
+{
+	TupleDesc      tupdesc = RelationGetDescr(fmstate->rel);
+	StringInfoData names;
+	StringInfoData values;
+	List          *attnums = NIL;
+	ListCell      *lc;
+
+	/* UPDATE and DELETE find the key column in the junk attribute. */
+	if (fmstate->key_name != NULL)
+		attnums = list_make1_int(0);
+	else if (slot != NULL)
+		attnums = fmstate->key_attrs;
+	if (attnums == NIL)
+		return NULL;
+
+	initStringInfo(&names);
+	initStringInfo(&values);
+
+	foreach(lc, attnums)
+	{
+		int     attnum = lfirst_int(lc);
+		const char *name;
+		Oid     typoid;
+		Datum   value;
+		bool    isnull;
+
+		if (attnum == 0)
+		{
+			name = fmstate->key_name;
+			typoid = fmstate->p_type_oids[fmstate->p_nums - 1];
+			value = ExecGetJunkAttribute(planSlot, fmstate->keyAttno, &isnull);
+		}
+		else
+		{
+			Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+
+			name = NameStr(attr->attname);
+			typoid = attr->atttypid;
+			value = slot_getattr(slot, attnum, &isnull);
+		}
+
+		if (names.len > 0)
+		{
+			appendStringInfoString(&names, ", ");
+			appendStringInfoString(&values, ", ");
+		}
+		appendStringInfoString(&names, quote_identifier(name));
+		if (isnull)
+			appendStringInfoString(&values, "null");
+		else
+		{
+			Oid     output_func_oid;
+			bool    type_var_length;
+
+			getTypeOutputInfo(typoid, &output_func_oid, &type_var_length);
+			appendStringInfoString(&values,
+			                       OidOutputFunctionCall(output_func_oid,
+			                                             value));
+		}
+	}
+
+	if (nrows > 1)
+		return psprintf("Failing batch of %d rows starts with key (%s)=(%s).",
+		                nrows, names.data, values.data);
+	return psprintf("Failing row has key (%s)=(%s).", names.data, values.data);
+}
+
+/*
+ * cassHandleWrite
+ *		Take over the future of a write just sent.  Unless write_concurrency
+ *		lets it stay in flight, wait for it and check its outcome.
+ *
+ * Writes in flight together may reach Cassandra in any order.  They are
+ * still applied in the order they were sent, as each carries a larger
+ * timestamp than the ones before; see cassNextWriteTimestamp().
+ */
+static
+void cassHandleWrite(CassFdwModifyState *fmstate, CassFuture *future,
+                     TupleTableSlot *slot, TupleTableSlot *planSlot,
+                     int nrows, EState *estate, ResultRelInfo *resultRelInfo)
+{
+	MemoryContext oldcontext;
+	int           slotno;
+
+	if (fmstate->write_concurrency <= 1)
+	{
+		cass_future_wait(future);
+		if (cass_future_error_code(future) != CASS_OK)
+		{
+			cassReportWriteError(fmstate, future,
+			                     cassDescribeWrite(fmstate, slot, planSlot,
+			                                       nrows),
+			                     estate, resultRelInfo);
+			fmstate->rows_failed += nrows;
+		}
+		else
+			fmstate->rows_written += nrows;
+		cass_future_free(future);
+		return;
+	}
+
+	/*
+	 * Reap the writes that are done, then make room for this one by waiting
+	 * for the oldest if needed.  Until it has its place, it is kept aside
+	 * so that an error reaping the others still frees it.
+	 */
+	fmstate->queuing = future;
+	cassReapWrites(fmstate,
+	               fmstate->num_inflight == fmstate->write_concurrency ? 1 : 0,
+	               estate, resultRelInfo);
+	fmstate->queuing = NULL;
+
+	slotno = (fmstate->inflight_head + fmstate->num_inflight) %
+		fmstate->write_concurrency;
+	fmstate->inflight[slotno] = future;
+	fmstate->inflight_nrows[slotno] = nrows;
+	fmstate->num_inflight++;
+
+	/* The row is gone by the time the write fails, so describe it now. */
+	oldcontext = MemoryContextSwitchTo(fmstate->rows_cxt);
+	fmstate->inflight_rows[slotno] = cassDescribeWrite(fmstate, slot,
+	                                                   planSlot, nrows);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * cassReapWrites
+ *		Check the outcome of the writes in flight that are done, oldest
+ *		first, after waiting for the nwait oldest ones.
+ */
+static
+void cassReapWrites(CassFdwModifyState *fmstate, int nwait,
+                    EState *estate, ResultRelInfo *resultRelInfo)
+{
+	while (fmstate->num_inflight > 0)
+	{
+		int         head = fmstate->inflight_head;
+		CassFuture *future = fmstate->inflight[head];
+		char       *row = fmstate->inflight_rows[head];
+
+		if (nwait > 0)
+			nwait--;
+		else if (!cass_future_ready(future))
+			break;
+
+		/* Take it out of the ring first, so that an error doesn't free it. */
+		fmstate->inflight_head = (head + 1) % fmstate->write_concurrency;
+		fmstate->num_inflight--;
+
+		cass_future_wait(future);
+		if (cass_future_error_code(future) != CASS_OK)
+		{
+			cassReportWriteError(fmstate, future, row, estate, resultRelInfo);
+			fmstate->rows_failed += fmstate->inflight_nrows[head];
+		}
+		else
+			fmstate->rows_written += fmstate->inflight_nrows[head];
+		cass_future_free(future);
+		if (row)
+			pfree(row);
+	}
+}
+
+/*
+ * cassReportWriteError
+ *		Raise the error of a failed write, after releasing its future and the
+ *		other resources.  row is the description of the rows it wrote, or
+ *		NULL.
+ *
+ *		While a COPY has not had more than copy_max_errors failed writes,
+ *		the error is only reported as a warning, and the caller keeps the
+ *		future.
+ */
+static
+void cassReportWriteError(CassFdwModifyState *fmstate, CassFuture *future,
+                          const char *row, EState *estate,
+                          ResultRelInfo *resultRelInfo)
+{
+	const char* message;
+	size_t message_length;
+	char  *msg;
+
+	cass_future_error_message(future, &message, &message_length);
+	msg = pnstrdup(message, message_length);
+
+	if (fmstate->num_errors < fmstate->max_errors)
+	{
+		fmstate->num_errors++;
+		ereport(WARNING,
+		        (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+		         errmsg("Failed to execute the %s into Cassandra: %s",
+		                fmstate->opname, msg),
+		         row ? errdetail("%s", row) : 0));
+		pfree(msg);
+		return;
+	}
+
+	fmstate->num_errors++;
+	cass_future_free(future);
+	releaseCassResources(estate, resultRelInfo);
+
+	ereport(ERROR,
+	        (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+	         errmsg("Failed to execute the %s into Cassandra: %s",
+	                fmstate->opname, msg),
+	         row ? errdetail("%s", row) : 0));
+}
+
+/*
+ * cassNextWriteTimestamp
+ *		Return the write timestamp for the next write sent to Cassandra, in
+ *		microseconds since the Unix epoch.
+ *
+ * Cassandra keeps the write with the largest timestamp, so the writes of
+ * the backend get increasing timestamps, in the order they are sent.
+ */
+static
+int64 cassNextWriteTimestamp(void)
+{
+	static int64 last_timestamp = 0;
+	int64        timestamp;
+
+	timestamp = GetCurrentTimestamp() +
+		((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY);
+	if (timestamp <= last_timestamp)
+		timestamp = last_timestamp + 1;
+	last_timestamp = timestamp;
+
+	return timestamp;
+}
+
+/*
+ * cassExecForeignInsert
+ *		Insert one row into a FOREIGN TABLE
+ */
+static TupleTableSlot *cassExecForeignInsert(EState *estate,
+                                             ResultRelInfo *resultRelInfo,
+                                             TupleTableSlot *slot,
+                                             TupleTableSlot *planSlot)
+{
+	CassFdwModifyState *fmstate = (CassFdwModifyState *) resultRelInfo->ri_FdwState;
+	MemoryContext       oldcontext;
+	CassFuture*         future  = NULL;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": begin foreign INSERT on relation ID %d",
+		RelationGetRelid(resultRelInfo->ri_RelationDesc));
+
+	oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
+
+	cassBindInsertRow(fmstate, slot, estate, resultRelInfo);
+
+	cass_statement_set_consistency(fmstate->statement, fmstate->write_consistency);
+	cass_statement_set_timestamp(fmstate->statement, cassNextWriteTimestamp());
+	future = cass_session_execute(fmstate->cass_conn, fmstate->statement);
+	cass_statement_free(fmstate->statement);
+	fmstate->statement = NULL;
+
+	cassHandleWrite(fmstate, future, slot, planSlot, 1,
+	                estate, resultRelInfo);
+	MemoryContextSwitchTo(oldcontext);
+
+	MemoryContextReset(fmstate->temp_cxt);
+
+	return slot;
+}
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * cassGetForeignModifyBatchSize
+ *		Determine the number of rows an INSERT sends to Cassandra at once.
+ */
+static int cassGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
+{
+	CassFdwModifyState *fmstate = (CassFdwModifyState *) resultRelInfo->ri_FdwState;
+	int                 batch_size;
+
+	/* In EXPLAIN without ANALYZE, ri_FdwState is NULL; read the option. */
+	if (fmstate)
+		batch_size = fmstate->batch_size;
+	else
+		batch_size = cassGetIntOption(
+			RelationGetRelid(resultRelInfo->ri_RelationDesc), "batch_size", 1);
+
+	/*
+	 * RETURNING, WITH CHECK OPTION and row triggers need each row as soon as
+	 * it is inserted.
+	 */
+	if (resultRelInfo->ri_projectReturning != NULL ||
+		resultRelInfo->ri_WithCheckOptions != NIL ||
+		(resultRelInfo->ri_TrigDesc &&
+		 (resultRelInfo->ri_TrigDesc->trig_insert_before_row ||
+		  resultRelInfo->ri_TrigDesc->trig_insert_after_row)))
+		return 1;
+
+	return batch_size;
+}
+
+/*
+ * A row of a batch of INSERTs, with the hashes of its partition and primary
+ * keys.
+ */
+typedef struct CassBatchRow
+{
+	int			slotno;			/* index of its slot */
+	uint32		hash;			/* hash of its partition key values */
+	uint32		key_hash;		/* hash of its primary key values */
+	int			round;			/* # of earlier rows with the same key */
+} CassBatchRow;
+
+/*
+ * Order batch rows by partition key hash, keeping the order of the rows of
+ * each partition.
+ */
+static int
+cass_batch_row_cmp(const void *a, const void *b)
+{
+	const CassBatchRow *ra = (const CassBatchRow *) a;
+	const CassBatchRow *rb = (const CassBatchRow *) b;
+
+	if (ra->hash != rb->hash)
+		return ra->hash < rb->hash ? -1 : 1;
+	return ra->slotno - rb->slotno;
+}
+
+/*
+ * cassKeyHash
+ *		Hash the values of the key columns attrs of the row in slot.
+ */
+static uint32
+cassKeyHash(CassFdwModifyState *fmstate, TupleTableSlot *slot, List *attrs)
+{
+	TupleDesc   tupdesc = RelationGetDescr(fmstate->rel);
+	uint32      hash = 0;
+	ListCell   *lc;
+
+	foreach(lc, attrs)
+	{
+		int         attnum = lfirst_int(lc);
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+		Datum       value;
+		bool        isnull;
+
+		value = slot_getattr(slot, attnum, &isnull);
+		hash = hash_combine(hash, isnull ? 0 :
+		                    datum_image_hash(value, attr->attbyval,
+		                                     attr->attlen));
+	}
+
+	return hash;
+}
+
+/*
+ * cassSameKey
+ *		Do the rows in slots a and b have the same values for the key
+ *		columns attrs?
+ */
+static bool
+cassSameKey(CassFdwModifyState *fmstate, TupleTableSlot *a,
+            TupleTableSlot *b, List *attrs)
+{
+	TupleDesc   tupdesc = RelationGetDescr(fmstate->rel);
+	ListCell   *lc;
+
+	foreach(lc, attrs)
+	{
+		int         attnum = lfirst_int(lc);
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+		Datum       va;
+		Datum       vb;
+		bool        nulla;
+		bool        nullb;
+
+		va = slot_getattr(a, attnum, &nulla);
+		vb = slot_getattr(b, attnum, &nullb);
+		if (nulla != nullb)
+			return false;
+		if (!nulla && !datum_image_eq(va, vb, attr->attbyval, attr->attlen))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * cassSendInsertRows
+ *		Send the INSERTs of the n rows of slots listed in slotnos, as a
+ *		plain statement for a single row, else as a batch, and return the
+ *		future of the write.
+ */
+static CassFuture *
+cassSendInsertRows(CassFdwModifyState *fmstate, TupleTableSlot **slots,
+                   int *slotnos, int n, EState *estate,
+                   ResultRelInfo *resultRelInfo)
+{
+	CassFuture *future;
+	int         k;
+
+	if (n == 1)
+	{
+		cassBindInsertRow(fmstate, slots[slotnos[0]], estate, resultRelInfo);
+		cass_statement_set_consistency(fmstate->statement,
+		                               fmstate->write_consistency);
+		cass_statement_set_timestamp(fmstate->statement,
+		                             cassNextWriteTimestamp());
+		future = cass_session_execute(fmstate->cass_conn, fmstate->statement);
+		cass_statement_free(fmstate->statement);
+		fmstate->statement = NULL;
+
+		return future;
+	}
+
+	fmstate->batch = cass_batch_new(fmstate->batch_type);
+	cass_batch_set_consistency(fmstate->batch, fmstate->write_consistency);
+	cass_batch_set_timestamp(fmstate->batch, cassNextWriteTimestamp());
+
+	/* The batch keeps its own reference to each statement added. */
+	for (k = 0; k < n; k++)
+	{
+		cassBindInsertRow(fmstate, slots[slotnos[k]], estate, resultRelInfo);
+		cass_batch_add_statement(fmstate->batch, fmstate->statement);
+		cass_statement_free(fmstate->statement);
+		fmstate->statement = NULL;
+	}
+
+	future = cass_session_execute_batch(fmstate->cass_conn, fmstate->batch);
+	cass_batch_free(fmstate->batch);
+	fmstate->batch = NULL;
+
+	return future;
+}
+
+/*
+ * cassExecForeignBatchInsert
+ *		Insert multiple rows into a FOREIGN TABLE, in a batch per partition
+ *
+ * Batches spanning several partitions load their coordinator with
+ * forwarding every row to its replicas, so unless the batches are logged,
+ * the rows are grouped by partition key.  Each group goes out as a batch of
+ * its own, or as a plain statement for a single row, routed to a replica
+ * of its partition.  Up to write_concurrency groups are in flight at once.
+ *
+ * All the rows of a batch share its write timestamp, and Cassandra settles
+ * a tie between two writes of the same row by comparing their values, not
+ * by their order.  So the rows of a group repeating the primary key of an
+ * earlier one go out in a later batch, whose timestamp is larger.  When the
+ * primary key is not known, every row counts as a repeat, and the rows are
+ * sent one at a time.
+ */
+static TupleTableSlot **cassExecForeignBatchInsert(EState *estate,
+                                                   ResultRelInfo *resultRelInfo,
+                                                   TupleTableSlot **slots,
+                                                   TupleTableSlot **planSlots,
+                                                   int *numSlots)
+{
+	CassFdwModifyState *fmstate = (CassFdwModifyState *) resultRelInfo->ri_FdwState;
+	MemoryContext       oldcontext;
+	CassBatchRow       *rows;
+	CassFuture         *future;
+	int                *slotnos;
+	int                 first;
+	int                 i;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": begin foreign INSERT of %d rows on "
+		 "relation ID %d", *numSlots,
+		 RelationGetRelid(resultRelInfo->ri_RelationDesc));
+
+	oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
+
+	rows = (CassBatchRow *) palloc(*numSlots * sizeof(CassBatchRow));
+	slotnos = (int *) palloc(*numSlots * sizeof(int));
+
+	/*
+	 * Sort the rows by the hash of their partition key, so that the rows of
+	 * a partition come together.  Rows of partitions whose hashes collide
+	 * may interleave and end up in more groups than needed, which is
+	 * harmless.
+	 */
+	for (i = 0; i < *numSlots; i++)
+	{
+		rows[i].slotno = i;
+		rows[i].hash = 0;
+		rows[i].key_hash = cassKeyHash(fmstate, slots[i], fmstate->key_attrs);
 	}
+	if (fmstate->batch_type == CASS_BATCH_TYPE_UNLOGGED)
+	{
+		for (i = 0; i < *numSlots; i++)
+			rows[i].hash = cassKeyHash(fmstate, slots[i],
+			                           fmstate->partition_attrs);
+		qsort(rows, *numSlots, sizeof(CassBatchRow), cass_batch_row_cmp);
+	}
+
+	/*
+	 * Split them into groups of consecutive rows of the same partition, and
+	 * each group into rounds: a row is sent with the round after that of the
+	 * last earlier row of the group with the same primary key.
+	 */
+	for (first = 0; first < *numSlots; first = i)
+	{
+		int         nrounds = 0;
+		int         round;
+
+		for (i = first; i < *numSlots; i++)
+		{
+			int         j;
+
+			if (i > first &&
+				fmstate->batch_type == CASS_BATCH_TYPE_UNLOGGED &&
+				(rows[i].hash != rows[i - 1].hash ||
+				 !cassSameKey(fmstate, slots[rows[i].slotno],
+				              slots[rows[i - 1].slotno],
+				              fmstate->partition_attrs)))
+				break;
+
+			rows[i].round = 0;
+			for (j = i - 1; j >= first; j--)
+			{
+				if (rows[j].key_hash == rows[i].key_hash &&
+					cassSameKey(fmstate, slots[rows[j].slotno],
+					            slots[rows[i].slotno], fmstate->key_attrs))
+				{
+					rows[i].round = rows[j].round + 1;
+					break;
+				}
+			}
+			nrounds = Max(nrounds, rows[i].round + 1);
+		}
+
+		/* Send the rounds of the group in order. */
+		for (round = 0; round < nrounds; round++)
+		{
+			int         n = 0;
+			int         k;
+
+			for (k = first; k < i; k++)
+			{
+				if (rows[k].round == round)
+					slotnos[n++] = rows[k].slotno;
+			}
+
+			/* Up to write_concurrency writes are in flight at once. */
+			future = cassSendInsertRows(fmstate, slots, slotnos, n,
+			                            estate, resultRelInfo);
+			cassHandleWrite(fmstate, future, slots[slotnos[0]],
+			                planSlots[slotnos[0]], n, estate, resultRelInfo);
+		}
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	MemoryContextReset(fmstate->temp_cxt);
+
+	return slots;
+}
+#endif
+
+/*
+ * cassExecForeignUpdate
+ *		Update one row in a FOREIGN TABLE
+ */
+static TupleTableSlot *cassExecForeignUpdate(EState *estate,
+                                             ResultRelInfo *resultRelInfo,
+                                             TupleTableSlot *slot,
+                                             TupleTableSlot *planSlot)
+{
+	return cassExecPKPredWrite(
+		estate, resultRelInfo, slot, planSlot, "UPDATE");
 }
 
+/*
+ * cassExecForeignDelete
+ *		Delete one row from a FOREIGN TABLE
+ */
+static TupleTableSlot *cassExecForeignDelete(EState *estate,
+                                             ResultRelInfo *resultRelInfo,
+                                             TupleTableSlot *slot,
+                                             TupleTableSlot *planSlot)
+{
+	return cassExecPKPredWrite(
+		estate, resultRelInfo, slot, planSlot, "DELETE");
+}
 
 /*
- * cassPlanForeignModify
- *		Plan an INSERT/UPDATE/DELETE operation on a FOREIGN TABLE
+ * cassEndForeignModify
+ *		Finish an INSERT/UPDATE/DELETE operation on a FOREIGN TABLE.
+ */
+static void cassEndForeignModify(EState *estate, ResultRelInfo *resultRelInfo)
+{
+	CassFdwModifyState *fmstate = (CassFdwModifyState *) resultRelInfo->ri_FdwState;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": end foreign modify for relation ID %d",
+	     RelationGetRelid(resultRelInfo->ri_RelationDesc));
+
+	/* Wait for the writes still in flight, failing on the first error. */
+	if (fmstate != NULL)
+		cassReapWrites(fmstate, fmstate->num_inflight, estate, resultRelInfo);
+
+	releaseCassResources(estate, resultRelInfo);
+	/* MemoryContexts will be deleted automatically. */
+}
+
+#if PG_VERSION_NUM >= 110000
+/*
+ * cassBeginForeignInsert
+ *		Begin an insert operation on a foreign table, for COPY FROM or for
+ *		rows routed into a partition
  *
- * Note: currently, the plan tree generated for UPDATE/DELETE will always
- * include a ForeignScan that retrieves PKs and then the ModifyTable node will
- * have to execute individual remote UPDATE/DELETE commands.
+ * COPY keeps copy_concurrency rows in flight, written with the
+ * copy_consistency level, and may turn up to copy_max_errors failed writes
+ * into warnings.
  */
-static List *
-cassPlanForeignModify(PlannerInfo *root,
-					  ModifyTable *plan,
-					  Index resultRelation,
-					  int subplan_index)
+static void cassBeginForeignInsert(ModifyTableState *mtstate,
+                                   ResultRelInfo *resultRelInfo)
 {
-	CmdType		operation       = plan->operation;
-	RangeTblEntry  *rte             = planner_rt_fetch(resultRelation, root);
-	Relation        rel;
-	StringInfoData  sql;
-	List           *targetAttrs     = NIL;
-	List           *retrieved_attrs = NIL;
-	bool            doNothing       = false;
-	const char	   *primaryKey;
+	EState             *estate  = mtstate->ps.state;
+	ModifyTable        *plan    = (ModifyTable *) mtstate->ps.plan;
+	Relation            rel     = resultRelInfo->ri_RelationDesc;
+	Oid                 relid   = RelationGetRelid(rel);
+	TupleDesc           tupdesc = RelationGetDescr(rel);
+	Index               rtindex = resultRelInfo->ri_RangeTableIndex;
+	Oid                 userid  = GetUserId();
+	CassFdwModifyState *fmstate;
+	List               *targetAttrs = NIL;
+	StringInfoData      sql;
+	const char         *consistency;
+	int                 attnum;
 
-	elog(DEBUG1, CSTAR_FDW_NAME ": plan foreign modify");
+	elog(DEBUG1, CSTAR_FDW_NAME ": begin foreign insert on relation ID %d",
+		 relid);
+
+	/*
+	 * A partition that is also a target of the UPDATE routing rows into it
+	 * already has its state set up for the UPDATE.
+	 */
+	if (plan && plan->operation == CMD_UPDATE &&
+		resultRelInfo->ri_FdwState != NULL)
+		ereport(ERROR,
+		        (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+		         errmsg("cannot route tuples into foreign table to be updated \"%s\"",
+		                RelationGetRelationName(rel))));
+
+	/*
+	 * Identify which user to do the remote access as, from the target
+	 * relation of the statement.
+	 */
+#if PG_VERSION_NUM >= 140000
+	if (rtindex == 0 && resultRelInfo->ri_RootResultRelInfo != NULL)
+		rtindex = resultRelInfo->ri_RootResultRelInfo->ri_RangeTableIndex;
+#endif
+	if (rtindex > 0)
+	{
+		RangeTblEntry *rte = rt_fetch(rtindex, estate->es_range_table);
+
+		if (rte->checkAsUser)
+			userid = rte->checkAsUser;
+	}
+
+	/* Rows come with all their columns. */
+	for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+	{
+		if (!TupleDescAttr(tupdesc, attnum - 1)->attisdropped)
+			targetAttrs = lappend_int(targetAttrs, attnum);
+	}
 
 	initStringInfo(&sql);
+	cassDeparseInsertSql(&sql, NULL, rtindex, rel, targetAttrs, false);
+
+	fmstate = create_foreign_modify(estate, resultRelInfo, CMD_INSERT, NULL,
+	                                userid, sql.data, targetAttrs, false, NIL);
+
+	/* COPY runs without a plan. */
+	if (plan == NULL)
+	{
+		fmstate->is_copy = true;
+		set_write_concurrency(fmstate, estate,
+		                      cassGetIntOption(relid, "copy_concurrency",
+		                                       DEFAULT_COPY_CONCURRENCY));
+		consistency = cassGetStringOption(relid, "copy_consistency");
+		if (consistency != NULL)
+			fmstate->write_consistency = consistency_from_string(consistency);
+		fmstate->max_errors = cassGetIntOption(relid, "copy_max_errors", 0);
+		fmstate->start_time = GetCurrentTimestamp();
+	}
+
+	resultRelInfo->ri_FdwState = fmstate;
+}
+
+/*
+ * cassEndForeignInsert
+ *		Finish an insert operation on a foreign table, reporting how a COPY
+ *		went
+ */
+static void cassEndForeignInsert(EState *estate, ResultRelInfo *resultRelInfo)
+{
+	CassFdwModifyState *fmstate = (CassFdwModifyState *) resultRelInfo->ri_FdwState;
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": end foreign insert for relation ID %d",
+	     RelationGetRelid(resultRelInfo->ri_RelationDesc));
+
+	if (fmstate == NULL)
+		return;
+
+	/* Wait for the writes still in flight, failing on the first error. */
+	cassReapWrites(fmstate, fmstate->num_inflight, estate, resultRelInfo);
+
+	if (fmstate->is_copy)
+	{
+		long        secs;
+		int         usecs;
+		double      elapsed;
+
+		TimestampDifference(fmstate->start_time, GetCurrentTimestamp(),
+		                    &secs, &usecs);
+		elapsed = secs + usecs / 1000000.0;
+
+		ereport(NOTICE,
+		        (errmsg("%s: copied " INT64_FORMAT " rows into \"%s\" in %.3f s (%.0f rows/s), " INT64_FORMAT " rows failed in %d writes",
+		                CSTAR_FDW_NAME, fmstate->rows_written,
+		                RelationGetRelationName(resultRelInfo->ri_RelationDesc),
+		                elapsed,
+		                elapsed > 0 ? fmstate->rows_written / elapsed : 0.0,
+		                fmstate->rows_failed, fmstate->num_errors)));
+	}
+
+	releaseCassResources(estate, resultRelInfo);
+}
+#endif
+
+static void cassExplainForeignModify(ModifyTableState *mtstate,
+                                     ResultRelInfo *rinfo, List *fdw_private,
+                                     int subplan_index,
+                                     struct ExplainState *es)
+{
+	elog(DEBUG1, CSTAR_FDW_NAME ": explain foreign modify");
+
+#if PG_VERSION_NUM >= 140000
+	if (es->verbose && rinfo->ri_BatchSize > 0)
+		ExplainPropertyInteger("Batch Size", NULL, rinfo->ri_BatchSize, es);
+#endif
+}
+
+/*
+ * cassIsForeignRelUpdatable
+ *		Determine whether a FOREIGN TABLE supports INSERT, UPDATE and/or
+ *		DELETE.
+ */
+static int	cassIsForeignRelUpdatable(Relation rel)
+{
+	/*
+	 * Cassandra does not provide "read_only" tables and we do not need to
+	 * emulate them on the local side presently.
+	 */
+	return (1 << CMD_UPDATE) | (1 << CMD_INSERT) | (1 << CMD_DELETE);
+}
+
+/*
+ * Range table index of the foreign table a scan reads.  Scans computing
+ * aggregates have no scanrelid, but still cover exactly that one table.
+ */
+static Index
+scan_relation_index(ForeignScanState *node)
+{
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+
+	if (fsplan->scan.scanrelid > 0)
+		return fsplan->scan.scanrelid;
+	return (Index) bms_next_member(fsplan->fs_relids, -1);
+}
+
+/*
+ * OID of the foreign table a scan reads, for messages.
+ */
+static Oid
+scan_relation_id(ForeignScanState *node)
+{
+	return rt_fetch(scan_relation_index(node),
+					node->ss.ps.state->es_range_table)->relid;
+}
+
+/*
+ * Create cursor for node's query with current parameter values.
+ *
+ * This builds the statements of the scan's streams; pages are requested by
+ * fetch_more_data().  A partition key compared with "= ANY" of an array is
+ * read with one single-partition statement per distinct array element,
+ * which spreads the work over the replicas owning each partition rather
+ * than loading a single coordinator with a CQL IN query.
+ */
+static void
+create_cursor(ForeignScanState *node)
+{
+	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	MemoryContext query_cxt = node->ss.ps.state->es_query_cxt;
+	MemoryContext oldcontext;
+	Datum	   *values = NULL;
+	Datum	   *elems = NULL;
+	bool	   *elem_nulls = NULL;
+	int			nelems = 1;
+	int			array_param = -1;
+	Oid			elem_type = InvalidOid;
+	bool		no_rows = false;
+	int			i;
+
+	/*
+	 * Evaluate the current values of the pushed-down restrictions.
+	 */
+	oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+	if (fsstate->numParams > 0)
+	{
+		ListCell   *lc;
+
+		values = (Datum *) palloc(fsstate->numParams * sizeof(Datum));
+
+		i = 0;
+		foreach(lc, fsstate->param_exprs)
+		{
+			ExprState  *expr_state = (ExprState *) lfirst(lc);
+			bool		isnull;
+
+			values[i] = ExecEvalExpr(expr_state, econtext, &isnull);
+
+			/*
+			 * Comparing with NULL never succeeds, so there is nothing to
+			 * fetch; Cassandra would reject the NULL key value anyway.
+			 */
+			if (isnull)
+			{
+				no_rows = true;
+				break;
+			}
+
+			/* The array of an "= ANY" restriction is expanded into streams. */
+			if (type_is_array(fsstate->param_types[i]))
+			{
+				int16		typlen;
+				bool		typbyval;
+				char		typalign;
+
+				Assert(array_param < 0);
+				array_param = i;
+				elem_type = get_element_type(fsstate->param_types[i]);
+				get_typlenbyvalalign(elem_type, &typlen, &typbyval, &typalign);
+				deconstruct_array(DatumGetArrayTypeP(values[i]), elem_type,
+								  typlen, typbyval, typalign,
+								  &elems, &elem_nulls, &nelems);
+				nelems = dedup_array_elements(elems, elem_nulls, nelems,
+											  typlen, typbyval);
+			}
+			i++;
+		}
+	}
+	if (no_rows)
+		nelems = 0;
+
+	/*
+	 * A parallel scan reads one token range at a time, taking the next one
+	 * that no participant has read yet.  Any other scan split into token
+	 * ranges reads them all at once, one stream each, and takes rows from
+	 * whichever stream has a page ready first.
+	 */
+	if (fsstate->token_ranges > 0)
+	{
+		if (node->ss.ps.plan->parallel_aware)
+		{
+			fsstate->cur_range = claim_token_range(fsstate);
+			if (fsstate->cur_range < 0)
+				nelems = 0;
+		}
+		else
+			nelems = fsstate->token_ranges;
+	}
+
+	if (fsstate->prepare && fsstate->prepared == NULL && nelems > 0)
+		prepare_scan_statement(fsstate);
+
+	/*
+	 * Build one stream per partition to read.  The stream array is kept
+	 * across rescans, so only grow it when needed.
+	 */
+	if (fsstate->max_streams < nelems)
+	{
+		if (fsstate->streams)
+			pfree(fsstate->streams);
+		fsstate->streams = (CassScanStream *)
+			MemoryContextAlloc(query_cxt, nelems * sizeof(CassScanStream));
+		fsstate->inflight = (int *)
+			MemoryContextAlloc(query_cxt, nelems * sizeof(int));
+		fsstate->max_streams = nelems;
+	}
+
+	fsstate->num_streams = 0;
+	for (i = 0; i < nelems; i++)
+	{
+		CassStatement *statement;
+
+		if (fsstate->prepared)
+			statement = cass_prepared_bind(fsstate->prepared);
+		else
+			statement = cass_statement_new(fsstate->query,
+										   fsstate->numParams +
+										   (fsstate->token_ranges > 0 ? 2 : 0));
+		cass_statement_set_consistency(statement, fsstate->read_consistency);
+		cass_statement_set_paging_size(statement, fsstate->fetch_size);
+
+		if (!bind_scan_params(fsstate, statement, values, array_param,
+							  elem_type, elems ? elems[i] : (Datum) 0))
+		{
+			cass_statement_free(statement);
+			continue;
+		}
+
+		if (fsstate->token_ranges > 0)
+		{
+			int64		lower;
+			int64		upper;
+
+			cassTokenRangeBounds(fsstate->cur_range >= 0 ?
+								 fsstate->cur_range : i,
+								 fsstate->token_ranges, &lower, &upper);
+			cass_statement_bind_int64(statement, fsstate->numParams, lower);
+			cass_statement_bind_int64(statement, fsstate->numParams + 1,
+									  upper);
+		}
+
+		fsstate->streams[fsstate->num_streams].statement = statement;
+		fsstate->streams[fsstate->num_streams].pending = NULL;
+		fsstate->streams[fsstate->num_streams].finished = false;
+		fsstate->num_streams++;
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	/*
+	 * Each stream has at most one request in flight, and on top of the
+	 * "prefetch" pages wanted ahead there is room for a page per extra
+	 * concurrent request.
+	 */
+	fsstate->concurrency = Max(Min(fsstate->max_concurrent,
+								   fsstate->num_streams), 1);
+	fsstate->ring_size = Max(fsstate->prefetch + fsstate->concurrency - 1, 1);
+	if (fsstate->ring_capacity < fsstate->ring_size)
+	{
+		if (fsstate->pages)
+			pfree(fsstate->pages);
+		fsstate->pages = (const CassResult **)
+			MemoryContextAlloc(query_cxt,
+							   fsstate->ring_size * sizeof(CassResult *));
+		fsstate->ring_capacity = fsstate->ring_size;
+	}
+
+	/* Mark the cursor as created, and show no tuples have been retrieved */
+	fsstate->sql_sended = true;
+	fsstate->first_open = 0;
+	fsstate->num_unfinished = fsstate->num_streams;
+	fsstate->num_pending = 0;
+	fsstate->page_head = 0;
+	fsstate->num_pages = 0;
+	fsstate->fetch_ct_2 = 0;
+	fsstate->eof_reached = (fsstate->num_streams == 0);
+}
+
+/*
+ * Prepare the scan's statement, for its streams to be bound to from now on.
+ *
+ * A scan whose parameters keep changing, like the inner side of a nested
+ * loop joined on the partition key, then only sends the new values for each
+ * outer row instead of having Cassandra parse the statement every time.
+ */
+static void
+prepare_scan_statement(CassFdwScanState *fsstate)
+{
+	CassFuture *future;
+
+	future = cass_session_prepare(fsstate->cass_conn, fsstate->query);
+	cass_future_wait(future);
+	if (cass_future_error_code(future) != CASS_OK)
+		pgcass_report_error(ERROR, future, true, fsstate->query);
+
+	fsstate->prepared = cass_future_get_prepared(future);
+	cass_future_free(future);
+}
+
+/*
+ * Take the next token range for a parallel scan to read, from the shared
+ * state if there is one.  Returns -1 once all have been taken.
+ */
+static int
+claim_token_range(CassFdwScanState *fsstate)
+{
+	uint32		range;
+
+	if (fsstate->pscan)
+		range = pg_atomic_fetch_add_u32(&fsstate->pscan->next_range, 1);
+	else
+		range = fsstate->next_range++;
+
+	return range < (uint32) fsstate->token_ranges ? (int) range : -1;
+}
+
+/*
+ * Compute the bounds of token range number range out of nranges, which
+ * split the ring of the Murmur3 partitioner evenly.  The range holds the
+ * tokens greater than *lower, and up to *upper inclusive; the minimum
+ * token is never that of a partition.
+ */
+static void
+cassTokenRangeBounds(int range, int nranges, int64 *lower, int64 *upper)
+{
+	uint64		step = PG_UINT64_MAX / (uint64) nranges;
 
-	/*
-	 * Core code already has some lock on each rel being planned, so we can
-	 * use NoLock here.
-	 */
+	*lower = (int64) ((uint64) PG_INT64_MIN + step * (uint64) range);
+	if (range == nranges - 1)
+		*upper = PG_INT64_MAX;
+	else
+		*upper = (int64) ((uint64) PG_INT64_MIN + step * (uint64) (range + 1));
+}
 
-#if PG_VERSION_NUM < 120000
-	rel = heap_open(rte->relid, NoLock);
-#else
-	rel = table_open(rte->relid, NoLock);
-#endif
+/*
+ * Bind the parameter values of the scan to one of its statements, using
+ * elem in place of the array parameter, if any.
+ *
+ * Returns false if the statement cannot match anything, because a timestamp
+ * compared for equality has more precision than Cassandra keeps.
+ */
+static bool
+bind_scan_params(CassFdwScanState *fsstate, CassStatement *statement,
+				 Datum *values, int array_param, Oid elem_type, Datum elem)
+{
+	int			i;
 
-	/*
-	 * In an INSERT, we transmit all columns that are defined in the FOREIGN
-	 * TABLE.  In an UPDATE, we transmit only columns that were explicitly
-	 * targets of the UPDATE, so as to avoid unnecessary data transmission.
-	 * (We can't do that for INSERT since we would miss sending default values
-	 * for columns not listed in the source statement.)
-	 */
-	if (operation == CMD_INSERT)
+	for (i = 0; i < fsstate->numParams; i++)
 	{
-		TupleDesc	tupdesc = RelationGetDescr(rel);
-		int			attnum;
+		Oid			type = fsstate->param_types[i];
+		Datum		value = values[i];
 
-		for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+		if (i == array_param)
 		{
-#if PG_VERSION_NUM < 110000
-			Form_pg_attribute attr = tupdesc->attrs[attnum - 1];
-#else
-			Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
-#endif
-
-			if (!attr->attisdropped)
-				targetAttrs = lappend_int(targetAttrs, attnum);
+			type = elem_type;
+			value = elem;
 		}
+
+		if (!cassBindKeyValue(statement, i, type, value,
+							  list_nth_int(fsstate->param_strategies, i)))
+			return false;
 	}
-	else if (operation == CMD_UPDATE)
-	{
-		int			col;
-		Bitmapset		*updatedCols = rte->updatedCols;
 
-		col = -1;
-		while ((col = bms_next_member(updatedCols, col)) >= 0)
-		{
-			/* bit numbers are offset by FirstLowInvalidHeapAttributeNumber */
-			AttrNumber	attno = col + FirstLowInvalidHeapAttributeNumber;
+	return true;
+}
 
-			if (attno <= InvalidAttrNumber)		/* shouldn't happen */
-				elog(ERROR, "system-column update is not supported");
-			targetAttrs = lappend_int(targetAttrs, attno);
-		}
+/*
+ * Bind value, compared with a key column using the given btree strategy,
+ * to parameter pindex of statement.
+ *
+ * Returns false if the statement cannot match anything, because a timestamp
+ * compared for equality has more precision than Cassandra keeps.
+ */
+bool
+cassBindKeyValue(CassStatement *statement, int pindex, Oid type, Datum value,
+				 int strategy)
+{
+	CassError	rc;
+
+	if (type == TIMESTAMPOID || type == TIMESTAMPTZOID)
+	{
+		int64		msecs;
+
+		if (!cassTimestampBound(DatumGetTimestamp(value), strategy, &msecs))
+			return false;
+		rc = cass_statement_bind_int64(statement, pindex, msecs);
 	}
+	else
+		rc = bind_cass_statement_param(type, value, statement, pindex);
 
-	/*
-	 * ON CONFLICT DO UPDATE and DO NOTHING case with inference specification
-	 * should have already been rejected in the optimizer, as presently there
-	 * is no way to recognize an arbiter index on a foreign table.  Only DO
-	 * NOTHING is supported without an inference specification.
-	 */
-	if (plan->onConflictAction == ONCONFLICT_NOTHING)
-		doNothing = true;
-	else if (plan->onConflictAction != ONCONFLICT_NONE)
-		elog(ERROR, "unexpected ON CONFLICT specification: %d",
-			 (int) plan->onConflictAction);
+	/* A prepared statement checks the value against its column's type. */
+	if (rc != CASS_OK)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+				 errmsg("Unable to bind parameter %d of type %s",
+						pindex + 1, format_type_be(type)),
+				 errdetail_internal("%s", cass_error_desc(rc))));
 
-	cassGetPKOption(rte->relid, &primaryKey);
-	/*
-	 * Construct the SQL command string.
-	 */
-	switch (operation)
+	return true;
+}
+
+/*
+ * Remove NULLs and duplicates from the elements of an "= ANY" array, so
+ * that each partition is read only once.  Returns the new element count.
+ *
+ * The key types we push down compare equal exactly when their binary
+ * representations do, so datumIsEqual() is good enough here.
+ */
+static int
+dedup_array_elements(Datum *elems, bool *nulls, int nelems,
+					 int16 typlen, bool typbyval)
+{
+	int			n = 0;
+	int			i;
+	int			j;
+
+	for (i = 0; i < nelems; i++)
 	{
-		case CMD_INSERT:
-				cassDeparseInsertSql(&sql, root, resultRelation, rel,
-									 targetAttrs, doNothing);
-				break;
-		case CMD_UPDATE:
-				cassDeparseUpdateSql(&sql, root, resultRelation, rel,
-									 targetAttrs, primaryKey);
+		if (nulls[i])
+			continue;
+
+		for (j = 0; j < n; j++)
+		{
+			if (datumIsEqual(elems[i], elems[j], typbyval, typlen))
 				break;
-		case CMD_DELETE:
-				cassDeparseDeleteSql(&sql, root, resultRelation, rel,
-									 &retrieved_attrs, primaryKey);
-			break;
-		default:
-			elog(ERROR, "unexpected operation: %d", (int) operation);
-			break;
+		}
+		if (j == n)
+			elems[n++] = elems[i];
 	}
-#if PG_VERSION_NUM < 120000
-	heap_close(rel, NoLock);
-#else
-	table_close(rel, NoLock);
-#endif
 
-	/*
-	 * Build the fdw_private list that will be available to the executor.
-	 * Items in the list must match enum FdwModifyPrivateIndex, above.
-	 */
-	return list_make4(makeString(sql.data),
-					  targetAttrs,
-					  makeInteger((retrieved_attrs != NIL)),
-					  retrieved_attrs);
+	return n;
 }
 
 /*
- * cassBeginForeignModify
- *		Begin an INSERT/UPDATE/DELETE operation on a foreign table
+ * Utility routine to close a cursor.
  */
-static void cassBeginForeignModify(ModifyTableState *mtstate,
-                                   ResultRelInfo *resultRelInfo,
-                                   List *fdw_private, int subplan_index,
-                                   int eflags)
+static void
+close_cursor(CassFdwScanState *fsstate)
 {
-	CassFdwModifyState *fmstate;
-	EState             *estate    = mtstate->ps.state;
-	CmdType             operation = mtstate->operation;
-	Relation            rel       = resultRelInfo->ri_RelationDesc;
-	RangeTblEntry      *rte;
-	Oid                 userid;
-	ForeignTable       *table;
-	ForeignServer      *server;
-	UserMapping        *user;
-	AttrNumber          n_params;
-	ListCell           *lc;
-	const char         *primaryKey;
+	int			i;
 
-	elog(DEBUG1, CSTAR_FDW_NAME ": begin foreign modify on relation ID %d",
-		RelationGetRelid(resultRelInfo->ri_RelationDesc));
+	release_current_page(fsstate);
 
-	/*
-	 * Do nothing in EXPLAIN (no ANALYZE) case.  resultRelInfo->ri_FdwState
-	 * stays NULL.
-	 */
-	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-		return;
+	/* An abandoned request is cancelled from our side by freeing it. */
+	for (i = 0; i < fsstate->num_streams; i++)
+	{
+		CassScanStream *stream = &fsstate->streams[i];
 
-	/* Begin constructing CassFdwModifyState. */
-	fmstate = (CassFdwModifyState *) palloc0(sizeof(CassFdwModifyState));
-	fmstate->rel = rel;
+		if (stream->pending)
+			cass_future_free(stream->pending);
+		stream->pending = NULL;
 
-	/*
-	 * Identify which user to do the remote access as.  This should match what
-	 * ExecCheckRTEPerms() does.
-	 */
-	rte = rt_fetch(resultRelInfo->ri_RangeTableIndex, estate->es_range_table);
-	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+		if (stream->statement)
+			cass_statement_free(stream->statement);
+		stream->statement = NULL;
+	}
+	fsstate->num_streams = 0;
+	fsstate->num_pending = 0;
+	fsstate->num_unfinished = 0;
 
-	/* Get info about foreign table. */
-	table = GetForeignTable(RelationGetRelid(rel));
-	server = GetForeignServer(table->serverid);
-	user = GetUserMapping(userid, server->serverid);
+	while (fsstate->num_pages > 0)
+	{
+		cass_result_free(fsstate->pages[fsstate->page_head]);
+		fsstate->page_head = (fsstate->page_head + 1) % fsstate->ring_size;
+		fsstate->num_pages--;
+	}
+	fsstate->page_head = 0;
+}
 
-	/*
-	 * Get connection to the foreign server.  Connection manager will
-	 * establish new connection if necessary.
-	 */
-	fmstate->cass_conn = pgcass_GetConnection(server, user, false);
-	fmstate->sql_sent = false;
+/*
+ * Release the page whose rows we have finished returning.
+ */
+static void
+release_current_page(CassFdwScanState *fsstate)
+{
+	if (fsstate->rows)
+		cass_iterator_free(fsstate->rows);
+	fsstate->rows = NULL;
 
-	cassGetWriteConsistencyOption(RelationGetRelid(fmstate->rel), &fmstate->write_consistency);
+	if (fsstate->result)
+		cass_result_free(fsstate->result);
+	fsstate->result = NULL;
+}
 
-	/* Deconstruct fdw_private data. */
-	fmstate->query = strVal(list_nth(fdw_private,
-									 FdwModifyPrivateUpdateSql));
-	fmstate->target_attrs = (List *) list_nth(fdw_private,
-											  FdwModifyPrivateTargetAttnums);
-	fmstate->has_returning = intVal(list_nth(fdw_private,
-											 FdwModifyPrivateHasReturning));
-	fmstate->retrieved_attrs = (List *) list_nth(fdw_private,
-											 FdwModifyPrivateRetrievedAttrs);
+/*
+ * Memory context callback releasing the driver objects of a scan that was
+ * not shut down by cassEndForeignScan, e.g. because of an error.
+ */
+static void
+cleanup_cursor_callback(void *arg)
+{
+	CassFdwScanState *fsstate = (CassFdwScanState *) arg;
 
-	/* Create context for per-tuple temp workspace. */
-	fmstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
-	                                          "cassandra_fdw temporary data",
-	                                          ALLOCSET_SMALL_MINSIZE,
-	                                          ALLOCSET_SMALL_INITSIZE,
-	                                          ALLOCSET_SMALL_MAXSIZE);
+	if (fsstate->sql_sended)
+		close_cursor(fsstate);
+	fsstate->sql_sended = false;
 
-	/* Prepare for input conversion of RETURNING results. */
-	if (fmstate->has_returning)
-		fmstate->attinmeta = TupleDescGetAttInMetadata(RelationGetDescr(rel));
+	if (fsstate->prepared)
+		cass_prepared_free(fsstate->prepared);
+	fsstate->prepared = NULL;
+}
 
-	/* Prepare for output conversion of parameters used in modify stmt. */
-	n_params = list_length(fmstate->target_attrs) + 1;
-	fmstate->p_type_oids = (Oid *) palloc0(sizeof(Oid) * n_params);
-	fmstate->p_nums = 0;
+/*
+ * Send asynchronous requests for the next pages of the cursor's streams.
+ *
+ * Requests go out as long as fewer than "concurrency" are in flight and,
+ * counting those, fewer than window pages are queued or in flight.  Streams
+ * already under way are continued before new ones are started.
+ */
+static void
+request_pages(CassFdwScanState *fsstate, int window)
+{
+	int			i = fsstate->first_open;
 
-	if (operation == CMD_INSERT || operation == CMD_UPDATE)
-	{
-		/* Set up for remaining transmittable parameters */
-		foreach(lc, fmstate->target_attrs)
-		{
-			int			attnum = lfirst_int(lc);
-#if PG_VERSION_NUM < 110000
-			Form_pg_attribute attr = RelationGetDescr(rel)->attrs[attnum - 1];
-#else
-			Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
-#endif
+	Assert(window <= fsstate->ring_size);
 
-			Assert(!attr->attisdropped);
+	while (fsstate->num_pending < fsstate->concurrency &&
+		   fsstate->num_pending + fsstate->num_pages < window)
+	{
+		CassScanStream *stream;
+
+		/* Find the next stream that can take a request. */
+		while (i < fsstate->num_streams &&
+			   (fsstate->streams[i].finished ||
+				fsstate->streams[i].pending != NULL))
+			i++;
+		if (i >= fsstate->num_streams)
+			break;
 
-			fmstate->p_type_oids[fmstate->p_nums] = attr->atttypid;
-			fmstate->p_nums++;
-		}
+		stream = &fsstate->streams[i];
+		stream->pending = cass_session_execute(fsstate->cass_conn,
+											   stream->statement);
+		fsstate->inflight[fsstate->num_pending++] = i;
 	}
+}
 
-	if (operation == CMD_UPDATE || operation == CMD_DELETE)
+/*
+ * Move completed page requests into the ring of received pages.
+ *
+ * If wait is true, block until at least one in-flight request completes.
+ * After pages arrive, the requests for the following pages are sent right
+ * away as long as the ring has room for them, so that up to ring_size pages
+ * are queued or in flight ahead of the page being returned.
+ */
+static void
+collect_pages(CassFdwScanState *fsstate, bool wait)
+{
+	for (;;)
 	{
-		/* Find the key resjunk column in the subplan's result */
-		Plan              *subplan = mtstate->mt_plans[subplan_index]->plan;
-		Form_pg_attribute  attr;
-		AttrNumber         attnum;
-
-		cassGetPKOption(rel->rd_id, &primaryKey);
+		bool		collected = false;
+		int			k = 0;
 
-		fmstate->keyAttno = ExecFindJunkAttributeInTlist(subplan->targetlist,
-		                                                 primaryKey);
+		while (k < fsstate->num_pending)
+		{
+			CassScanStream *stream = &fsstate->streams[fsstate->inflight[k]];
+			CassFuture *future = stream->pending;
+			const CassResult *res;
 
-		if (!AttributeNumberIsValid(fmstate->keyAttno))
-			ereport(ERROR,
-			        (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-			         errmsg("%s: Internal error -- could not find the "
-			                "junk attribute in the target list "
-			                "and modifying without a key is not possible",
-			                CSTAR_FDW_NAME)));
+			if (!cass_future_ready(future))
+			{
+				k++;
+				continue;
+			}
 
-		attnum = get_attnum(rel->rd_id, primaryKey);
-		elog(DEBUG5, CSTAR_FDW_NAME ": The PK attribute number is %d", attnum);
+			/* Forget the request; the last in-flight entry takes its place. */
+			stream->pending = NULL;
+			fsstate->inflight[k] = fsstate->inflight[--fsstate->num_pending];
 
-#if PG_VERSION_NUM < 110000
-		attr = RelationGetDescr(rel)->attrs[attnum - 1];
-#else
-		attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
-#endif
+			/* On error, report the original query. */
+			if (cass_future_error_code(future) != CASS_OK)
+				pgcass_report_error(ERROR, future, true, fsstate->query);
 
+			res = cass_future_get_result(future);
+			cass_future_free(future);
 
-		Assert(strncmp(NameStr(attr->attname), primaryKey, strlen(primaryKey))
-		       == 0);
+			Assert(fsstate->num_pages < fsstate->ring_size);
+			fsstate->pages[(fsstate->page_head + fsstate->num_pages) %
+						   fsstate->ring_size] = res;
+			fsstate->num_pages++;
+			collected = true;
 
-		elog(DEBUG5, CSTAR_FDW_NAME
-		     ": The PK attribute name after mapping is %s",
-		     NameStr(attr->attname));
+			/* Remember where the stream's next page starts, if there is one. */
+			if (cass_result_has_more_pages(res))
+				cass_statement_set_paging_state(stream->statement, res);
+			else
+			{
+				stream->finished = true;
+				fsstate->num_unfinished--;
+				while (fsstate->first_open < fsstate->num_streams &&
+					   fsstate->streams[fsstate->first_open].finished)
+					fsstate->first_open++;
+			}
+		}
 
-		fmstate->p_type_oids[fmstate->p_nums] = attr->atttypid;
-		fmstate->p_nums++;
-	}
+		if (collected)
+			request_pages(fsstate, fsstate->ring_size);
 
-	Assert(fmstate->p_nums <= n_params);
+		if (!wait || collected || fsstate->num_pending == 0)
+			break;
 
-	resultRelInfo->ri_FdwState = fmstate;
+		/*
+		 * Nothing has arrived yet.  Block on one request; when others are
+		 * in flight too, only briefly, as any of them may complete first.
+		 */
+		if (fsstate->num_pending == 1)
+			cass_future_wait(fsstate->streams[fsstate->inflight[0]].pending);
+		else
+			cass_future_wait_timed(fsstate->streams[fsstate->inflight[0]].pending,
+								   CASS_POLL_USECS);
+		CHECK_FOR_INTERRUPTS();
+	}
 }
 
 /*
- * releaseCassResources
- *		Release in-use Cassandra statement and connection resources if any.
+ * Fetch the next page of rows from the node's cursor.
+ *
+ * Pages of at most fetch_size rows are requested one after another for each
+ * stream, each resuming from the paging state of its predecessor, and are
+ * returned in the order they arrive.  With a non-zero prefetch, or several
+ * streams, the requests for the following pages are sent as soon as this
+ * one is dequeued, so the round trips overlap with returning its rows.  The
+ * rows themselves stay in the driver's result until they are decoded into
+ * the scan slot one at a time.
  */
-static
-void releaseCassResources(EState *estate, ResultRelInfo *resultRelInfo)
+static void
+fetch_more_data(ForeignScanState *node)
 {
-	CassFdwModifyState *fmstate = (CassFdwModifyState *)
-		resultRelInfo->ri_FdwState;
+	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
 
-	/* if fmstate is NULL, we are in EXPLAIN; nothing to do */
-	if (fmstate == NULL)
-		return;
+	/* First, release the previous page. */
+	release_current_page(fsstate);
 
-	elog(DEBUG2, CSTAR_FDW_NAME ": release resources");
+	/* Pick up anything that has arrived, then wait if we have nothing. */
+	collect_pages(fsstate, false);
+	if (fsstate->num_pages == 0)
+	{
+		request_pages(fsstate, fsstate->ring_size);
+		collect_pages(fsstate, true);
+	}
 
-	/* Close the statement if open */
-	if (fmstate->statement && fmstate->sql_sent)
-		cass_statement_free(fmstate->statement);
+	if (fsstate->num_pages == 0)
+	{
+		fsstate->eof_reached = true;
+		return;
+	}
 
-	/* Release remote connection */
-	pgcass_ReleaseConnection(fmstate->cass_conn);
-	fmstate->cass_conn = NULL;
-}
+	/* Dequeue the oldest page. */
+	fsstate->result = fsstate->pages[fsstate->page_head];
+	fsstate->page_head = (fsstate->page_head + 1) % fsstate->ring_size;
+	fsstate->num_pages--;
 
-/*
- * cassStatementBindNull
- *		Bind NULL to a param position while checking for errors and releasing
- *		resources upon error.
- */
-static
-void cassStatementBindNull(const CassStatement *stmt,
-                           int pindex, Oid ptypeid, const char *opname,
-                           EState *estate, ResultRelInfo *resultRelInfo)
-{
-	if (ptypeid == INT2OID)
-	{
-		releaseCassResources(estate, resultRelInfo);
+	/* Keep the pipeline full while this page is being returned. */
+	request_pages(fsstate, fsstate->prefetch + fsstate->concurrency - 1);
 
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				 errmsg("Failed to execute %s into Cassandra: \n  "
-						"Unable to bind NULL to a SMALLINT COLUMN because of "
-						"%s", opname, SMALLINT_NULL_SET_ISSUE_URL)));
+	/*
+	 * On the first page, work out once how each column is converted; every
+	 * later row of the scan reuses that plan.
+	 */
+	if (fsstate->colplan == NULL)
+	{
+		MemoryContext oldcontext;
+
+		oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+		fsstate->NumberOfColumns = cass_result_column_count(fsstate->result);
+		fsstate->colplan = cassBuildColumnPlan(fsstate->result,
+											   fsstate->tupdesc,
+											   fsstate->attinmeta,
+											   fsstate->retrieved_attrs);
+		MemoryContextSwitchTo(oldcontext);
 	}
 
-	cass_statement_bind_null((CassStatement *) stmt, pindex);
+	fsstate->rows = cass_iterator_from_result(fsstate->result);
+
+	/* Update fetch_ct_2 */
+	if (fsstate->fetch_ct_2 < 2)
+		fsstate->fetch_ct_2++;
+
+	/* No more pages will arrive once the last one has been dequeued. */
+	if (fsstate->num_unfinished == 0 && fsstate->num_pages == 0)
+		fsstate->eof_reached = true;
 }
 
 /*
- * cassExecForeignInsert
- *		Insert one row into a FOREIGN TABLE
+ * cassDecodeRow
+ *		Convert a result row into the values/isnull arrays of a tuple with
+ *		natts attributes, following the column plan.
+ *
+ * Pass-by-reference values are allocated in the current memory context.
  */
-static TupleTableSlot *cassExecForeignInsert(EState *estate,
-                                             ResultRelInfo *resultRelInfo,
-                                             TupleTableSlot *slot,
-                                             TupleTableSlot *planSlot)
+void
+cassDecodeRow(const CassRow *row, const CassColumnPlan *colplan, int ncolumn,
+			  int natts, Datum *values, bool *isnull)
 {
-	CassFdwModifyState *fmstate = (CassFdwModifyState *) resultRelInfo->ri_FdwState;
-	int                 pindex  = 0;
-	MemoryContext       oldcontext;
-	CassFuture*         future  = NULL;
-	CassError           rc      = CASS_OK;
-
-	elog(DEBUG1, CSTAR_FDW_NAME ": begin foreign INSERT on relation ID %d",
-		RelationGetRelid(resultRelInfo->ri_RelationDesc));
-
-	oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
+	int			j;
 
-	if (!fmstate->sql_sent)
-		fmstate->statement = cass_statement_new(fmstate->query,
-		                                        fmstate->p_nums);
+	/* Initialize to nulls for any columns not present in result */
+	memset(values, 0, natts * sizeof(Datum));
+	memset(isnull, true, natts * sizeof(bool));
 
-	if (slot != NULL && fmstate->target_attrs != NIL)
+	/*
+	 * j indexes columns in the result; the plan maps each to its attribute.
+	 */
+	for (j = 0; j < ncolumn; j++)
 	{
-		ListCell   *lc;
-
-		foreach(lc, fmstate->target_attrs)
-		{
-			int   attnum = lfirst_int(lc);
-			Datum value;
-			bool  isnull;
+		const CassColumnPlan *col = &colplan[j];
+		const CassValue *cassVal;
 
-			value = slot_getattr(slot, attnum, &isnull);
-			if (isnull)
-				cassStatementBindNull(fmstate->statement, pindex,
-				                      fmstate->p_type_oids[pindex], "INSERT",
-				                      estate, resultRelInfo);
-			else
-				bind_cass_statement_param(fmstate->p_type_oids[pindex],
-				                          value, fmstate->statement, pindex);
+		if (col->attnum <= 0)
+			continue;
 
-			pindex++;
+		Assert(col->attnum <= natts);
+		cassVal = cass_row_get_column(row, j);
+		if (cass_true == cass_value_is_null(cassVal))
+		{
+			/* Apply the input function even to nulls, to support domains */
+			values[col->attnum - 1] = InputFunctionCall(col->infunc, NULL,
+														col->ioparam,
+														col->typmod);
+		}
+		else
+		{
+			isnull[col->attnum - 1] = false;
+			values[col->attnum - 1] = col->convert(cassVal, col);
 		}
-
-		Assert(pindex == fmstate->p_nums);
 	}
+}
 
-	cass_statement_set_consistency(fmstate->statement, fmstate->write_consistency);
-	future = cass_session_execute(fmstate->cass_conn, fmstate->statement);
-	fmstate->sql_sent = true;
-	cass_future_wait(future);
-
-	rc = cass_future_error_code(future);
-
-	if (rc != CASS_OK)
+static void
+pgcass_transferValue(StringInfo buf, const CassValue* value)
+{
+	CassValueType type = cass_value_type(value);
+	switch (type)
 	{
-		const char* message;
-		size_t message_length;
-		cass_future_error_message(future, &message, &message_length);
-		cass_future_free(future);
-		releaseCassResources(estate, resultRelInfo);
+	case CASS_VALUE_TYPE_TINY_INT:
+	{
+		cass_int8_t i;
+		cass_value_get_int8(value, &i);
+		appendStringInfo(buf, "%d", i);
+		break;
+	}
+	case CASS_VALUE_TYPE_SMALL_INT:
+	{
+		cass_int16_t i;
+		cass_value_get_int16(value, &i);
+		appendStringInfo(buf, "%d", i);
+		break;
+	}
+	case CASS_VALUE_TYPE_INT:
+	{
+		cass_int32_t i;
+		cass_value_get_int32(value, &i);
+		appendStringInfo(buf, "%d", i);
+		break;
+	}
+	case CASS_VALUE_TYPE_BIGINT:
+	case CASS_VALUE_TYPE_COUNTER:
+	{
+		cass_int64_t i;
+		cass_value_get_int64(value, &i);
+		appendStringInfo(buf, "%lld ", (long long int)i);
+		break;
+	}
+	case CASS_VALUE_TYPE_BOOLEAN:
+	{
+		cass_bool_t b;
+		cass_value_get_bool(value, &b);
+		appendStringInfoString(buf, b ? "true" : "false");
+		break;
+	}
+	case CASS_VALUE_TYPE_FLOAT:
+	{
+		cass_float_t d;
+		cass_value_get_float(value, &d);
+		appendStringInfo(buf, "%.*g", FLT_DIG + 3, d);
+		break;
+	}
+	case CASS_VALUE_TYPE_DOUBLE:
+	{
+		cass_double_t d;
+		cass_value_get_double(value, &d);
+		appendStringInfo(buf, "%.*g", DBL_DIG + 3, d);
+		break;
+	}
 
-		ereport(ERROR,
-		        (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-		         errmsg("Failed to execute the INSERT into Cassandra: %.*s",
-		                (int)message_length, message)));
+	case CASS_VALUE_TYPE_TEXT:
+	case CASS_VALUE_TYPE_ASCII:
+	case CASS_VALUE_TYPE_VARCHAR:
+	{
+		const char* s;
+		size_t s_length;
+		cass_value_get_string(value, &s, &s_length);
+		appendStringInfo(buf, "%.*s", (int)s_length, s);
+		break;
 	}
+	case CASS_VALUE_TYPE_TIMESTAMP:
+	{
+		cass_int64_t timestamp;
 
-	cass_future_free(future);
-	MemoryContextSwitchTo(oldcontext);
+		cass_value_get_int64(value, &timestamp);
+		/* cassandra stores in milliseconds so convert to seconds */
+		timestamp /= MSECS_PER_SEC;
+		appendStringInfo(buf, "%s %s",
+					  asctime(gmtime(((time_t *) &timestamp))), LITERAL_UTC);
+		break;
+	}
+	case CASS_VALUE_TYPE_UUID:
+	case CASS_VALUE_TYPE_TIMEUUID:
+	{
+		CassUuid u;
 
-	MemoryContextReset(fmstate->temp_cxt);
+		cass_value_get_uuid(value, &u);
+		cass_uuid_string(u, buf->data + buf->len);
+		buf->len += CASS_UUID_STRING_LENGTH;
+		buf->data[buf->len] = '\0';
+		break;
+	}
+	case CASS_VALUE_TYPE_INET:
+	{
+		CassInet i;
 
-	return slot;
+		cass_value_get_inet(value, &i);
+		cass_inet_string(i, buf->data + buf->len);
+		buf->len += CASS_INET_STRING_LENGTH;
+		buf->data[buf->len] = '\0';
+		break;
+	}
+	case CASS_VALUE_TYPE_LIST:
+	case CASS_VALUE_TYPE_MAP:
+	default:
+		appendStringInfoString(buf, "<unhandled type>");
+		break;
+	}
 }
 
 /*
- * cassExecForeignUpdate
- *		Update one row in a FOREIGN TABLE
+ * Readers for the integer Cassandra types, widened to int64.
  */
-static TupleTableSlot *cassExecForeignUpdate(EState *estate,
-                                             ResultRelInfo *resultRelInfo,
-                                             TupleTableSlot *slot,
-                                             TupleTableSlot *planSlot)
+static int64
+read_tinyint(const CassValue *value)
 {
-	return cassExecPKPredWrite(
-		estate, resultRelInfo, slot, planSlot, "UPDATE");
+	cass_int8_t i;
+
+	cass_value_get_int8(value, &i);
+	return i;
 }
 
-/*
- * cassExecForeignDelete
- *		Delete one row from a FOREIGN TABLE
- */
-static TupleTableSlot *cassExecForeignDelete(EState *estate,
-                                             ResultRelInfo *resultRelInfo,
-                                             TupleTableSlot *slot,
-                                             TupleTableSlot *planSlot)
+static int64
+read_smallint(const CassValue *value)
 {
-	return cassExecPKPredWrite(
-		estate, resultRelInfo, slot, planSlot, "DELETE");
+	cass_int16_t i;
+
+	cass_value_get_int16(value, &i);
+	return i;
 }
 
-/*
- * cassEndForeignModify
- *		Finish an INSERT/UPDATE/DELETE operation on a FOREIGN TABLE.
- */
-static void cassEndForeignModify(EState *estate, ResultRelInfo *resultRelInfo)
+static int64
+read_int(const CassValue *value)
 {
-	elog(DEBUG1, CSTAR_FDW_NAME ": end foreign modify for relation ID %d",
-	     RelationGetRelid(resultRelInfo->ri_RelationDesc));
+	cass_int32_t i;
 
-	releaseCassResources(estate, resultRelInfo);
-	/* MemoryContexts will be deleted automatically. */
+	cass_value_get_int32(value, &i);
+	return i;
 }
 
-static void cassExplainForeignModify(ModifyTableState *mtstate,
-                                     ResultRelInfo *rinfo, List *fdw_private,
-                                     int subplan_index,
-                                     struct ExplainState *es)
+static int64
+read_bigint(const CassValue *value)
 {
-	elog(DEBUG1, CSTAR_FDW_NAME ": explain foreign modify");
+	cass_int64_t i;
+
+	cass_value_get_int64(value, &i);
+	return i;
 }
 
 /*
- * cassIsForeignRelUpdatable
- *		Determine whether a FOREIGN TABLE supports INSERT, UPDATE and/or
- *		DELETE.
+ * Converters from non-NULL Cassandra values straight to Datums, without
+ * going through the text representation.
  */
-static int	cassIsForeignRelUpdatable(Relation rel)
+static Datum
+convert_to_int2(const CassValue *value, const CassColumnPlan *col)
 {
-	/*
-	 * Cassandra does not provide "read_only" tables and we do not need to
-	 * emulate them on the local side presently.
-	 */
-	return (1 << CMD_UPDATE) | (1 << CMD_INSERT) | (1 << CMD_DELETE);
+	int64		i = col->read_int(value);
+
+	if (i < PG_INT16_MIN || i > PG_INT16_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("smallint out of range")));
+	return Int16GetDatum((int16) i);
+}
+
+static Datum
+convert_to_int4(const CassValue *value, const CassColumnPlan *col)
+{
+	int64		i = col->read_int(value);
+
+	if (i < PG_INT32_MIN || i > PG_INT32_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("integer out of range")));
+	return Int32GetDatum((int32) i);
+}
+
+static Datum
+convert_to_int8(const CassValue *value, const CassColumnPlan *col)
+{
+	return Int64GetDatum(col->read_int(value));
 }
 
-/*
- * Create cursor for node's query with current parameter values.
- */
-static void
-create_cursor(ForeignScanState *node)
+static Datum
+convert_bool(const CassValue *value, const CassColumnPlan *col)
 {
-	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
+	cass_bool_t b;
 
-	/* Build statement and execute query */
-	fsstate->statement = cass_statement_new(fsstate->query, 0);
+	cass_value_get_bool(value, &b);
+	return BoolGetDatum(b == cass_true);
+}
 
-	/* Mark the cursor as created, and show no tuples have been retrieved */
-	fsstate->sql_sended = true;
-	fsstate->tuples = NULL;
-	fsstate->num_tuples = 0;
-	fsstate->next_tuple = 0;
-	fsstate->fetch_ct_2 = 0;
-	fsstate->eof_reached = false;
+static Datum
+convert_float_to_float4(const CassValue *value, const CassColumnPlan *col)
+{
+	cass_float_t f;
+
+	cass_value_get_float(value, &f);
+	return Float4GetDatum(f);
 }
 
-/*
- * Utility routine to close a cursor.
- */
-static void
-close_cursor(CassFdwScanState *fsstate)
+static Datum
+convert_float_to_float8(const CassValue *value, const CassColumnPlan *col)
 {
-	if (fsstate->statement)
-		cass_statement_free(fsstate->statement);
+	cass_float_t f;
+
+	cass_value_get_float(value, &f);
+	return Float8GetDatum((float8) f);
 }
 
-/*
- * Fetch some more rows from the node's cursor.
- */
-static void
-fetch_more_data(ForeignScanState *node)
+static Datum
+convert_double_to_float8(const CassValue *value, const CassColumnPlan *col)
 {
-	CassFdwScanState *fsstate = (CassFdwScanState *) node->fdw_state;
-	MemoryContext oldcontext;
-	CassFuture* 	result_future = NULL;
+	cass_double_t d;
 
-	/*
-	 * We'll store the tuples in the batch_cxt.  First, flush the previous
-	 * batch.
-	 */
-	fsstate->tuples = NULL;
-	MemoryContextReset(fsstate->batch_cxt);
-	oldcontext = MemoryContextSwitchTo(fsstate->batch_cxt);
+	cass_value_get_double(value, &d);
+	return Float8GetDatum(d);
+}
 
-	{
-		cass_statement_set_consistency(fsstate->statement, fsstate->read_consistency);
-		result_future = cass_session_execute(fsstate->cass_conn, fsstate->statement);
-		if (cass_future_error_code(result_future) == CASS_OK)
-		{
-			const CassResult* res;
-			int			numrows;
-			CassIterator* rows;
-			int			k;
+static Datum
+convert_text(const CassValue *value, const CassColumnPlan *col)
+{
+	const char *s;
+	size_t		s_length;
 
-			/* Retrieve result set and iterate over the rows */
-			res = cass_future_get_result(result_future);
+	cass_value_get_string(value, &s, &s_length);
+	return PointerGetDatum(cstring_to_text_with_len(s, (int) s_length));
+}
 
-			/* Stash away the state info we have already */
-			fsstate->NumberOfColumns = cass_result_column_count(res);
+static Datum
+convert_timestamp(const CassValue *value, const CassColumnPlan *col)
+{
+	cass_int64_t msecs;
+	Timestamp	ts;
+	Datum		result;
 
-			/* Convert the data into HeapTuples */
-			numrows = cass_result_row_count(res);
-			fsstate->tuples = (HeapTuple *) palloc0(numrows * sizeof(HeapTuple));
-			fsstate->num_tuples = numrows;
-			fsstate->next_tuple = 0;
+	/*
+	 * Cassandra counts milliseconds since the Unix epoch; a timestamp
+	 * without time zone receives the UTC wall-clock time.
+	 */
+	cass_value_get_int64(value, &msecs);
+	ts = (Timestamp) msecs * (USECS_PER_SEC / MSECS_PER_SEC) -
+		((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY);
+	if (!IS_VALID_TIMESTAMP(ts))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range")));
+
+	result = TimestampGetDatum(ts);
+	if (col->typmod >= 0)
+		result = DirectFunctionCall2(col->pgtype == TIMESTAMPTZOID ?
+									 timestamptz_scale : timestamp_scale,
+									 result, Int32GetDatum(col->typmod));
+	return result;
+}
 
-			rows = cass_iterator_from_result(res);
-			k = 0;
-			while (cass_iterator_next(rows))
-			{
-				const CassRow* row = cass_iterator_get_row(rows);
+static Datum
+convert_uuid(const CassValue *value, const CassColumnPlan *col)
+{
+	CassUuid	u;
+	pg_uuid_t  *uuid;
+	uint64		bits;
+	int			k;
 
-				fsstate->tuples[k] = make_tuple_from_result_row(row,
-															fsstate->NumberOfColumns,
-															fsstate->rel,
-															fsstate->attinmeta,
-															fsstate->retrieved_attrs,
-															fsstate->temp_cxt);
+	cass_value_get_uuid(value, &u);
 
-				Assert(k < numrows);
-				k++;
-			}
+	/*
+	 * time_and_version holds time_low in its low 32 bits, then time_mid
+	 * and time_hi_and_version; the wire format is big-endian per field.
+	 */
+	uuid = (pg_uuid_t *) palloc(sizeof(pg_uuid_t));
+	bits = u.time_and_version;
+	uuid->data[0] = (unsigned char) (bits >> 24);
+	uuid->data[1] = (unsigned char) (bits >> 16);
+	uuid->data[2] = (unsigned char) (bits >> 8);
+	uuid->data[3] = (unsigned char) bits;
+	uuid->data[4] = (unsigned char) (bits >> 40);
+	uuid->data[5] = (unsigned char) (bits >> 32);
+	uuid->data[6] = (unsigned char) (bits >> 56);
+	uuid->data[7] = (unsigned char) (bits >> 48);
+	bits = u.clock_seq_and_node;
+	for (k = 15; k >= 8; k--)
+	{
+		uuid->data[k] = (unsigned char) bits;
+		bits >>= 8;
+	}
+	return UUIDPGetDatum(uuid);
+}
 
-			fsstate->eof_reached = true;
+static Datum
+convert_inet(const CassValue *value, const CassColumnPlan *col)
+{
+	CassInet	i;
+	inet	   *addr;
 
-			cass_result_free(res);
-			cass_iterator_free(rows);
-		}
-		else
-		{
-			/* On error, report the original query. */
-			pgcass_report_error(ERROR, result_future, true, fsstate->query);
+	cass_value_get_inet(value, &i);
+	if (i.address_length != 4 && i.address_length != 16)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid inet address length %d",
+						(int) i.address_length)));
+
+	addr = (inet *) palloc0(sizeof(inet));
+	ip_family(addr) = (i.address_length == 4) ? PGSQL_AF_INET : PGSQL_AF_INET6;
+	ip_bits(addr) = i.address_length * 8;
+	memcpy(ip_addr(addr), i.address, i.address_length);
+	SET_INET_VARSIZE(addr);
+	return InetPGetDatum(addr);
+}
 
-			fsstate->eof_reached = true;
-		}
+/*
+ * Fallback converter: print the value and parse it with the input function
+ * of the target type.  This is also what enforces domain constraints.
+ */
+static Datum
+convert_via_input(const CassValue *value, const CassColumnPlan *col)
+{
+	Datum		result;
 
-		cass_future_free(result_future);
-		MemoryContextSwitchTo(oldcontext);
-	}
+	resetStringInfo(col->buf);
+	pgcass_transferValue(col->buf, value);
+	result = InputFunctionCall(col->infunc, col->buf->data,
+							   col->ioparam, col->typmod);
+	return result;
 }
 
-static HeapTuple
-make_tuple_from_result_row(const CassRow* row,
-						   int ncolumn,
-						   Relation rel,
-						   AttInMetadata *attinmeta,
-						   List *retrieved_attrs,
-						   MemoryContext temp_context)
+/*
+ * cassBuildColumnPlan
+ *		Choose, once per scan, how each result column is converted into its
+ *		target attribute.
+ *
+ * Column types are taken from the result metadata, so a Cassandra type that
+ * cannot be converted at all is reported here instead of on every row.
+ */
+CassColumnPlan *
+cassBuildColumnPlan(const CassResult *res, TupleDesc tupdesc,
+					AttInMetadata *attinmeta, List *retrieved_attrs)
 {
-	HeapTuple	tuple;
-	TupleDesc	tupdesc = RelationGetDescr(rel);
-	Datum	   *values;
-	bool	   *nulls;
-	MemoryContext oldcontext;
+	int			ncolumn = cass_result_column_count(res);
+	CassColumnPlan *colplan;
+	StringInfo	buf;
 	ListCell   *lc;
 	int			j;
-	StringInfoData buf;
 
 	/*
-	 * Do the following work in a temp context that we reset after each tuple.
-	 * This cleans up not only the data we have direct access to, but any
-	 * cruft the I/O functions might leak.
+	 * Check we got the expected number of columns.  Note: no retrieved
+	 * attributes and one column is expected only for a table without
+	 * undropped columns, since deparse emits a NULL then.
 	 */
-	oldcontext = MemoryContextSwitchTo(temp_context);
-
-	values = (Datum *) palloc0(tupdesc->natts * sizeof(Datum));
-	nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
-	/* Initialize to nulls for any columns not present in result */
-	memset(nulls, true, tupdesc->natts * sizeof(bool));
+	if (retrieved_attrs != NIL && list_length(retrieved_attrs) != ncolumn)
+		elog(ERROR, "remote query result does not match the foreign table");
 
-	initStringInfo(&buf);
+	colplan = (CassColumnPlan *) palloc0(Max(ncolumn, 1) * sizeof(CassColumnPlan));
+	buf = makeStringInfo();
 
-	/*
-	 * i indexes columns in the relation, j indexes columns in the PGresult.
-	 */
 	j = 0;
 	foreach(lc, retrieved_attrs)
 	{
+		CassColumnPlan *col = &colplan[j];
 		int			i = lfirst_int(lc);
-		const char	   *valstr;
+		CassValueType ctype = cass_result_column_type(res, j);
+		Form_pg_attribute attr;
+		bool		has_text_form = true;
 
-		const CassValue* cassVal = cass_row_get_column(row, j);
-		if (cass_true == cass_value_is_null(cassVal))
-			valstr = NULL;
-		else
+		j++;
+		if (i <= 0)
+			continue;
+
+		Assert(i <= tupdesc->natts);
+#if PG_VERSION_NUM < 110000
+		attr = tupdesc->attrs[i - 1];
+#else
+		attr = TupleDescAttr(tupdesc, i - 1);
+#endif
+
+		col->attnum = i;
+		col->pgtype = attr->atttypid;
+		col->typmod = attr->atttypmod;
+		col->infunc = &attinmeta->attinfuncs[i - 1];
+		col->ioparam = attinmeta->attioparams[i - 1];
+		col->buf = buf;
+		col->convert = NULL;
+
+		switch (ctype)
 		{
-			pgcass_transferValue(&buf, cassVal);
-			valstr = buf.data;
+			case CASS_VALUE_TYPE_TINY_INT:
+			case CASS_VALUE_TYPE_SMALL_INT:
+			case CASS_VALUE_TYPE_INT:
+			case CASS_VALUE_TYPE_BIGINT:
+			case CASS_VALUE_TYPE_COUNTER:
+				if (ctype == CASS_VALUE_TYPE_TINY_INT)
+					col->read_int = read_tinyint;
+				else if (ctype == CASS_VALUE_TYPE_SMALL_INT)
+					col->read_int = read_smallint;
+				else if (ctype == CASS_VALUE_TYPE_INT)
+					col->read_int = read_int;
+				else
+					col->read_int = read_bigint;
+
+				if (col->pgtype == INT2OID)
+					col->convert = convert_to_int2;
+				else if (col->pgtype == INT4OID)
+					col->convert = convert_to_int4;
+				else if (col->pgtype == INT8OID)
+					col->convert = convert_to_int8;
+				break;
+			case CASS_VALUE_TYPE_BOOLEAN:
+				if (col->pgtype == BOOLOID)
+					col->convert = convert_bool;
+				break;
+			case CASS_VALUE_TYPE_FLOAT:
+				if (col->pgtype == FLOAT4OID)
+					col->convert = convert_float_to_float4;
+				else if (col->pgtype == FLOAT8OID)
+					col->convert = convert_float_to_float8;
+				break;
+			case CASS_VALUE_TYPE_DOUBLE:
+				if (col->pgtype == FLOAT8OID)
+					col->convert = convert_double_to_float8;
+				break;
+			case CASS_VALUE_TYPE_TEXT:
+			case CASS_VALUE_TYPE_ASCII:
+			case CASS_VALUE_TYPE_VARCHAR:
+				/* varchar(n) needs its length check from the input function */
+				if (col->pgtype == TEXTOID ||
+					(col->pgtype == VARCHAROID && col->typmod < 0))
+					col->convert = convert_text;
+				break;
+			case CASS_VALUE_TYPE_TIMESTAMP:
+				if (col->pgtype == TIMESTAMPTZOID || col->pgtype == TIMESTAMPOID)
+					col->convert = convert_timestamp;
+				break;
+			case CASS_VALUE_TYPE_UUID:
+			case CASS_VALUE_TYPE_TIMEUUID:
+				if (col->pgtype == UUIDOID)
+					col->convert = convert_uuid;
+				break;
+			case CASS_VALUE_TYPE_INET:
+				if (col->pgtype == INETOID)
+					col->convert = convert_inet;
+				break;
+			default:
+				has_text_form = false;
+				break;
 		}
 
-		if (i > 0)
+		if (col->convert == NULL)
 		{
-			/* ordinary column */
-			Assert(i <= tupdesc->natts);
-			nulls[i - 1] = (valstr == NULL);
-			/* Apply the input function even to nulls, to support domains */
-			values[i - 1] = InputFunctionCall(&attinmeta->attinfuncs[i - 1],
-											  (char *) valstr,
-											  attinmeta->attioparams[i - 1],
-											  attinmeta->atttypmods[i - 1]);
-		}
+			if (!has_text_form)
+			{
+				const char *colname;
+				size_t		colname_length;
 
-		resetStringInfo(&buf);
+				cass_result_column_name(res, j - 1, &colname, &colname_length);
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+						 errmsg("cannot convert Cassandra column \"%.*s\" of type %s "
+								"to column \"%s\" of type %s",
+								(int) colname_length, colname,
+								pgcass_typeName(ctype),
+								NameStr(attr->attname),
+								format_type_with_typemod(col->pgtype,
+														 col->typmod))));
+			}
 
-		j++;
+			/* Domains and other target types are parsed from text. */
+			col->convert = convert_via_input;
+		}
 	}
 
-	/*
-	 * Check we got the expected number of columns.  Note: j == 0 and
-	 * PQnfields == 1 is expected, since deparse emits a NULL if no columns.
-	 */
-	if (j > 0 && j != ncolumn)
-		elog(ERROR, "remote query result does not match the foreign table");
-
-	/*
-	 * Build the result tuple in caller's memory context.
-	 */
-	MemoryContextSwitchTo(oldcontext);
-
-	tuple = heap_form_tuple(tupdesc, values, nulls);
-
-	/* Clean up */
-	MemoryContextReset(temp_context);
+	return colplan;
+}
 
-	return tuple;
+/*
+ * Return the CQL name of a Cassandra type, for error messages.
+ */
+static const char *
+pgcass_typeName(CassValueType type)
+{
+	switch (type)
+	{
+		case CASS_VALUE_TYPE_ASCII:		return "ascii";
+		case CASS_VALUE_TYPE_BIGINT:	return "bigint";
+		case CASS_VALUE_TYPE_BLOB:		return "blob";
+		case CASS_VALUE_TYPE_BOOLEAN:	return "boolean";
+		case CASS_VALUE_TYPE_COUNTER:	return "counter";
+		case CASS_VALUE_TYPE_DECIMAL:	return "decimal";
+		case CASS_VALUE_TYPE_DOUBLE:	return "double";
+		case CASS_VALUE_TYPE_FLOAT:		return "float";
+		case CASS_VALUE_TYPE_INT:		return "int";
+		case CASS_VALUE_TYPE_TEXT:		return "text";
+		case CASS_VALUE_TYPE_TIMESTAMP:	return "timestamp";
+		case CASS_VALUE_TYPE_UUID:		return "uuid";
+		case CASS_VALUE_TYPE_VARCHAR:	return "varchar";
+		case CASS_VALUE_TYPE_VARINT:	return "varint";
+		case CASS_VALUE_TYPE_TIMEUUID:	return "timeuuid";
+		case CASS_VALUE_TYPE_INET:		return "inet";
+		case CASS_VALUE_TYPE_DATE:		return "date";
+		case CASS_VALUE_TYPE_TIME:		return "time";
+		case CASS_VALUE_TYPE_SMALL_INT:	return "smallint";
+		case CASS_VALUE_TYPE_TINY_INT:	return "tinyint";
+		case CASS_VALUE_TYPE_LIST:		return "list";
+		case CASS_VALUE_TYPE_MAP:		return "map";
+		case CASS_VALUE_TYPE_SET:		return "set";
+		case CASS_VALUE_TYPE_UDT:		return "user-defined type";
+		case CASS_VALUE_TYPE_TUPLE:		return "tuple";
+		default:						return "unknown";
+	}
 }
 
 static void
-pgcass_transferValue(StringInfo buf, const CassValue* value)
+pgcass_transformDataType(StringInfo buf, CassValueType type)
 {
-	CassValueType type = cass_value_type(value);
+	char *valid_datatype = NULL, *invalid_datatype = NULL;
 	switch (type)
 	{
 	case CASS_VALUE_TYPE_TINY_INT:
 	{
-		cass_int8_t i;
-		cass_value_get_int8(value, &i);
-		appendStringInfo(buf, "%d", i);
+		invalid_datatype = "tinyint";
 		break;
 	}
 	case CASS_VALUE_TYPE_SMALL_INT:
 	{
-		cass_int16_t i;
-		cass_value_get_int16(value, &i);
-		appendStringInfo(buf, "%d", i);
+		valid_datatype = "smallint";
 		break;
 	}
 	case CASS_VALUE_TYPE_INT:
 	{
-		cass_int32_t i;
-		cass_value_get_int32(value, &i);
-		appendStringInfo(buf, "%d", i);
+		valid_datatype = "integer";
 		break;
 	}
 	case CASS_VALUE_TYPE_BIGINT:
 	case CASS_VALUE_TYPE_COUNTER:
 	{
-		cass_int64_t i;
-		cass_value_get_int64(value, &i);
-		appendStringInfo(buf, "%lld ", (long long int)i);
+		valid_datatype = "bigint";
 		break;
 	}
 	case CASS_VALUE_TYPE_BOOLEAN:
 	{
-		cass_bool_t b;
-		cass_value_get_bool(value, &b);
-		appendStringInfoString(buf, b ? "true" : "false");
+		valid_datatype = "boolean";
+		break;
+	}
+	case CASS_VALUE_TYPE_DOUBLE:
+	{
+		valid_datatype = "double precision";
 		break;
 	}
 	case CASS_VALUE_TYPE_FLOAT:
 	{
-		cass_float_t d;
-		cass_value_get_float(value, &d);
-		appendStringInfo(buf, "%f", d);
+		valid_datatype = "real";
 		break;
 	}
-	case CASS_VALUE_TYPE_DOUBLE:
+	case CASS_VALUE_TYPE_DECIMAL:
 	{
-		cass_double_t d;
-		cass_value_get_double(value, &d);
-		appendStringInfo(buf, "%f", d);
+		invalid_datatype = "decimal";
 		break;
 	}
-
 	case CASS_VALUE_TYPE_TEXT:
 	case CASS_VALUE_TYPE_ASCII:
 	case CASS_VALUE_TYPE_VARCHAR:
 	{
-		const char* s;
-		size_t s_length;
-		cass_value_get_string(value, &s, &s_length);
-		appendStringInfo(buf, "%.*s", (int)s_length, s);
+		valid_datatype = "text";
 		break;
 	}
 	case CASS_VALUE_TYPE_TIMESTAMP:
 	{
-		cass_int64_t timestamp;
-
-		cass_value_get_int64(value, &timestamp);
-		/* cassandra stores in milliseconds so convert to seconds */
-		timestamp /= MSECS_PER_SEC;
-		appendStringInfo(buf, "%s %s",
-					  asctime(gmtime(((time_t *) &timestamp))), LITERAL_UTC);
+		valid_datatype = "timestamp(0) with time zone";
 		break;
 	}
-	case CASS_VALUE_TYPE_UUID:
+	case CASS_VALUE_TYPE_INET:
 	{
-		CassUuid u;
-
-		cass_value_get_uuid(value, &u);
-		cass_uuid_string(u, buf->data + buf->len);
-		buf->len += CASS_UUID_STRING_LENGTH;
-		buf->data[buf->len] = '\0';
+		valid_datatype = "inet";
 		break;
 	}
-	case CASS_VALUE_TYPE_INET:
+	case CASS_VALUE_TYPE_UUID:
 	{
-		CassInet i;
-
-		cass_value_get_inet(value, &i);
-		cass_inet_string(i, buf->data + buf->len);
-		buf->len += CASS_INET_STRING_LENGTH;
-		buf->data[buf->len] = '\0';
+		valid_datatype = "uuid";
 		break;
 	}
 	case CASS_VALUE_TYPE_LIST:
+	{
+		invalid_datatype = "list";
+		break;
+	}
 	case CASS_VALUE_TYPE_MAP:
+		invalid_datatype = "map";
+		break;
 	default:
-		appendStringInfoString(buf, "<unhandled type>");
+		invalid_datatype = "unknown";
 		break;
 	}
+
+	if (valid_datatype)
+		appendStringInfoString(buf, valid_datatype);
+	else
+		ereport(ERROR,
+		        (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+		         errmsg("Data type %s not supported.", invalid_datatype)));
 }
 
-static void
-pgcass_transformDataType(StringInfo buf, CassValueType type)
+/*
+ * Examine each qual clause in input_conds, and classify them into two groups,
+ * which are returned as two lists:
+ *	- remote_conds contains expressions that can be evaluated remotely
+ *	- local_conds contains expressions that can't be evaluated remotely
+ *
+ * Cassandra only accepts restrictions on the primary key that it can serve
+ * from a contiguous slice of one partition: every partition key column
+ * compared with "=", then "=" on a prefix of the clustering columns, then
+ * optionally a range on the next clustering column.  One partition key
+ * column may instead be compared with "= ANY" of an array, in which case
+ * the scan reads each of the partitions listed with a query of its own.
+ */
+void
+cassClassifyConditions(PlannerInfo *root,
+					   RelOptInfo *baserel,
+					   List *input_conds,
+					   List *partition_attrs,
+					   List *clustering_attrs,
+					   List **remote_conds,
+					   List **local_conds)
 {
-	char *valid_datatype = NULL, *invalid_datatype = NULL;
-	switch (type)
+	int			npkeys = list_length(partition_attrs);
+	int			nckeys = list_length(clustering_attrs);
+	RestrictInfo **key_conds;
+	RestrictInfo **any_conds;
+	RestrictInfo **lower_conds;
+	RestrictInfo **upper_conds;
+	List	   *candidates = NIL;
+	bool		pinned = (npkeys > 0);
+	bool		fanned_out = false;
+	ListCell   *lc;
+	int			k;
+
+	*remote_conds = NIL;
+	*local_conds = NIL;
+
+	/*
+	 * Collect at most one equality clause per key column, and one lower and
+	 * one upper bound per clustering column.  Partition key columns come
+	 * first in key_conds, followed by the clustering columns; any_conds
+	 * holds an "= ANY" clause per partition key column.
+	 */
+	key_conds = (RestrictInfo **)
+		palloc0((npkeys + nckeys + 1) * sizeof(RestrictInfo *));
+	any_conds = (RestrictInfo **) palloc0((npkeys + 1) * sizeof(RestrictInfo *));
+	lower_conds = (RestrictInfo **) palloc0((nckeys + 1) * sizeof(RestrictInfo *));
+	upper_conds = (RestrictInfo **) palloc0((nckeys + 1) * sizeof(RestrictInfo *));
+
+	foreach(lc, input_conds)
 	{
-	case CASS_VALUE_TYPE_TINY_INT:
+		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+		RestrictInfo **slot = NULL;
+		AttrNumber	attnum;
+		int			strategy;
+		Expr	   *value;
+
+		if (!ri->pseudoconstant &&
+			cassIsKeyRestriction(root, baserel, ri->clause,
+								 &attnum, &strategy, &value))
+		{
+			if ((k = cassListIndexInt(partition_attrs, attnum)) >= 0)
+			{
+				if (IsA(ri->clause, ScalarArrayOpExpr))
+					slot = &any_conds[k];
+				else if (strategy == BTEqualStrategyNumber)
+					slot = &key_conds[k];
+			}
+			else if (!IsA(ri->clause, ScalarArrayOpExpr) &&
+					 (k = cassListIndexInt(clustering_attrs, attnum)) >= 0)
+			{
+				if (strategy == BTEqualStrategyNumber)
+					slot = &key_conds[npkeys + k];
+				else if (cassIsOrderedType(exprType((Node *) value)))
+					slot = (strategy == BTLessStrategyNumber ||
+							strategy == BTLessEqualStrategyNumber) ?
+						&upper_conds[k] : &lower_conds[k];
+			}
+		}
+
+		if (slot != NULL && *slot == NULL)
+		{
+			*slot = ri;
+			candidates = lappend(candidates, ri);
+		}
+		else
+			*local_conds = lappend(*local_conds, ri);
+	}
+
+	/*
+	 * Nothing can be pushed down unless each partition key column is pinned
+	 * to one value, or for at most one of them, to the values of an array.
+	 */
+	for (k = 0; k < npkeys; k++)
 	{
-		invalid_datatype = "tinyint";
-		break;
+		if (key_conds[k] != NULL)
+			continue;
+		if (any_conds[k] != NULL && !fanned_out)
+		{
+			key_conds[k] = any_conds[k];
+			fanned_out = true;
+		}
+		else
+			pinned = false;
+	}
+
+	if (pinned)
+	{
+		for (k = 0; k < npkeys; k++)
+			*remote_conds = lappend(*remote_conds, key_conds[k]);
+
+		for (k = 0; k < nckeys; k++)
+		{
+			if (key_conds[npkeys + k] != NULL)
+			{
+				*remote_conds = lappend(*remote_conds, key_conds[npkeys + k]);
+				continue;
+			}
+
+			/* A range ends the usable prefix of the clustering key. */
+			if (lower_conds[k] != NULL)
+				*remote_conds = lappend(*remote_conds, lower_conds[k]);
+			if (upper_conds[k] != NULL)
+				*remote_conds = lappend(*remote_conds, upper_conds[k]);
+			break;
+		}
 	}
-	case CASS_VALUE_TYPE_SMALL_INT:
+
+	/* Whatever could not be used is checked locally. */
+	foreach(lc, candidates)
 	{
-		valid_datatype = "smallint";
-		break;
+		if (!list_member_ptr(*remote_conds, lfirst(lc)))
+			*local_conds = lappend(*local_conds, lfirst(lc));
 	}
-	case CASS_VALUE_TYPE_INT:
+
+	pfree(key_conds);
+	pfree(any_conds);
+	pfree(lower_conds);
+	pfree(upper_conds);
+}
+
+/*
+ * Return the position of value in an integer List, or -1 if it is absent.
+ */
+static int
+cassListIndexInt(List *list, int value)
+{
+	ListCell   *lc;
+	int			i = 0;
+
+	foreach(lc, list)
 	{
-		valid_datatype = "integer";
-		break;
+		if (lfirst_int(lc) == value)
+			return i;
+		i++;
 	}
-	case CASS_VALUE_TYPE_BIGINT:
-	case CASS_VALUE_TYPE_COUNTER:
+	return -1;
+}
+
+/*
+ * Check whether a scan of baserel can return its rows in the order given by
+ * pathkeys.  That takes a scan of a single partition, and pathkeys following
+ * its clustering columns, either all in their stored direction or all in
+ * reverse; clustering columns pinned by "=" may be left out.  On success,
+ * *reverse tells whether the stored order has to be reversed.
+ */
+static bool
+cassPathkeysMatchClustering(PlannerInfo *root, RelOptInfo *baserel,
+							List *pathkeys, bool *reverse)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
+	int			nckeys = list_length(fpinfo->clustering_attrs);
+	List	   *pinned = NIL;
+	bool		direction_known = false;
+	ListCell   *lc;
+	int			k = 0;
+
+	*reverse = false;
+	if (pathkeys == NIL || nckeys == 0)
+		return false;
+
+	/* The rows of several partitions are returned intermixed. */
+	foreach(lc, fpinfo->remote_conds)
 	{
-		valid_datatype = "bigint";
-		break;
+		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+
+		if (IsA(ri->clause, ScalarArrayOpExpr))
+			return false;
 	}
-	case CASS_VALUE_TYPE_BOOLEAN:
+
+	pinned = cassPinnedKeyAttrs(root, baserel);
+	foreach(lc, fpinfo->partition_attrs)
 	{
-		valid_datatype = "boolean";
-		break;
+		if (!list_member_int(pinned, lfirst_int(lc)))
+			return false;
 	}
-	case CASS_VALUE_TYPE_DOUBLE:
+
+	foreach(lc, pathkeys)
 	{
-		valid_datatype = "double precision";
-		break;
+		PathKey    *pathkey = (PathKey *) lfirst(lc);
+		Var		   *var = cassFindPathkeyVar(pathkey->pk_eclass, baserel);
+		Oid			opclass;
+		bool		mismatch;
+
+		if (var == NULL)
+			return false;
+
+		/* Pinned columns before the one wanted don't affect the order. */
+		while (k < nckeys &&
+			   list_nth_int(fpinfo->clustering_attrs, k) != var->varattno &&
+			   list_member_int(pinned, list_nth_int(fpinfo->clustering_attrs, k)))
+			k++;
+		if (k >= nckeys ||
+			list_nth_int(fpinfo->clustering_attrs, k) != var->varattno)
+			return false;
+
+		/* Cassandra must sort the values like the default btree opclass. */
+		opclass = GetDefaultOpClass(var->vartype, BTREE_AM_OID);
+		if (!OidIsValid(opclass) ||
+			pathkey->pk_opfamily != get_opclass_family(opclass))
+			return false;
+		if (!cassIsOrderedType(var->vartype) &&
+			!((var->vartype == TEXTOID || var->vartype == VARCHAROID) &&
+			  lc_collate_is_c(pathkey->pk_eclass->ec_collation)))
+			return false;
+
+		/* The direction of a pinned column doesn't matter either. */
+		if (!list_member_int(pinned, var->varattno))
+		{
+			mismatch = (pathkey->pk_strategy == BTGreaterStrategyNumber) !=
+				(list_nth_int(fpinfo->clustering_desc, k) != 0);
+			if (!direction_known)
+				*reverse = mismatch;
+			else if (*reverse != mismatch)
+				return false;
+			direction_known = true;
+		}
+		k++;
 	}
-	case CASS_VALUE_TYPE_FLOAT:
+
+	/* Reading backwards would pick the other end of each partition. */
+	if (*reverse && fpinfo->per_partition_limit > 0)
+		return false;
+
+	return true;
+}
+
+/*
+ * Find a plain column of baserel among the members of an equivalence class.
+ */
+static Var *
+cassFindPathkeyVar(EquivalenceClass *ec, RelOptInfo *baserel)
+{
+	ListCell   *lc;
+
+	if (ec->ec_has_volatile)
+		return NULL;
+
+	foreach(lc, ec->ec_members)
 	{
-		valid_datatype = "real";
-		break;
+		EquivalenceMember *em = (EquivalenceMember *) lfirst(lc);
+		Expr	   *expr = em->em_expr;
+
+		while (IsA(expr, RelabelType))
+			expr = ((RelabelType *) expr)->arg;
+
+		if (IsA(expr, Var) &&
+			((Var *) expr)->varno == baserel->relid &&
+			((Var *) expr)->varlevelsup == 0 &&
+			((Var *) expr)->varattno > 0)
+			return (Var *) expr;
 	}
-	case CASS_VALUE_TYPE_DECIMAL:
+
+	return NULL;
+}
+
+/*
+ * Add parameterized paths for scans of baserel restricted by join clauses
+ * on its partition key, as the inner side of a nested loop.
+ *
+ * Each one reads only the partitions the current outer row joins with, so
+ * a join driven by a few local rows costs a few point reads instead of a
+ * scan of the whole table.  The join clauses come from joininfo, and from
+ * the equivalence classes of the partition key columns.
+ */
+static void
+cassAddParamPaths(PlannerInfo *root, RelOptInfo *baserel)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
+	List	   *ppi_list = NIL;
+	ListCell   *lc;
+
+	if (fpinfo->partition_attrs == NIL)
+		return;
+
+	foreach(lc, baserel->joininfo)
+		cassAddParamPathInfo(root, baserel, (RestrictInfo *) lfirst(lc),
+							 &ppi_list);
+
+	if (baserel->has_eclass_joins)
 	{
-		invalid_datatype = "decimal";
-		break;
+		ec_member_foreign_arg arg;
+
+		/* Each round generates the join clauses of one partition column. */
+		arg.already_used = NIL;
+		for (;;)
+		{
+			List	   *clauses;
+
+			arg.current = NULL;
+			clauses = generate_implied_equalities_for_column(root, baserel,
+											ec_member_matches_partition_key,
+															 (void *) &arg,
+											baserel->lateral_referencers);
+			if (arg.current == NULL)
+				break;
+
+			foreach(lc, clauses)
+				cassAddParamPathInfo(root, baserel,
+									 (RestrictInfo *) lfirst(lc), &ppi_list);
+			arg.already_used = lappend(arg.already_used, arg.current);
+		}
 	}
-	case CASS_VALUE_TYPE_TEXT:
-	case CASS_VALUE_TYPE_ASCII:
-	case CASS_VALUE_TYPE_VARCHAR:
+
+	foreach(lc, ppi_list)
 	{
-		valid_datatype = "text";
-		break;
+		ParamPathInfo *param_info = (ParamPathInfo *) lfirst(lc);
+		List	   *remote_conds;
+		List	   *local_conds;
+		ListCell   *lc2;
+		bool		uses_join = false;
+		ForeignPath *path;
+
+		/* The join clauses must actually narrow the scan down. */
+		cassClassifyConditions(root, baserel,
+							   list_concat(list_copy(baserel->baserestrictinfo),
+										   param_info->ppi_clauses),
+							   fpinfo->partition_attrs,
+							   fpinfo->clustering_attrs,
+							   &remote_conds, &local_conds);
+		foreach(lc2, param_info->ppi_clauses)
+		{
+			if (list_member_ptr(remote_conds, lfirst(lc2)))
+				uses_join = true;
+		}
+		if (!uses_join)
+			continue;
+
+		path = create_foreignscan_path(root, baserel,
+									   NULL,
+									   param_info->ppi_rows,
+									   fpinfo->startup_cost,
+									   fpinfo->startup_cost +
+									   (cpu_tuple_cost + DEFAULT_FDW_TUPLE_COST) *
+									   param_info->ppi_rows,
+									   NIL, /* no pathkeys */
+									   param_info->ppi_req_outer,
+									   NULL,
+									   NIL);
+		add_path(baserel, (Path *) path);
 	}
-	case CASS_VALUE_TYPE_TIMESTAMP:
+}
+
+/*
+ * Add a partial path for a scan of the whole of baserel, which the
+ * participants of a parallel query share out by token ranges.
+ *
+ * Each participant reads the ranges it takes with a query of its own,
+ * "token(partition key) > ? AND token(partition key) <= ?", through its own
+ * session, so that the work is spread over the backends and over the
+ * nodes owning each range.  This is only offered when the table sets
+ * token_ranges, the number of ranges, and its cluster has the Murmur3
+ * token ring those ranges assume.
+ */
+static void
+cassAddParallelPath(PlannerInfo *root, RelOptInfo *baserel)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
+	ForeignPath *path;
+	int			parallel_workers;
+	double		divisor;
+	double		rows;
+
+	if (!baserel->consider_parallel || fpinfo->partition_attrs == NIL ||
+		fpinfo->remote_conds != NIL || fpinfo->token_ranges <= 0)
+		return;
+
+	parallel_workers = Min(max_parallel_workers_per_gather,
+						   fpinfo->token_ranges);
+	if (parallel_workers <= 0)
+		return;
+
+	/* The leader takes its share as well, as for a parallel seq scan. */
+	divisor = parallel_workers;
+	if (parallel_leader_participation)
 	{
-		valid_datatype = "timestamp(0) with time zone";
-		break;
+		double		leader_contribution = 1.0 - (0.3 * parallel_workers);
+
+		if (leader_contribution > 0)
+			divisor += leader_contribution;
 	}
-	case CASS_VALUE_TYPE_INET:
+	rows = clamp_row_est(baserel->rows / divisor);
+
+	path = create_foreignscan_path(root, baserel,
+								   NULL,
+								   rows,
+								   fpinfo->startup_cost,
+								   fpinfo->startup_cost +
+								   (fpinfo->total_cost -
+									fpinfo->startup_cost) / divisor,
+								   NIL, /* no pathkeys */
+								   NULL,
+								   NULL,
+								   NIL);
+	path->path.parallel_aware = true;
+	path->path.parallel_workers = parallel_workers;
+	add_partial_path(baserel, (Path *) path);
+}
+
+/*
+ * If rinfo is a join clause that a parameterized scan of baserel could
+ * send to Cassandra, add the ParamPathInfo for the outer relations it
+ * needs to *ppi_list.
+ */
+static void
+cassAddParamPathInfo(PlannerInfo *root, RelOptInfo *baserel,
+					 RestrictInfo *rinfo, List **ppi_list)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
+	Relids		required_outer;
+	AttrNumber	attnum;
+	int			strategy;
+	Expr	   *value;
+
+	if (!join_clause_is_movable_to(rinfo, baserel))
+		return;
+	if (!IsA(rinfo->clause, OpExpr) ||
+		!cassIsKeyRestriction(root, baserel, rinfo->clause,
+							  &attnum, &strategy, &value) ||
+		strategy != BTEqualStrategyNumber ||
+		!list_member_int(fpinfo->partition_attrs, attnum))
+		return;
+
+	required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+	required_outer = bms_del_member(required_outer, baserel->relid);
+	if (bms_is_empty(required_outer))
+		return;
+
+	*ppi_list = list_append_unique_ptr(*ppi_list,
+									   get_baserel_parampathinfo(root, baserel,
+																 required_outer));
+}
+
+/*
+ * Callback for generate_implied_equalities_for_column: accept the first
+ * partition key column of rel not already used, and then only that one.
+ */
+static bool
+ec_member_matches_partition_key(PlannerInfo *root, RelOptInfo *rel,
+								EquivalenceClass *ec, EquivalenceMember *em,
+								void *arg)
+{
+	ec_member_foreign_arg *state = (ec_member_foreign_arg *) arg;
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) rel->fdw_private;
+	Var		   *var = (Var *) em->em_expr;
+
+	if (state->current != NULL)
+		return equal(em->em_expr, state->current);
+
+	if (!IsA(var, Var) || var->varno != rel->relid ||
+		!list_member_int(fpinfo->partition_attrs, var->varattno) ||
+		list_member(state->already_used, var))
+		return false;
+
+	state->current = (Expr *) var;
+	return true;
+}
+
+/*
+ * Attribute numbers of the key columns that the remote query compares with
+ * "=" to a single value.
+ */
+static List *
+cassPinnedKeyAttrs(PlannerInfo *root, RelOptInfo *baserel)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
+	List	   *pinned = NIL;
+	ListCell   *lc;
+
+	foreach(lc, fpinfo->remote_conds)
 	{
-		valid_datatype = "inet";
-		break;
+		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+		AttrNumber	attnum;
+		int			strategy;
+		Expr	   *value;
+
+		if (IsA(ri->clause, ScalarArrayOpExpr))
+			continue;
+
+		if (cassIsKeyRestriction(root, baserel, ri->clause,
+								 &attnum, &strategy, &value) &&
+			strategy == BTEqualStrategyNumber)
+			pinned = lappend_int(pinned, attnum);
 	}
-	case CASS_VALUE_TYPE_UUID:
+
+	return pinned;
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Whether Cassandra can group by expr, an entry of the query's GROUP BY
+ * compared as sgc says.  It must be a column of baserel whose values
+ * Cassandra tells apart exactly when PostgreSQL does.
+ */
+static bool
+cassIsGroupingColumn(RelOptInfo *baserel, Expr *expr, SortGroupClause *sgc)
+{
+	Var		   *var = (Var *) expr;
+
+	if (!IsA(expr, Var) || var->varno != baserel->relid ||
+		var->varlevelsup != 0 || var->varattno <= 0)
+		return false;
+
+	/* Floats are left out, having distinct zeros but only one in btree. */
+	switch (var->vartype)
 	{
-		valid_datatype = "uuid";
-		break;
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case BOOLOID:
+		case UUIDOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			break;
+		case TEXTOID:
+		case VARCHAROID:
+			if (!get_collation_isdeterministic(var->varcollid))
+				return false;
+			break;
+		default:
+			return false;
 	}
-	case CASS_VALUE_TYPE_LIST:
+
+	return sgc->eqop ==
+		lookup_type_cache(var->vartype, TYPECACHE_EQ_OPR)->eq_opr;
+}
+
+/*
+ * Find the primary key columns that CQL must GROUP BY to form the groups of
+ * the grouped columns.  CQL takes the partition key followed by a prefix of
+ * the clustering columns, which must then take in every grouped column.
+ * Key columns compared with "=" can be added, as they don't split the
+ * groups; any other can't.
+ */
+static bool
+cassGroupingKeyAttrs(PlannerInfo *root, RelOptInfo *baserel,
+					 List *grouped, List **group_attrs)
+{
+	CassFdwPlanState *fpinfo = (CassFdwPlanState *) baserel->fdw_private;
+	List	   *key_attrs;
+	List	   *pinned;
+	ListCell   *lc;
+	int			nkeys;
+	int			k;
+
+	if (fpinfo->partition_attrs == NIL)
+		return false;
+
+	key_attrs = list_concat(list_copy(fpinfo->partition_attrs),
+							list_copy(fpinfo->clustering_attrs));
+	nkeys = list_length(fpinfo->partition_attrs);
+	foreach(lc, grouped)
 	{
-		invalid_datatype = "list";
-		break;
+		k = cassListIndexInt(key_attrs, lfirst_int(lc));
+		if (k < 0)
+			return false;
+		nkeys = Max(nkeys, k + 1);
 	}
-	case CASS_VALUE_TYPE_MAP:
-		invalid_datatype = "map";
-		break;
-	default:
-		invalid_datatype = "unknown";
-		break;
+
+	pinned = cassPinnedKeyAttrs(root, baserel);
+	*group_attrs = NIL;
+	for (k = 0; k < nkeys; k++)
+	{
+		int			attnum = list_nth_int(key_attrs, k);
+
+		if (!list_member_int(grouped, attnum) &&
+			!list_member_int(pinned, attnum))
+			return false;
+		*group_attrs = lappend_int(*group_attrs, attnum);
 	}
 
-	if (valid_datatype)
-		appendStringInfoString(buf, valid_datatype);
-	else
-		ereport(ERROR,
-		        (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-		         errmsg("Data type %s not supported.", invalid_datatype)));
+	return true;
 }
+#endif
 
 /*
- * Examine each qual clause in input_conds, and classify them into two groups,
- * which are returned as two lists:
- *	- remote_conds contains expressions that can be evaluated remotely
- *	- local_conds contains expressions that can't be evaluated remotely
+ * Build the fdw_private list of a ForeignPath; see CassFdwPathPrivateIndex.
  */
-static void
-cassClassifyConditions(PlannerInfo *root,
-					   RelOptInfo *baserel,
-					   List *input_conds,
-					   List **remote_conds,
-					   List **local_conds)
+static List *
+cassMakePathPrivate(int limit_count, int limit_offset, bool reverse,
+					bool distinct)
 {
-	ListCell   *lc;
+	return list_make4(makeInteger(limit_count),
+					  makeInteger(limit_offset),
+					  makeInteger(reverse ? 1 : 0),
+					  makeInteger(distinct ? 1 : 0));
+}
 
-	*remote_conds = NIL;
-	*local_conds = NIL;
+/*
+ * Convert a timestamp compared with a Cassandra timestamp column using the
+ * given btree strategy into the number of milliseconds since the Unix epoch
+ * to bind in its place.  Cassandra keeps only milliseconds, so the value is
+ * rounded in the direction that selects exactly the rows the original
+ * comparison would.  Returns false if no row can match at all.
+ */
+static bool
+cassTimestampBound(Timestamp ts, int strategy, int64 *msecs)
+{
+	int64		usecs;
+	int64		q;
+	int64		r;
 
-	foreach(lc, input_conds)
+	if (TIMESTAMP_IS_NOBEGIN(ts))
 	{
-		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+		*msecs = PG_INT64_MIN;
+		return strategy >= BTGreaterEqualStrategyNumber;
+	}
+	if (TIMESTAMP_IS_NOEND(ts))
+	{
+		*msecs = PG_INT64_MAX;
+		return strategy <= BTLessEqualStrategyNumber;
+	}
+
+	usecs = ts + ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY);
+	q = usecs / (USECS_PER_SEC / MSECS_PER_SEC);
+	r = usecs % (USECS_PER_SEC / MSECS_PER_SEC);
+	if (r < 0)
+	{
+		q--;
+		r += (USECS_PER_SEC / MSECS_PER_SEC);
+	}
 
-		*local_conds = lappend(*local_conds, ri);
+	*msecs = q;
+	if (r != 0)
+	{
+		switch (strategy)
+		{
+			case BTEqualStrategyNumber:
+				return false;
+			case BTLessStrategyNumber:
+			case BTGreaterEqualStrategyNumber:
+				*msecs = q + 1;
+				break;
+			default:
+				break;
+		}
 	}
+	return true;
 }
 
 /*
  * bind_cass_statement_param
  *
  * 	Map a parameter to its corresponding bind call for the Cassandra C(++)
- * 	Driver.
+ * 	Driver.  Returns the driver's error code, which for a prepared statement
+ * 	tells whether the value suits the type of its column.
  */
-static void bind_cass_statement_param(Oid type, Datum value,
-                                      CassStatement *statement, int pindex)
+static CassError bind_cass_statement_param(Oid type, Datum value,
+                                           CassStatement *statement, int pindex)
 {
+	CassError rc = CASS_OK;
+
 	switch (type)
 	{
 		case INT2OID:
 		{
 			int16 int16_val = DatumGetInt16(value);
-			cass_statement_bind_int16(statement, pindex, int16_val);
+			rc = cass_statement_bind_int16(statement, pindex, int16_val);
 			break;
 		}
 		case INT4OID:
 		{
 			int32 int32_val = DatumGetInt32(value);
-			cass_statement_bind_int32(statement, pindex, int32_val);
+			rc = cass_statement_bind_int32(statement, pindex, int32_val);
 			break;
 		}
 		case INT8OID:
 		{
 			int64 int64_val = DatumGetInt64(value);
-			cass_statement_bind_int64(statement, pindex, int64_val);
+			rc = cass_statement_bind_int64(statement, pindex, int64_val);
 			break;
 		}
 		case FLOAT4OID:
 		{
 			float4 float4_val = DatumGetFloat4(value);
-			cass_statement_bind_float(statement, pindex, float4_val);
+			rc = cass_statement_bind_float(statement, pindex, float4_val);
 			break;
 		}
 		case FLOAT8OID:
 		{
 			float8 float8_val = DatumGetFloat8(value);
-			cass_statement_bind_double(statement, pindex, float8_val);
+			rc = cass_statement_bind_double(statement, pindex, float8_val);
 			break;
 		}
 		case BOOLOID:
 		{
 			bool bool_val = DatumGetBool(value);
-			cass_statement_bind_bool(statement, pindex, bool_val);
+			rc = cass_statement_bind_bool(statement, pindex, bool_val);
 			break;
 		}
 		case TEXTOID:
@@ -2156,7 +6396,29 @@ static void bind_cass_statement_param(Oid type, Datum value,
 			getTypeOutputInfo(type, &output_func_oid, &type_var_length);
 			str_val = OidOutputFunctionCall(output_func_oid, value);
 
-			cass_statement_bind_string(statement, pindex, str_val);
+			rc = cass_statement_bind_string(statement, pindex, str_val);
+			break;
+		}
+		case UUIDOID:
+		{
+			pg_uuid_t  *uuid = DatumGetUUIDP(value);
+			CassUuid	u;
+			int			k;
+
+			/* The inverse of the layout decoded by convert_uuid(). */
+			u.time_and_version = ((uint64) uuid->data[0] << 24) |
+				((uint64) uuid->data[1] << 16) |
+				((uint64) uuid->data[2] << 8) |
+				(uint64) uuid->data[3] |
+				((uint64) uuid->data[4] << 40) |
+				((uint64) uuid->data[5] << 32) |
+				((uint64) uuid->data[6] << 56) |
+				((uint64) uuid->data[7] << 48);
+			u.clock_seq_and_node = 0;
+			for (k = 8; k < 16; k++)
+				u.clock_seq_and_node = (u.clock_seq_and_node << 8) | uuid->data[k];
+
+			rc = cass_statement_bind_uuid(statement, pindex, u);
 			break;
 		}
 		case TIMESTAMPTZOID:
@@ -2182,7 +6444,7 @@ static void bind_cass_statement_param(Oid type, Datum value,
 			 * we further convert this into milliseconds.
 			 */
 			time = (DatumGetTimestampTz(value)- SetEpochTimestamp() + tzoffset) / MSECS_PER_SEC;
-			cass_statement_bind_int64(statement, pindex, (int64)time);
+			rc = cass_statement_bind_int64(statement, pindex, (int64)time);
 			break;
 		}
 		default:
@@ -2193,6 +6455,8 @@ static void bind_cass_statement_param(Oid type, Datum value,
 			break;
 		}
 	}
+
+	return rc;
 }
 
 /*
@@ -2211,7 +6475,6 @@ cassExecPKPredWrite(EState *estate,
 	int                 pindex  = 0;
 	MemoryContext       oldcontext;
 	CassFuture*         future  = NULL;
-	CassError           rc      = CASS_OK;
 	Datum               value;
 	bool                isnull;
 
@@ -2220,9 +6483,7 @@ cassExecPKPredWrite(EState *estate,
 
 	oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
 
-	if (!fmstate->sql_sent)
-		fmstate->statement = cass_statement_new(fmstate->query,
-		                                        fmstate->p_nums);
+	fmstate->statement = cass_prepared_bind(fmstate->prepared);
 
 	if (slot != NULL && fmstate->target_attrs != NIL)
 	{
@@ -2233,13 +6494,8 @@ cassExecPKPredWrite(EState *estate,
 			int   attnum = lfirst_int(lc);
 
 			value = slot_getattr(slot, attnum, &isnull);
-			if (isnull)
-				cassStatementBindNull(fmstate->statement, pindex,
-				                      fmstate->p_type_oids[pindex], cqlOpName,
-				                      estate, resultRelInfo);
-			else
-				bind_cass_statement_param(fmstate->p_type_oids[pindex],
-				                          value, fmstate->statement, pindex);
+			cassBindModifyParam(fmstate, pindex, value, isnull, cqlOpName,
+			                    estate, resultRelInfo);
 
 			pindex++;
 		}
@@ -2255,6 +6511,7 @@ cassExecPKPredWrite(EState *estate,
 		Oid         rid      = RelationGetRelid(relation);
 
 		cassGetPKOption(rid, &primary_key);
+		releaseCassResources(estate, resultRelInfo);
 
 		ereport(ERROR,
 				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
@@ -2270,33 +6527,19 @@ cassExecPKPredWrite(EState *estate,
 						 OPT_PK)));
 	}
 
-	bind_cass_statement_param(fmstate->p_type_oids[pindex], value,
-	                          fmstate->statement, pindex);
+	cassBindModifyParam(fmstate, pindex, value, false, cqlOpName,
+	                    estate, resultRelInfo);
 	pindex++;
 	Assert(pindex == fmstate->p_nums);
 
 	cass_statement_set_consistency(fmstate->statement, fmstate->write_consistency);
+	cass_statement_set_timestamp(fmstate->statement, cassNextWriteTimestamp());
 	future = cass_session_execute(fmstate->cass_conn, fmstate->statement);
-	fmstate->sql_sent = true;
-	cass_future_wait(future);
-
-	rc = cass_future_error_code(future);
-
-	if (rc != CASS_OK)
-	{
-		const char* message;
-		size_t message_length;
-		cass_future_error_message(future, &message, &message_length);
-		cass_future_free(future);
-		releaseCassResources(estate, resultRelInfo);
-
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-				 errmsg("Failed to execute the %s into Cassandra: %.*s",
-						cqlOpName, (int) message_length, message)));
-	}
+	cass_statement_free(fmstate->statement);
+	fmstate->statement = NULL;
 
-	cass_future_free(future);
+	cassHandleWrite(fmstate, future, slot, planSlot, 1,
+	                estate, resultRelInfo);
 	MemoryContextSwitchTo(oldcontext);
 
 	MemoryContextReset(fmstate->temp_cxt);
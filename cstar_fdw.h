@@ -18,6 +18,7 @@
 #include <cassandra.h>
 
 #include "foreign/foreign.h"
+#include "funcapi.h"
 #include "lib/stringinfo.h"
 #if PG_VERSION_NUM < 120000
 	#include "nodes/relation.h"
@@ -32,21 +33,165 @@
 #define LITERAL_UTC					"UTC"
 #define DEFAULT_CONSISTENCY_LEVEL	CASS_CONSISTENCY_LOCAL_ONE
 
+/* Default CPU cost to start up a foreign query. */
+#define DEFAULT_FDW_STARTUP_COST	100.0
+
+/* Default CPU cost to process 1 row (above and beyond cpu_tuple_cost). */
+#define DEFAULT_FDW_TUPLE_COST		0.01
+
+/* Default number of rows requested per page of a remote scan. */
+#define DEFAULT_FETCH_SIZE			5000
+
+/* Default number of concurrent requests of a scan reading many partitions. */
+#define DEFAULT_MAX_CONCURRENT_REQUESTS	32
+
+/* How long to wait on one of several in-flight requests before polling all. */
+#define CASS_POLL_USECS				1000
+
+/*
+ * FDW-specific information for RelOptInfo.fdw_private.
+ */
+typedef struct CassFdwPlanState
+{
+	/* baserestrictinfo clauses, broken down into safe and unsafe subsets. */
+	List	   *remote_conds;
+	List	   *local_conds;
+
+	/* Bitmap of attr numbers we need to fetch from the remote server. */
+	Bitmapset  *attrs_used;
+
+	/* Attribute numbers of the partition key columns, in key order. */
+	List	   *partition_attrs;
+
+	/* Attribute numbers of the clustering columns, in key order. */
+	List	   *clustering_attrs;
+
+	/* Whether each clustering column is stored in descending order. */
+	List	   *clustering_desc;
+
+	/* Rows read from each partition at most, or 0 for no limit. */
+	int			per_partition_limit;
+
+	/* Token ranges a whole-table scan is split into, or 0 if not set. */
+	int			token_ranges;
+
+	/*
+	 * For the ordered upper relation of a scan returning rows in the order
+	 * requested: the foreign table, and whether its order is reversed.  For
+	 * the distinct relation of a scan returning distinct partition keys:
+	 * the foreign table, and distinct set.
+	 */
+	RelOptInfo *scan_rel;
+	bool		reverse_order;
+	bool		distinct;
+
+	/*
+	 * For the grouping upper relation, when Cassandra computes the
+	 * aggregates: their target list, and the primary key columns to group
+	 * by, if any.  scan_rel is the foreign table.
+	 */
+	List	   *grouped_tlist;
+	List	   *group_attrs;
+
+	/* Estimated size and cost for a scan with baserestrictinfo quals. */
+	double		rows;
+	int			width;
+	Cost		startup_cost;
+	Cost		total_cost;
+} CassFdwPlanState;
+
+/*
+ * Conversion of one result column into a Datum of its target attribute.
+ */
+struct CassColumnPlan;
+
+typedef Datum (*CassColumnConverter) (const CassValue *value,
+									  const struct CassColumnPlan *col);
+typedef int64 (*CassIntReader) (const CassValue *value);
+
+typedef struct CassColumnPlan
+{
+	int			attnum;			/* target attribute number, or 0 to skip */
+	CassColumnConverter convert;	/* converter for non-NULL values */
+	CassIntReader read_int;		/* reader for integer Cassandra types */
+	Oid			pgtype;			/* target type OID */
+	int32		typmod;			/* target type modifier */
+	FmgrInfo   *infunc;			/* target type's input function */
+	Oid			ioparam;		/* ... and its type I/O parameter */
+	StringInfo	buf;			/* text workspace for convert_via_input */
+} CassColumnPlan;
+
 /* in cstar_connect.c */
 extern CassSession *pgcass_GetConnection(ForeignServer *server, UserMapping *user,
 			  bool will_prep_stmt);
 extern void pgcass_ReleaseConnection(CassSession *session);
+extern const CassPrepared *pgcass_GetPrepared(CassSession *session,
+											  const char *query);
+extern const char *pgcass_GetPartitioner(CassSession *session);
 
 extern void pgcass_report_error(int elevel, CassFuture* result_future,
 				bool clear, const char *sql);
 
+/* in cstar_fdw.c */
+extern bool cassIsForeignRel(RelOptInfo *rel);
+extern int	cassGetIntOption(Oid foreigntableid, const char *optname,
+							 int defval);
+extern void cassGetReadConsistencyOption(Oid foreigntableid,
+							 CassConsistency *read_consistency);
+extern void
+cassClassifyConditions(PlannerInfo *root,
+					   RelOptInfo *baserel,
+					   List *input_conds,
+					   List *partition_attrs,
+					   List *clustering_attrs,
+					   List **remote_conds,
+					   List **local_conds);
+extern bool cassBindKeyValue(CassStatement *statement, int pindex, Oid type,
+							 Datum value, int strategy);
+extern CassColumnPlan *cassBuildColumnPlan(const CassResult *res,
+										   TupleDesc tupdesc,
+										   AttInMetadata *attinmeta,
+										   List *retrieved_attrs);
+extern void cassDecodeRow(const CassRow *row, const CassColumnPlan *colplan,
+						  int ncolumn, int natts, Datum *values,
+						  bool *isnull);
+
+/* in cstar_join.c */
+extern void cassInitBatchJoin(void);
+
 /* in deparse.c */
+extern bool
+cassIsKeyRestriction(PlannerInfo *root, RelOptInfo *baserel, Expr *clause,
+					 AttrNumber *attnum, int *strategy, Expr **value);
+extern bool cassIsOrderedType(Oid type);
+extern bool cassIsPushableAggregate(RelOptInfo *baserel, Aggref *agg);
+extern void
+cassDeparseAggregateSql(StringInfo buf,
+						PlannerInfo *root,
+						RelOptInfo *baserel,
+						List *tlist,
+						List *group_attrs,
+						List *remote_conds,
+						List **retrieved_attrs,
+						List **params_list,
+						List **agg_counts,
+						List **empty_nulls);
+extern void
+cassAppendTokenRangeClause(StringInfo buf, PlannerInfo *root,
+						   RelOptInfo *baserel, List *partition_attrs);
+extern void
+cassAppendOrderByClause(StringInfo buf, PlannerInfo *root,
+						RelOptInfo *baserel, AttrNumber attnum,
+						bool descending);
 extern void
 cassDeparseSelectSql(StringInfo buf,
 					 PlannerInfo *root,
 					 RelOptInfo *baserel,
 					 Bitmapset *attrs_used,
-					 List **retrieved_attrs);
+					 List *remote_conds,
+					 bool distinct,
+					 List **retrieved_attrs,
+					 List **params_list);
 extern void
 cassDeparseInsertSql(StringInfo buf, PlannerInfo *root,
 					 Index rtindex, Relation rel,
@@ -0,0 +1,1381 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstar_join.c
+ *                Batched key lookup join of local rows with a cassandra_fdw
+ *                foreign table.
+ *
+ * A nested loop over a scan parameterized by the partition key makes one
+ * blocking round trip per outer row.  The custom scan here instead reads a
+ * batch of outer rows, looks up the partitions of all their distinct keys
+ * with concurrent single-partition queries, and then joins each outer row
+ * with the rows of its partition, in outer order.
+ *
+ * Copyright (c) 2014-2020, BigSQL
+ * Portions Copyright (c) 2012-2018, PostgreSQL Global Development Group & Others
+ *
+ * IDENTIFICATION
+ *                contrib/cassandra_fdw/cstar_join.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "cstar_fdw.h"
+
+#include "access/stratnum.h"
+#include "access/sysattr.h"
+#include "commands/explain.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/extensible.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/cost.h"
+#if PG_VERSION_NUM >= 120000
+	#include "optimizer/optimizer.h"
+#endif
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
+#include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
+#include "parser/parsetree.h"
+#include "utils/datum.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+/* Default number of outer rows whose lookups are sent together. */
+#define DEFAULT_JOIN_BATCH_SIZE		500
+
+#if PG_VERSION_NUM >= 120000
+
+/*
+ * This enum describes what's kept in the custom_private list of the
+ * CustomScan node of a batched lookup join.  The custom_exprs list holds
+ * the values bound to the lookup statement, followed by the conditions
+ * checked on each joined pair of rows.
+ */
+enum CassJoinPrivateIndex
+{
+	/* SQL statement reading the rows of one key (as a String node) */
+	CassJoinPrivateSelectSql,
+	/* Integer list of attribute numbers retrieved by the SELECT */
+	CassJoinPrivateRetrievedAttrs,
+	/* Integer list of the btree strategy each parameter is compared with */
+	CassJoinPrivateParamStrategies,
+	/* Number of parameters leading custom_exprs (as an Integer node) */
+	CassJoinPrivateNumParams,
+	/*
+	 * Integer list with where each custom_scan_tlist entry comes from: its
+	 * position in the outer plan's target list if positive, else minus the
+	 * attribute number of the foreign table
+	 */
+	CassJoinPrivateSources,
+	/* OID of the foreign table (as an Integer node) */
+	CassJoinPrivateRelid,
+	/* Batch size (as an Integer node) */
+	CassJoinPrivateBatchSize,
+	/* Whether outer rows without a match are null-extended (Integer node) */
+	CassJoinPrivateLeftJoin
+};
+
+/*
+ * Likewise for the custom_private list of the CustomPath.
+ */
+enum CassJoinPathPrivateIndex
+{
+	/* RestrictInfos sent to Cassandra with each lookup */
+	CassJoinPathPrivateRemoteConds,
+	/* RestrictInfos deciding whether an inner row joins an outer row */
+	CassJoinPathPrivateJoinConds,
+	/* RestrictInfos filtering the joined rows */
+	CassJoinPathPrivateOtherConds,
+	/* Range table index of the foreign table (as an Integer node) */
+	CassJoinPathPrivateInnerRelid,
+	/* Whether the join is a left join (as an Integer node) */
+	CassJoinPathPrivateLeftJoin
+};
+
+/*
+ * The read of one partition, shared by the outer rows of a batch with the
+ * same key.  Only one page of it is held at a time.
+ */
+typedef struct CassJoinLookup
+{
+	Datum	   *values;			/* key values bound to the statement */
+	CassStatement *statement;	/* statement paging through the partition,
+								 * or NULL if the key cannot match */
+	CassFuture *pending;		/* in-flight page request, or NULL */
+	const CassResult *page;		/* page in hand, or NULL */
+	int			page_no;		/* its position in the partition, from 0 */
+} CassJoinLookup;
+
+/*
+ * Execution state of a batched lookup join.
+ */
+typedef struct CassBatchJoinState
+{
+	CustomScanState css;
+
+	Relation	rel;			/* relcache entry for the foreign table */
+	AttInMetadata *attinmeta;	/* attribute datatype conversion metadata */
+
+	/* extracted custom_private data */
+	char	   *query;			/* text of SELECT command */
+	List	   *retrieved_attrs;	/* list of retrieved attribute numbers */
+	List	   *param_strategies;	/* how each parameter is compared */
+	int		   *sources;		/* where each scan tuple column comes from */
+	int			batch_size;		/* max # of outer rows per batch */
+	bool		left_join;		/* null-extend unmatched outer rows? */
+
+	/* values bound to the statement's parameters */
+	int			numParams;		/* number of parameters */
+	List	   *param_exprs;	/* executable expressions for their values */
+	Oid		   *param_types;	/* their type OIDs */
+	int16	   *param_typlens;	/* ... and lengths */
+	bool	   *param_typbyvals;	/* ... and whether passed by value */
+
+	/* conditions deciding whether an inner row joins an outer row */
+	ExprState  *join_qual;
+
+	/* per-column conversion plan, built from the first page received */
+	CassColumnPlan *colplan;
+	int			NumberOfColumns;
+	Datum	   *inner_values;	/* columns of the current inner row */
+	bool	   *inner_isnull;
+
+	/* for remote query execution */
+	CassSession *cass_conn;		/* connection for the lookups */
+	CassConsistency read_consistency;
+	int			fetch_size;		/* number of rows per remote page */
+	int			max_concurrent;	/* max # of requests in flight */
+	const CassPrepared *prepared;	/* lookup statement, from the cache */
+
+	/* the current batch */
+	MemoryContext batch_cxt;	/* context for its key values */
+	TupleTableSlot **outer_slots;	/* its outer rows */
+	int		   *outer_lookup;	/* lookup of each one, or -1 for none */
+	int			num_outer;		/* # of outer rows in the batch */
+	bool		outer_done;		/* true once the outer plan is exhausted */
+	CassJoinLookup *lookups;	/* distinct keys of the batch */
+	int			num_lookups;	/* # of entries in lookups */
+	int		   *inflight;		/* indexes of lookups with a request out */
+	int			num_pending;	/* # of entries in inflight */
+
+	/* position in the batch */
+	int			cur_outer;		/* outer row being joined */
+	int			cur_page;		/* # of pages of its lookup begun */
+	CassIterator *rows;			/* iterator over the current page, or NULL */
+	bool		matched;		/* has the outer row been joined yet? */
+} CassBatchJoinState;
+
+/* Whether the planner considers batched lookup joins */
+static bool cass_enable_batch_join = true;
+
+static set_join_pathlist_hook_type prev_set_join_pathlist_hook = NULL;
+
+static CustomPathMethods cassBatchJoinPathMethods;
+static CustomScanMethods cassBatchJoinScanMethods;
+static CustomExecMethods cassBatchJoinExecMethods;
+
+static void cassBatchJoinPathlist(PlannerInfo *root, RelOptInfo *joinrel,
+					  RelOptInfo *outerrel, RelOptInfo *innerrel,
+					  JoinType jointype, JoinPathExtraData *extra);
+static bool cassIsPlainVarExpr(Node *node, Index inner_relid);
+static Plan *cassPlanBatchJoin(PlannerInfo *root, RelOptInfo *rel,
+				  CustomPath *best_path, List *tlist,
+				  List *clauses, List *custom_plans);
+static Node *cassCreateBatchJoinState(CustomScan *cscan);
+static void cassBeginBatchJoin(CustomScanState *node, EState *estate,
+				   int eflags);
+static TupleTableSlot *cassExecBatchJoin(CustomScanState *node);
+static TupleTableSlot *cassBatchJoinNext(CustomScanState *node);
+static bool cassBatchJoinRecheck(CustomScanState *node,
+					 TupleTableSlot *slot);
+static void cassReScanBatchJoin(CustomScanState *node);
+static void cassEndBatchJoin(CustomScanState *node);
+static void cassExplainBatchJoin(CustomScanState *node, List *ancestors,
+					 ExplainState *es);
+static void fill_batch(CassBatchJoinState *state);
+static int	find_lookup(CassBatchJoinState *state, Datum *values);
+static void fetch_lookups(CassBatchJoinState *state);
+static void collect_lookup_pages(CassBatchJoinState *state);
+static void bind_lookup(CassBatchJoinState *state, CassJoinLookup *lookup);
+static void receive_lookup_page(CassBatchJoinState *state,
+					CassJoinLookup *lookup);
+static void next_lookup_page(CassBatchJoinState *state,
+				 CassJoinLookup *lookup);
+static void restart_lookup(CassBatchJoinState *state, CassJoinLookup *lookup);
+static bool next_inner_row(CassBatchJoinState *state);
+static void advance_outer(CassBatchJoinState *state);
+static TupleTableSlot *store_join_tuple(CassBatchJoinState *state,
+				 TupleTableSlot *outer_slot, bool inner_null);
+static void release_batch(CassBatchJoinState *state);
+static void cleanup_batch_join_callback(void *arg);
+#endif							/* PG_VERSION_NUM >= 120000 */
+
+/*
+ * Install the planner hook offering batched lookup joins, and the setting
+ * turning them off.
+ */
+void
+cassInitBatchJoin(void)
+{
+#if PG_VERSION_NUM >= 120000
+	DefineCustomBoolVariable("cassandra_fdw.enable_batch_join",
+							 "Enables batched key lookup joins with Cassandra tables.",
+							 NULL,
+							 &cass_enable_batch_join,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	cassBatchJoinPathMethods.CustomName = "Cassandra Batch Join";
+	cassBatchJoinPathMethods.PlanCustomPath = cassPlanBatchJoin;
+
+	cassBatchJoinScanMethods.CustomName = "Cassandra Batch Join";
+	cassBatchJoinScanMethods.CreateCustomScanState = cassCreateBatchJoinState;
+	RegisterCustomScanMethods(&cassBatchJoinScanMethods);
+
+	cassBatchJoinExecMethods.CustomName = "Cassandra Batch Join";
+	cassBatchJoinExecMethods.BeginCustomScan = cassBeginBatchJoin;
+	cassBatchJoinExecMethods.ExecCustomScan = cassExecBatchJoin;
+	cassBatchJoinExecMethods.EndCustomScan = cassEndBatchJoin;
+	cassBatchJoinExecMethods.ReScanCustomScan = cassReScanBatchJoin;
+	cassBatchJoinExecMethods.ExplainCustomScan = cassExplainBatchJoin;
+
+	prev_set_join_pathlist_hook = set_join_pathlist_hook;
+	set_join_pathlist_hook = cassBatchJoinPathlist;
+#endif
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * set_join_pathlist_hook: offer a batched lookup join of outerrel with a
+ * foreign table innerrel whose partition key the join clauses pin to
+ * values of the outer row.
+ *
+ * This is the nested loop over a parameterized scan of the foreign table,
+ * except that the lookups of many outer rows are in flight at once.  Only
+ * inner and left joins qualify, and only with an unparameterized outer
+ * path, as the rows come out in the order of the outer path.
+ */
+static void
+cassBatchJoinPathlist(PlannerInfo *root, RelOptInfo *joinrel,
+					  RelOptInfo *outerrel, RelOptInfo *innerrel,
+					  JoinType jointype, JoinPathExtraData *extra)
+{
+	CassFdwPlanState *fpinfo;
+	RangeTblEntry *rte;
+	Path	   *outer_path;
+	List	   *key_clauses = NIL;
+	List	   *remote_conds;
+	List	   *local_conds;
+	List	   *join_conds = NIL;
+	List	   *other_conds = NIL;
+	bool		uses_join = false;
+	int			batch_size;
+	int			concurrency;
+	Cost		startup_cost;
+	Cost		total_cost;
+	CustomPath *cpath;
+	ListCell   *lc;
+
+	if (prev_set_join_pathlist_hook)
+		prev_set_join_pathlist_hook(root, joinrel, outerrel, innerrel,
+									jointype, extra);
+
+	if (!cass_enable_batch_join)
+		return;
+	if (jointype != JOIN_INNER && jointype != JOIN_LEFT)
+		return;
+	if (!cassIsForeignRel(innerrel) || !bms_is_empty(innerrel->lateral_relids))
+		return;
+
+	fpinfo = (CassFdwPlanState *) innerrel->fdw_private;
+	if (fpinfo == NULL || fpinfo->partition_attrs == NIL)
+		return;
+
+	/*
+	 * Joined rows are not rechecked by EvalPlanQual, so stay out of queries
+	 * that lock or update rows.
+	 */
+	if (root->rowMarks != NIL)
+		return;
+
+	outer_path = outerrel->cheapest_total_path;
+	if (outer_path == NULL || PATH_REQ_OUTER(outer_path) != NULL)
+		return;
+
+	/* Joined rows are assembled from plain columns of either side. */
+	if (!cassIsPlainVarExpr((Node *) joinrel->reltarget->exprs,
+							innerrel->relid))
+		return;
+
+	/*
+	 * Find the join clauses comparing a partition key column with a value
+	 * of the outer row.  The conditions of a left join's WHERE clause
+	 * filter the joined rows, and so cannot select the partitions to read.
+	 */
+	foreach(lc, extra->restrictlist)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		AttrNumber	attnum;
+		int			strategy;
+		Expr	   *value;
+
+		if (rinfo->pseudoconstant ||
+			!cassIsPlainVarExpr((Node *) rinfo->clause, innerrel->relid))
+			return;
+
+		if (jointype == JOIN_LEFT &&
+			RINFO_IS_PUSHED_DOWN(rinfo, joinrel->relids))
+			continue;
+
+		if (IsA(rinfo->clause, OpExpr) &&
+			cassIsKeyRestriction(root, innerrel, rinfo->clause,
+								 &attnum, &strategy, &value) &&
+			strategy == BTEqualStrategyNumber &&
+			list_member_int(fpinfo->partition_attrs, attnum))
+			key_clauses = lappend(key_clauses, rinfo);
+	}
+	if (key_clauses == NIL)
+		return;
+
+	foreach(lc, innerrel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		if (rinfo->pseudoconstant ||
+			!cassIsPlainVarExpr((Node *) rinfo->clause, innerrel->relid))
+			return;
+	}
+
+	/*
+	 * The join clauses must pin the whole partition key, each lookup
+	 * reading a single partition.
+	 */
+	cassClassifyConditions(root, innerrel,
+						   list_concat(list_copy(innerrel->baserestrictinfo),
+									   key_clauses),
+						   fpinfo->partition_attrs,
+						   fpinfo->clustering_attrs,
+						   &remote_conds, &local_conds);
+	foreach(lc, remote_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		if (IsA(rinfo->clause, ScalarArrayOpExpr))
+			return;
+		if (list_member_ptr(key_clauses, rinfo))
+			uses_join = true;
+	}
+	if (!uses_join)
+		return;
+
+	/*
+	 * Whatever is not sent is checked on our side.  The foreign table's own
+	 * conditions and a left join's join clauses decide whether an inner row
+	 * joins an outer row, before unmatched outer rows are null-extended; the
+	 * remaining conditions filter the joined rows.
+	 */
+	foreach(lc, innerrel->baserestrictinfo)
+	{
+		if (!list_member_ptr(remote_conds, lfirst(lc)))
+			join_conds = lappend(join_conds, lfirst(lc));
+	}
+	foreach(lc, extra->restrictlist)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		if (list_member_ptr(remote_conds, rinfo))
+			continue;
+		if (jointype == JOIN_LEFT &&
+			!RINFO_IS_PUSHED_DOWN(rinfo, joinrel->relids))
+			join_conds = lappend(join_conds, rinfo);
+		else
+			other_conds = lappend(other_conds, rinfo);
+	}
+
+	/*
+	 * Each lookup costs a round trip, like a parameterized scan of the
+	 * foreign table, but up to max_concurrent_requests of them overlap.
+	 */
+	rte = planner_rt_fetch(innerrel->relid, root);
+	batch_size = cassGetIntOption(rte->relid, "join_batch_size",
+								  DEFAULT_JOIN_BATCH_SIZE);
+	concurrency = Min(cassGetIntOption(rte->relid, "max_concurrent_requests",
+									   DEFAULT_MAX_CONCURRENT_REQUESTS),
+					  batch_size);
+
+	startup_cost = outer_path->startup_cost + fpinfo->startup_cost;
+	total_cost = outer_path->total_cost + fpinfo->startup_cost +
+		outer_path->rows * fpinfo->startup_cost / concurrency +
+		(cpu_tuple_cost + DEFAULT_FDW_TUPLE_COST) * joinrel->rows;
+
+	cpath = makeNode(CustomPath);
+	cpath->path.pathtype = T_CustomScan;
+	cpath->path.parent = joinrel;
+	cpath->path.pathtarget = joinrel->reltarget;
+	cpath->path.param_info = NULL;
+	cpath->path.parallel_aware = false;
+	cpath->path.parallel_safe = false;
+	cpath->path.parallel_workers = 0;
+	cpath->path.rows = joinrel->rows;
+	cpath->path.startup_cost = startup_cost;
+	cpath->path.total_cost = total_cost;
+	cpath->path.pathkeys = build_join_pathkeys(root, joinrel, jointype,
+											   outer_path->pathkeys);
+	cpath->flags = 0;
+	cpath->custom_paths = list_make1(outer_path);
+	cpath->custom_private = list_make4(remote_conds,
+									   join_conds,
+									   other_conds,
+									   makeInteger(innerrel->relid));
+	cpath->custom_private = lappend(cpath->custom_private,
+									makeInteger(jointype == JOIN_LEFT ? 1 : 0));
+	cpath->methods = &cassBatchJoinPathMethods;
+
+	add_path(joinrel, (Path *) cpath);
+}
+
+/*
+ * Whether node only refers to columns through plain Vars, and to the
+ * foreign table's only through its user columns.
+ */
+static bool
+cassIsPlainVarExpr(Node *node, Index inner_relid)
+{
+	List	   *vars = pull_var_clause(node, PVC_INCLUDE_PLACEHOLDERS);
+	ListCell   *lc;
+
+	foreach(lc, vars)
+	{
+		Var		   *var = (Var *) lfirst(lc);
+
+		if (!IsA(var, Var))
+			return false;
+		if (var->varno == inner_relid && var->varattno <= 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * cassPlanBatchJoin
+ *		Create the CustomScan node of a batched lookup join.
+ *
+ * Its scan tuple holds the outer and foreign table columns needed above
+ * the join and by its conditions, which are all evaluated against it.
+ */
+static Plan *
+cassPlanBatchJoin(PlannerInfo *root, RelOptInfo *rel, CustomPath *best_path,
+				  List *tlist, List *clauses, List *custom_plans)
+{
+	List	   *path_private = best_path->custom_private;
+	List	   *remote_conds;
+	List	   *join_exprs;
+	List	   *other_exprs;
+	RelOptInfo *innerrel;
+	CassFdwPlanState *fpinfo;
+	RangeTblEntry *rte;
+	Plan	   *outer_plan = (Plan *) linitial(custom_plans);
+	CustomScan *cscan;
+	List	   *vars;
+	List	   *scan_tlist;
+	List	   *sources = NIL;
+	List	   *param_strategies = NIL;
+	List	   *params_list = NIL;
+	List	   *retrieved_attrs;
+	List	   *custom_private;
+	Bitmapset  *attrs_used = NULL;
+	StringInfoData sql;
+	ListCell   *lc;
+
+	remote_conds = (List *) list_nth(path_private,
+									 CassJoinPathPrivateRemoteConds);
+	join_exprs = extract_actual_clauses((List *) list_nth(path_private,
+														  CassJoinPathPrivateJoinConds),
+										false);
+	other_exprs = extract_actual_clauses((List *) list_nth(path_private,
+														   CassJoinPathPrivateOtherConds),
+										 false);
+	innerrel = find_base_rel(root, intVal(list_nth(path_private,
+												   CassJoinPathPrivateInnerRelid)));
+	fpinfo = (CassFdwPlanState *) innerrel->fdw_private;
+	rte = planner_rt_fetch(innerrel->relid, root);
+
+	/* Read the foreign table's columns that are used above the scan. */
+	vars = pull_var_clause((Node *) tlist, PVC_INCLUDE_PLACEHOLDERS);
+	vars = list_concat(vars, pull_var_clause((Node *) join_exprs,
+											 PVC_INCLUDE_PLACEHOLDERS));
+	vars = list_concat(vars, pull_var_clause((Node *) other_exprs,
+											 PVC_INCLUDE_PLACEHOLDERS));
+	foreach(lc, vars)
+	{
+		Var		   *var = (Var *) lfirst(lc);
+
+		if (var->varno == innerrel->relid)
+			attrs_used = bms_add_member(attrs_used,
+										var->varattno - FirstLowInvalidHeapAttributeNumber);
+	}
+
+	initStringInfo(&sql);
+	cassDeparseSelectSql(&sql, root, innerrel, attrs_used, remote_conds,
+						 false, &retrieved_attrs, &params_list);
+	if (fpinfo->per_partition_limit > 0)
+		appendStringInfo(&sql, " PER PARTITION LIMIT %d",
+						 fpinfo->per_partition_limit);
+
+	foreach(lc, remote_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		AttrNumber	attnum;
+		int			strategy;
+		Expr	   *value;
+
+		if (!cassIsKeyRestriction(root, innerrel, rinfo->clause,
+								  &attnum, &strategy, &value))
+			elog(ERROR, "unexpected remote condition");
+		param_strategies = lappend_int(param_strategies, strategy);
+	}
+
+	/*
+	 * The key values bound to each lookup are computed from the outer
+	 * columns in the scan tuple as well.
+	 */
+	scan_tlist = add_to_flat_tlist(NIL, vars);
+	scan_tlist = add_to_flat_tlist(scan_tlist,
+								   pull_var_clause((Node *) params_list,
+												   PVC_INCLUDE_PLACEHOLDERS));
+	foreach(lc, scan_tlist)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+		Var		   *var = (Var *) tle->expr;
+		TargetEntry *outer_tle;
+
+		if (var->varno == innerrel->relid)
+		{
+			sources = lappend_int(sources, -var->varattno);
+			continue;
+		}
+
+		outer_tle = tlist_member((Expr *) var, outer_plan->targetlist);
+		if (outer_tle == NULL)
+			elog(ERROR, "outer column not found in batch join");
+		sources = lappend_int(sources, outer_tle->resno);
+	}
+
+	/*
+	 * Build the custom_private list that will be available to the executor.
+	 * Items in the list must match enum CassJoinPrivateIndex, above.
+	 */
+	custom_private = list_make3(makeString(sql.data),
+								retrieved_attrs,
+								param_strategies);
+	custom_private = lappend(custom_private,
+							 makeInteger(list_length(params_list)));
+	custom_private = lappend(custom_private, sources);
+	custom_private = lappend(custom_private, makeInteger((int) rte->relid));
+	custom_private = lappend(custom_private,
+							 makeInteger(cassGetIntOption(rte->relid,
+														  "join_batch_size",
+														  DEFAULT_JOIN_BATCH_SIZE)));
+	custom_private = lappend(custom_private,
+							 list_nth(path_private,
+									  CassJoinPathPrivateLeftJoin));
+
+	cscan = makeNode(CustomScan);
+	cscan->scan.plan.targetlist = tlist;
+	cscan->scan.plan.qual = other_exprs;
+	cscan->scan.scanrelid = 0;
+	cscan->flags = best_path->flags;
+	cscan->custom_plans = custom_plans;
+	cscan->custom_exprs = list_concat(params_list, join_exprs);
+	cscan->custom_private = custom_private;
+	cscan->custom_scan_tlist = scan_tlist;
+	cscan->methods = &cassBatchJoinScanMethods;
+
+	return &cscan->scan.plan;
+}
+
+/*
+ * Create the execution state of a batched lookup join.
+ */
+static Node *
+cassCreateBatchJoinState(CustomScan *cscan)
+{
+	CassBatchJoinState *state;
+
+	state = (CassBatchJoinState *) palloc0(sizeof(CassBatchJoinState));
+	NodeSetTag(state, T_CustomScanState);
+	state->css.flags = cscan->flags;
+	state->css.methods = &cassBatchJoinExecMethods;
+
+	return (Node *) state;
+}
+
+/*
+ * cassBeginBatchJoin
+ *		Initiate the outer plan, and access to the foreign table
+ */
+static void
+cassBeginBatchJoin(CustomScanState *node, EState *estate, int eflags)
+{
+	CassBatchJoinState *state = (CassBatchJoinState *) node;
+	CustomScan *cscan = (CustomScan *) node->ss.ps.plan;
+	PlanState  *outer_ps;
+	TupleDesc	outer_desc;
+	RangeTblEntry *rte = NULL;
+	Oid			foreigntableid;
+	Oid			userid;
+	int			rtindex;
+	ForeignTable *table;
+	ForeignServer *server;
+	UserMapping *user;
+	List	   *qual_exprs = NIL;
+	List	   *sources;
+	ListCell   *lc;
+	int			natts;
+	int			i;
+
+	outer_ps = ExecInitNode((Plan *) linitial(cscan->custom_plans),
+							estate, eflags);
+	node->custom_ps = list_make1(outer_ps);
+
+	/*
+	 * Do nothing else in EXPLAIN (no ANALYZE) case.
+	 */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	/* Get private info created by planner functions. */
+	state->query = strVal(list_nth(cscan->custom_private,
+								   CassJoinPrivateSelectSql));
+	state->retrieved_attrs = (List *) list_nth(cscan->custom_private,
+											   CassJoinPrivateRetrievedAttrs);
+	state->param_strategies = (List *) list_nth(cscan->custom_private,
+												CassJoinPrivateParamStrategies);
+	state->numParams = intVal(list_nth(cscan->custom_private,
+									   CassJoinPrivateNumParams));
+	sources = (List *) list_nth(cscan->custom_private, CassJoinPrivateSources);
+	foreigntableid = (Oid) intVal(list_nth(cscan->custom_private,
+										   CassJoinPrivateRelid));
+	state->batch_size = intVal(list_nth(cscan->custom_private,
+										CassJoinPrivateBatchSize));
+	state->left_join = intVal(list_nth(cscan->custom_private,
+									   CassJoinPrivateLeftJoin)) != 0;
+
+	state->sources = (int *) palloc(list_length(sources) * sizeof(int));
+	i = 0;
+	foreach(lc, sources)
+		state->sources[i++] = lfirst_int(lc);
+
+	/*
+	 * Identify which user to do the remote access as.  This should match what
+	 * ExecCheckRTEPerms() does.  The foreign table is the one relation of
+	 * the join with its OID.
+	 */
+	rtindex = -1;
+	while ((rtindex = bms_next_member(cscan->custom_relids, rtindex)) >= 0)
+	{
+		rte = exec_rt_fetch(rtindex, estate);
+		if (rte->rtekind == RTE_RELATION && rte->relid == foreigntableid)
+			break;
+	}
+	if (rtindex < 0)
+		elog(ERROR, "foreign table of batch join not found");
+	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+
+	/* Get info about foreign table. */
+	state->rel = ExecOpenScanRelation(estate, rtindex, eflags);
+	table = GetForeignTable(foreigntableid);
+	server = GetForeignServer(table->serverid);
+	user = GetUserMapping(userid, server->serverid);
+
+	/*
+	 * Get connection to the foreign server.  Connection manager will
+	 * establish new connection if necessary.
+	 */
+	state->cass_conn = pgcass_GetConnection(server, user, true);
+
+	cassGetReadConsistencyOption(foreigntableid, &state->read_consistency);
+	state->fetch_size = cassGetIntOption(foreigntableid, "fetch_size",
+										 DEFAULT_FETCH_SIZE);
+	state->max_concurrent = cassGetIntOption(foreigntableid,
+											 "max_concurrent_requests",
+											 DEFAULT_MAX_CONCURRENT_REQUESTS);
+
+	/* Get info we'll need for input data conversion. */
+	state->attinmeta = TupleDescGetAttInMetadata(RelationGetDescr(state->rel));
+	natts = RelationGetDescr(state->rel)->natts;
+	state->inner_values = (Datum *) palloc0(Max(natts, 1) * sizeof(Datum));
+	state->inner_isnull = (bool *) palloc0(Max(natts, 1) * sizeof(bool));
+
+	/*
+	 * Prepare for evaluation of the values bound to the statement, and of
+	 * the conditions checked on each joined pair, which follow them.
+	 */
+	state->param_types = (Oid *) palloc0(Max(state->numParams, 1) * sizeof(Oid));
+	state->param_typlens = (int16 *) palloc0(Max(state->numParams, 1) * sizeof(int16));
+	state->param_typbyvals = (bool *) palloc0(Max(state->numParams, 1) * sizeof(bool));
+	i = 0;
+	foreach(lc, cscan->custom_exprs)
+	{
+		Expr	   *expr = (Expr *) lfirst(lc);
+
+		if (i < state->numParams)
+		{
+			state->param_exprs = lappend(state->param_exprs,
+										 ExecInitExpr(expr, (PlanState *) node));
+			state->param_types[i] = exprType((Node *) expr);
+			get_typlenbyval(state->param_types[i],
+							&state->param_typlens[i],
+							&state->param_typbyvals[i]);
+		}
+		else
+			qual_exprs = lappend(qual_exprs, expr);
+		i++;
+	}
+	state->join_qual = ExecInitQual(qual_exprs, (PlanState *) node);
+
+	/* Room for the outer rows of a batch, and the reads of their keys. */
+	outer_desc = ExecGetResultType(outer_ps);
+	state->outer_slots = (TupleTableSlot **)
+		palloc(state->batch_size * sizeof(TupleTableSlot *));
+	for (i = 0; i < state->batch_size; i++)
+		state->outer_slots[i] = ExecInitExtraTupleSlot(estate, outer_desc,
+													   &TTSOpsMinimalTuple);
+	state->outer_lookup = (int *) palloc(state->batch_size * sizeof(int));
+	state->lookups = (CassJoinLookup *)
+		palloc0(state->batch_size * sizeof(CassJoinLookup));
+	state->inflight = (int *) palloc(state->batch_size * sizeof(int));
+	state->batch_cxt = AllocSetContextCreate(estate->es_query_cxt,
+											 "cassandra_fdw batch join",
+											 ALLOCSET_DEFAULT_SIZES);
+
+	/*
+	 * Driver objects are not palloc'd, so make sure in-flight requests and
+	 * received pages are released even if the query fails.
+	 */
+	{
+		MemoryContextCallback *cb;
+
+		cb = (MemoryContextCallback *)
+			MemoryContextAlloc(estate->es_query_cxt,
+							   sizeof(MemoryContextCallback));
+		cb->func = cleanup_batch_join_callback;
+		cb->arg = (void *) state;
+		MemoryContextRegisterResetCallback(estate->es_query_cxt, cb);
+	}
+}
+
+/*
+ * cassExecBatchJoin
+ *		Return the next joined row, checked against the join's other
+ *		conditions and projected
+ */
+static TupleTableSlot *
+cassExecBatchJoin(CustomScanState *node)
+{
+	return ExecScan(&node->ss,
+					(ExecScanAccessMtd) cassBatchJoinNext,
+					(ExecScanRecheckMtd) cassBatchJoinRecheck);
+}
+
+/*
+ * Build the next joined row into the scan slot.
+ *
+ * Each outer row is joined with the rows read for its key that pass the
+ * join conditions; a left join returns it null-extended if there are none.
+ */
+static TupleTableSlot *
+cassBatchJoinNext(CustomScanState *node)
+{
+	CassBatchJoinState *state = (CassBatchJoinState *) node;
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+
+	for (;;)
+	{
+		TupleTableSlot *outer_slot;
+		TupleTableSlot *slot;
+		bool		null_extend;
+
+		if (state->cur_outer >= state->num_outer)
+		{
+			if (state->outer_done)
+				return ExecClearTuple(node->ss.ss_ScanTupleSlot);
+			fill_batch(state);
+			continue;
+		}
+
+		outer_slot = state->outer_slots[state->cur_outer];
+		for (;;)
+		{
+			MemoryContext oldcontext;
+			bool		found;
+
+			/* Inner columns go in per-tuple memory, reset for each row. */
+			oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+			found = next_inner_row(state);
+			MemoryContextSwitchTo(oldcontext);
+			if (!found)
+				break;
+
+			slot = store_join_tuple(state, outer_slot, false);
+			econtext->ecxt_scantuple = slot;
+			if (ExecQual(state->join_qual, econtext))
+			{
+				state->matched = true;
+				return slot;
+			}
+			ResetExprContext(econtext);
+		}
+
+		null_extend = state->left_join && !state->matched;
+		advance_outer(state);
+		if (null_extend)
+			return store_join_tuple(state, outer_slot, true);
+	}
+}
+
+/*
+ * The join is not offered to queries with row marks, so there is never
+ * anything to recheck.
+ */
+static bool
+cassBatchJoinRecheck(CustomScanState *node, TupleTableSlot *slot)
+{
+	return true;
+}
+
+/*
+ * cassReScanBatchJoin
+ *		Restart the join from the first outer row
+ */
+static void
+cassReScanBatchJoin(CustomScanState *node)
+{
+	CassBatchJoinState *state = (CassBatchJoinState *) node;
+
+	release_batch(state);
+	state->outer_done = false;
+
+	ExecReScan((PlanState *) linitial(node->custom_ps));
+}
+
+/*
+ * cassEndBatchJoin
+ *		Finish the join and dispose objects used for it
+ */
+static void
+cassEndBatchJoin(CustomScanState *node)
+{
+	CassBatchJoinState *state = (CassBatchJoinState *) node;
+
+	release_batch(state);
+
+	/* The prepared statement belongs to the connection cache. */
+	state->prepared = NULL;
+
+	/* Release remote connection */
+	if (state->cass_conn)
+		pgcass_ReleaseConnection(state->cass_conn);
+	state->cass_conn = NULL;
+
+	ExecEndNode((PlanState *) linitial(node->custom_ps));
+
+	/* MemoryContexts will be deleted automatically. */
+}
+
+/*
+ * cassExplainBatchJoin
+ *		Produce extra output for EXPLAIN
+ */
+static void
+cassExplainBatchJoin(CustomScanState *node, List *ancestors, ExplainState *es)
+{
+	CustomScan *cscan = (CustomScan *) node->ss.ps.plan;
+
+	if (es->verbose)
+	{
+		ExplainPropertyText("Remote SQL",
+							strVal(list_nth(cscan->custom_private,
+											CassJoinPrivateSelectSql)),
+							es);
+		ExplainPropertyInteger("Batch Size", NULL,
+							   intVal(list_nth(cscan->custom_private,
+											   CassJoinPrivateBatchSize)),
+							   es);
+	}
+}
+
+/*
+ * Read the next batch of outer rows, and the partitions of their keys.
+ *
+ * Outer rows with the same key share one read; a key with a NULL value
+ * cannot match anything, and is not read at all.
+ */
+static void
+fill_batch(CassBatchJoinState *state)
+{
+	PlanState  *outer_ps = (PlanState *) linitial(state->css.custom_ps);
+	ExprContext *econtext = state->css.ss.ps.ps_ExprContext;
+	Datum	   *values;
+	int			n;
+
+	release_batch(state);
+
+	values = (Datum *) palloc(Max(state->numParams, 1) * sizeof(Datum));
+
+	for (n = 0; n < state->batch_size; n++)
+	{
+		TupleTableSlot *slot = ExecProcNode(outer_ps);
+		MemoryContext oldcontext;
+		bool		null_key = false;
+		ListCell   *lc;
+		int			i;
+
+		if (TupIsNull(slot))
+		{
+			state->outer_done = true;
+			break;
+		}
+		ExecCopySlot(state->outer_slots[n], slot);
+
+		/*
+		 * The key is computed from the outer columns of the scan tuple,
+		 * with the foreign table's left NULL.
+		 */
+		ResetExprContext(econtext);
+		econtext->ecxt_scantuple = store_join_tuple(state,
+													state->outer_slots[n],
+													true);
+		oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+		i = 0;
+		foreach(lc, state->param_exprs)
+		{
+			bool		isnull;
+
+			values[i] = ExecEvalExpr((ExprState *) lfirst(lc), econtext,
+									 &isnull);
+			if (isnull)
+				null_key = true;
+			i++;
+		}
+		MemoryContextSwitchTo(oldcontext);
+
+		state->outer_lookup[n] = null_key ? -1 : find_lookup(state, values);
+	}
+	state->num_outer = n;
+
+	pfree(values);
+	ResetExprContext(econtext);
+
+	if (state->num_lookups > 0)
+		fetch_lookups(state);
+}
+
+/*
+ * Return the index of the lookup of the batch reading the partition of
+ * values, adding one if needed.
+ *
+ * The key types we push down compare equal exactly when their binary
+ * representations do, so datumIsEqual() is good enough here.
+ */
+static int
+find_lookup(CassBatchJoinState *state, Datum *values)
+{
+	CassJoinLookup *lookup;
+	MemoryContext oldcontext;
+	int			i;
+	int			k;
+
+	for (i = 0; i < state->num_lookups; i++)
+	{
+		for (k = 0; k < state->numParams; k++)
+		{
+			if (!datumIsEqual(values[k], state->lookups[i].values[k],
+							  state->param_typbyvals[k],
+							  state->param_typlens[k]))
+				break;
+		}
+		if (k == state->numParams)
+			return i;
+	}
+
+	lookup = &state->lookups[state->num_lookups];
+	oldcontext = MemoryContextSwitchTo(state->batch_cxt);
+	lookup->values = (Datum *) palloc(Max(state->numParams, 1) * sizeof(Datum));
+	for (k = 0; k < state->numParams; k++)
+		lookup->values[k] = datumCopy(values[k], state->param_typbyvals[k],
+									  state->param_typlens[k]);
+	MemoryContextSwitchTo(oldcontext);
+
+	return state->num_lookups++;
+}
+
+/*
+ * Request the first page of the partition of each key of the batch.
+ *
+ * Up to max_concurrent_requests single-partition reads are in flight at a
+ * time, each for fetch_size rows.  Later pages are only requested as the
+ * join gets to them, so that a batch holds about one page per key however
+ * large its partitions are.
+ */
+static void
+fetch_lookups(CassBatchJoinState *state)
+{
+	int			next = 0;
+	int			i;
+
+	if (state->prepared == NULL)
+		state->prepared = pgcass_GetPrepared(state->cass_conn, state->query);
+
+	for (i = 0; i < state->num_lookups; i++)
+		bind_lookup(state, &state->lookups[i]);
+
+	while (next < state->num_lookups || state->num_pending > 0)
+	{
+		while (next < state->num_lookups &&
+			   state->num_pending < state->max_concurrent)
+		{
+			CassJoinLookup *lookup = &state->lookups[next];
+
+			if (lookup->statement != NULL)
+			{
+				lookup->pending = cass_session_execute(state->cass_conn,
+													   lookup->statement);
+				state->inflight[state->num_pending++] = next;
+			}
+			next++;
+		}
+
+		collect_lookup_pages(state);
+	}
+}
+
+/*
+ * Store the first pages of completed lookups.  Blocks until at least one
+ * request completes.
+ */
+static void
+collect_lookup_pages(CassBatchJoinState *state)
+{
+	for (;;)
+	{
+		bool		collected = false;
+		int			k = 0;
+
+		while (k < state->num_pending)
+		{
+			CassJoinLookup *lookup = &state->lookups[state->inflight[k]];
+
+			if (!cass_future_ready(lookup->pending))
+			{
+				k++;
+				continue;
+			}
+
+			receive_lookup_page(state, lookup);
+			lookup->page_no = 0;
+			collected = true;
+
+			state->inflight[k] = state->inflight[--state->num_pending];
+		}
+
+		if (collected || state->num_pending == 0)
+			break;
+
+		/*
+		 * Nothing has arrived yet.  Block on one request; when others are
+		 * in flight too, only briefly, as any of them may complete first.
+		 */
+		if (state->num_pending == 1)
+			cass_future_wait(state->lookups[state->inflight[0]].pending);
+		else
+			cass_future_wait_timed(state->lookups[state->inflight[0]].pending,
+								   CASS_POLL_USECS);
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*
+ * Bind the key values of lookup to a new statement reading its partition
+ * from the start.  The statement is left NULL if the key cannot match
+ * anything, because a timestamp compared for equality has more precision
+ * than Cassandra keeps.
+ */
+static void
+bind_lookup(CassBatchJoinState *state, CassJoinLookup *lookup)
+{
+	CassStatement *statement;
+	int			k;
+
+	statement = cass_prepared_bind(state->prepared);
+	cass_statement_set_consistency(statement, state->read_consistency);
+	cass_statement_set_paging_size(statement, state->fetch_size);
+
+	/* Owned by the lookup right away, so that an error releases it. */
+	lookup->statement = statement;
+
+	for (k = 0; k < state->numParams; k++)
+	{
+		if (!cassBindKeyValue(statement, k, state->param_types[k],
+							  lookup->values[k],
+							  list_nth_int(state->param_strategies, k)))
+		{
+			cass_statement_free(statement);
+			lookup->statement = NULL;
+			return;
+		}
+	}
+}
+
+/*
+ * Wait for the page requested for lookup, and put it in hand in place of
+ * the previous one.
+ */
+static void
+receive_lookup_page(CassBatchJoinState *state, CassJoinLookup *lookup)
+{
+	CassFuture *future = lookup->pending;
+
+	cass_future_wait(future);
+	lookup->pending = NULL;
+
+	/* On error, report the original query. */
+	if (cass_future_error_code(future) != CASS_OK)
+		pgcass_report_error(ERROR, future, true, state->query);
+
+	if (lookup->page)
+		cass_result_free(lookup->page);
+	lookup->page = cass_future_get_result(future);
+	cass_future_free(future);
+}
+
+/*
+ * Move lookup on to the next page of its partition, and request the one
+ * after it, if any, so that it arrives while this one is being joined.
+ */
+static void
+next_lookup_page(CassBatchJoinState *state, CassJoinLookup *lookup)
+{
+	if (lookup->pending == NULL)
+	{
+		cass_statement_set_paging_state(lookup->statement, lookup->page);
+		lookup->pending = cass_session_execute(state->cass_conn,
+											   lookup->statement);
+	}
+	receive_lookup_page(state, lookup);
+	lookup->page_no++;
+
+	if (cass_result_has_more_pages(lookup->page))
+	{
+		cass_statement_set_paging_state(lookup->statement, lookup->page);
+		lookup->pending = cass_session_execute(state->cass_conn,
+											   lookup->statement);
+	}
+}
+
+/*
+ * Read the first page of lookup again, for an outer row sharing its key
+ * with an earlier one that went past it.
+ */
+static void
+restart_lookup(CassBatchJoinState *state, CassJoinLookup *lookup)
+{
+	/* An abandoned request is cancelled from our side by freeing it. */
+	if (lookup->pending)
+		cass_future_free(lookup->pending);
+	lookup->pending = NULL;
+
+	cass_statement_free(lookup->statement);
+	bind_lookup(state, lookup);
+
+	lookup->pending = cass_session_execute(state->cass_conn,
+										   lookup->statement);
+	receive_lookup_page(state, lookup);
+	lookup->page_no = 0;
+}
+
+/*
+ * Decode the next row read for the current outer row into inner_values,
+ * allocating pass-by-reference values in the current memory context.
+ * Returns false once there are none left.
+ */
+static bool
+next_inner_row(CassBatchJoinState *state)
+{
+	int			idx = state->outer_lookup[state->cur_outer];
+	CassJoinLookup *lookup;
+
+	if (idx < 0)
+		return false;
+	lookup = &state->lookups[idx];
+	if (lookup->statement == NULL)
+		return false;
+
+	for (;;)
+	{
+		if (state->rows == NULL)
+		{
+			if (state->cur_page == 0)
+			{
+				/* Each outer row reads the partition from the start. */
+				if (lookup->page_no > 0)
+					restart_lookup(state, lookup);
+			}
+			else if (cass_result_has_more_pages(lookup->page))
+				next_lookup_page(state, lookup);
+			else
+				return false;
+			state->cur_page++;
+			state->rows = cass_iterator_from_result(lookup->page);
+		}
+
+		if (cass_iterator_next(state->rows))
+			break;
+
+		cass_iterator_free(state->rows);
+		state->rows = NULL;
+	}
+
+	/*
+	 * On the first row, work out once how each column is converted; every
+	 * later row of the join reuses that plan.
+	 */
+	if (state->colplan == NULL)
+	{
+		const CassResult *res = lookup->page;
+		MemoryContext oldcontext;
+
+		oldcontext = MemoryContextSwitchTo(state->css.ss.ps.state->es_query_cxt);
+		state->NumberOfColumns = cass_result_column_count(res);
+		state->colplan = cassBuildColumnPlan(res,
+											 RelationGetDescr(state->rel),
+											 state->attinmeta,
+											 state->retrieved_attrs);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	cassDecodeRow(cass_iterator_get_row(state->rows),
+				  state->colplan, state->NumberOfColumns,
+				  RelationGetDescr(state->rel)->natts,
+				  state->inner_values, state->inner_isnull);
+
+	return true;
+}
+
+/*
+ * Move on to the next outer row of the batch.
+ */
+static void
+advance_outer(CassBatchJoinState *state)
+{
+	if (state->rows)
+		cass_iterator_free(state->rows);
+	state->rows = NULL;
+	state->cur_page = 0;
+	state->matched = false;
+	state->cur_outer++;
+}
+
+/*
+ * Store the columns of outer_slot and of the current inner row, or NULLs
+ * if inner_null is true, as a virtual tuple in the scan slot.
+ */
+static TupleTableSlot *
+store_join_tuple(CassBatchJoinState *state, TupleTableSlot *outer_slot,
+				 bool inner_null)
+{
+	TupleTableSlot *slot = state->css.ss.ss_ScanTupleSlot;
+	int			natts = slot->tts_tupleDescriptor->natts;
+	int			i;
+
+	ExecClearTuple(slot);
+	for (i = 0; i < natts; i++)
+	{
+		int			source = state->sources[i];
+
+		if (source > 0)
+			slot->tts_values[i] = slot_getattr(outer_slot, source,
+											   &slot->tts_isnull[i]);
+		else if (inner_null)
+		{
+			slot->tts_values[i] = (Datum) 0;
+			slot->tts_isnull[i] = true;
+		}
+		else
+		{
+			slot->tts_values[i] = state->inner_values[-source - 1];
+			slot->tts_isnull[i] = state->inner_isnull[-source - 1];
+		}
+	}
+
+	return ExecStoreVirtualTuple(slot);
+}
+
+/*
+ * Release the pages and requests of the current batch, and forget its
+ * outer rows.
+ */
+static void
+release_batch(CassBatchJoinState *state)
+{
+	int			i;
+
+	if (state->rows)
+		cass_iterator_free(state->rows);
+	state->rows = NULL;
+
+	/* An abandoned request is cancelled from our side by freeing it. */
+	for (i = 0; i < state->num_lookups; i++)
+	{
+		CassJoinLookup *lookup = &state->lookups[i];
+
+		if (lookup->pending)
+			cass_future_free(lookup->pending);
+		lookup->pending = NULL;
+
+		if (lookup->statement)
+			cass_statement_free(lookup->statement);
+		lookup->statement = NULL;
+
+		if (lookup->page)
+			cass_result_free(lookup->page);
+		lookup->page = NULL;
+		lookup->page_no = 0;
+	}
+	state->num_lookups = 0;
+	state->num_pending = 0;
+	state->num_outer = 0;
+	state->cur_outer = 0;
+	state->cur_page = 0;
+	state->matched = false;
+
+	if (state->batch_cxt)
+		MemoryContextReset(state->batch_cxt);
+}
+
+/*
+ * Memory context callback releasing the driver objects of a join that was
+ * not shut down by cassEndBatchJoin, e.g. because of an error.
+ *
+ * The batch context is already gone by then, but the driver objects are
+ * tracked in memory of the query context itself.
+ */
+static void
+cleanup_batch_join_callback(void *arg)
+{
+	CassBatchJoinState *state = (CassBatchJoinState *) arg;
+
+	state->batch_cxt = NULL;
+	release_batch(state);
+}
+#endif							/* PG_VERSION_NUM >= 120000 */
@@ -24,9 +24,15 @@
 #include "cstar_fdw.h"
 
 #include "access/heapam.h"
+#if PG_VERSION_NUM >= 120000
+	#include "access/table.h"
+#endif
 #include "access/htup_details.h"
+#include "access/stratnum.h"
 #include "access/sysattr.h"
 #include "access/transam.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_am.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_namespace.h"
 #include "catalog/pg_operator.h"
@@ -43,6 +49,7 @@
 #include "parser/parsetree.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
+#include "utils/pg_locale.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 
@@ -57,7 +64,26 @@ static void cassDeparseTargetList(StringInfo buf,
 					  List **retrieved_attrs);
 static void cassDeparseColumnRef(StringInfo buf, int varno, int varattno,
 					 PlannerInfo *root);
+static void cassDeparseColumnName(StringInfo buf, Oid relid, int attnum);
 static void cassDeparseRelation(StringInfo buf, Relation rel);
+static bool cassIsBindableType(Oid type);
+static bool cassAggregateForm(RelOptInfo *baserel, Aggref *agg,
+				  const char **funcname, Var **arg, const char **cast);
+static void cassAppendWhereClause(StringInfo buf, PlannerInfo *root,
+					  RelOptInfo *baserel, List *remote_conds,
+					  List **params_list);
+
+/*
+ * CQL comparison operators, indexed by btree strategy number.
+ */
+static const char *const cassStrategyOperators[] = {
+	NULL,						/* InvalidStrategy */
+	"<",						/* BTLessStrategyNumber */
+	"<=",						/* BTLessEqualStrategyNumber */
+	"=",						/* BTEqualStrategyNumber */
+	">=",						/* BTGreaterEqualStrategyNumber */
+	">"							/* BTGreaterStrategyNumber */
+};
 
 /*
  * Append remote name of specified foreign table to buf.
@@ -105,9 +131,6 @@ static void
 cassDeparseColumnRef(StringInfo buf, int varno, int varattno, PlannerInfo *root)
 {
 	RangeTblEntry *rte;
-	char	   *colname = NULL;
-	List	   *options;
-	ListCell   *lc;
 
 	/* varno must not be any of OUTER_VAR, INNER_VAR and INDEX_VAR. */
 	Assert(!IS_SPECIAL_VARNO(varno));
@@ -115,11 +138,25 @@ cassDeparseColumnRef(StringInfo buf, int varno, int varattno, PlannerInfo *root)
 	/* Get RangeTblEntry from array in PlannerInfo. */
 	rte = planner_rt_fetch(varno, root);
 
+	cassDeparseColumnName(buf, rte->relid, varattno);
+}
+
+/*
+ * Emit the name to use for column attnum of relation relid into buf; as
+ * cassDeparseColumnRef(), but without a planner to look up the relation.
+ */
+static void
+cassDeparseColumnName(StringInfo buf, Oid relid, int attnum)
+{
+	char	   *colname = NULL;
+	List	   *options;
+	ListCell   *lc;
+
 	/*
 	 * If it's a column of a foreign table, and it has the column_name FDW
 	 * option, use that value.
 	 */
-	options = GetForeignColumnOptions(rte->relid, varattno);
+	options = GetForeignColumnOptions(relid, attnum);
 	foreach(lc, options)
 	{
 		DefElem    *def = (DefElem *) lfirst(lc);
@@ -136,7 +173,7 @@ cassDeparseColumnRef(StringInfo buf, int varno, int varattno, PlannerInfo *root)
 	 * option, use attribute name.
 	 */
 	if (colname == NULL)
-		colname = get_attname(rte->relid, varattno, false);
+		colname = get_attname(relid, attnum, false);
 
 	appendStringInfoString(buf, quote_identifier(colname));
 }
@@ -194,25 +231,322 @@ cassDeparseTargetList(StringInfo buf,
 		}
 	}
 
+	/*
+	 * CQL has no "SELECT NULL", so if no column is needed, e.g. for a local
+	 * count(*), fetch the first one anyway; a 0 in retrieved_attrs tells the
+	 * scan to ignore it.
+	 */
+	for (i = 1; first && i <= tupdesc->natts; i++)
+	{
+#if PG_VERSION_NUM < 110000
+		Form_pg_attribute attr = tupdesc->attrs[i - 1];
+#else
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i - 1);
+#endif
+
+		if (attr->attisdropped)
+			continue;
+
+		cassDeparseColumnRef(buf, rtindex, i, root);
+		*retrieved_attrs = lappend_int(*retrieved_attrs, 0);
+		first = false;
+	}
+
 	/* Don't generate bad syntax if no undropped columns */
 	if (first)
 		appendStringInfoString(buf, "NULL");
 }
 
+/*
+ * Check whether values of the given type can be bound to a CQL statement.
+ */
+static bool
+cassIsBindableType(Oid type)
+{
+	switch (type)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case BOOLOID:
+		case TEXTOID:
+		case VARCHAROID:
+		case UUIDOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Whether Cassandra orders values of this type the same way as the default
+ * btree operators of PostgreSQL do, so that range restrictions, sorting and
+ * MIN/MAX give the same results.  Strings are left out because their
+ * order depends on the collation, and UUIDs because Cassandra orders them
+ * by version and time rather than bytewise.
+ */
+bool
+cassIsOrderedType(Oid type)
+{
+	switch (type)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * cassIsKeyRestriction
+ *		Check whether a WHERE clause restricts one column of the foreign
+ *		table to a value that Cassandra can be asked to compare against.
+ *
+ * The clause must have the form "column op value" or "value op column",
+ * where op is a member of the default btree operator family of the column
+ * type, and value is an expression of the same type that does not reference
+ * the foreign table and can be evaluated once before the scan starts.  For
+ * a join clause, value references the other side of the join, and is
+ * evaluated anew for each outer row of a parameterized scan.
+ *
+ * The clause may also be "column = ANY (array)", whose array expression is
+ * returned as the value with the equality strategy; the caller tells the
+ * two forms apart by the clause's node type.  Each array element is later
+ * sent in a statement of its own.
+ *
+ * On success, returns the column's attribute number, the btree strategy of
+ * the operator as seen from the column's side, and the value expression.
+ */
+bool
+cassIsKeyRestriction(PlannerInfo *root, RelOptInfo *baserel, Expr *clause,
+					 AttrNumber *attnum, int *strategy, Expr **value)
+{
+	OpExpr	   *op;
+	Oid			opno;
+	Expr	   *left;
+	Expr	   *right;
+	Var		   *var;
+	Expr	   *val;
+	Oid			opclass;
+	Oid			inputcollid;
+	Oid			vartype;
+	Oid			valtype;
+	bool		is_array;
+	List	   *args;
+
+	if (IsA(clause, OpExpr))
+	{
+		op = (OpExpr *) clause;
+		opno = op->opno;
+		inputcollid = op->inputcollid;
+		args = op->args;
+		is_array = false;
+	}
+	else if (IsA(clause, ScalarArrayOpExpr) &&
+			 ((ScalarArrayOpExpr *) clause)->useOr)
+	{
+		ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) clause;
+
+		opno = saop->opno;
+		inputcollid = saop->inputcollid;
+		args = saop->args;
+		is_array = true;
+	}
+	else
+		return false;
+	if (list_length(args) != 2)
+		return false;
+
+	left = (Expr *) linitial(args);
+	right = (Expr *) lsecond(args);
+	while (IsA(left, RelabelType))
+		left = ((RelabelType *) left)->arg;
+	while (IsA(right, RelabelType))
+		right = ((RelabelType *) right)->arg;
+
+	/*
+	 * Put the column on the left, commuting the operator if necessary.  The
+	 * array of "= ANY" is always on the right.
+	 */
+	if (IsA(left, Var) && ((Var *) left)->varno == baserel->relid &&
+		((Var *) left)->varlevelsup == 0)
+	{
+		var = (Var *) left;
+		val = (Expr *) lsecond(args);
+	}
+	else if (!is_array &&
+			 IsA(right, Var) && ((Var *) right)->varno == baserel->relid &&
+			 ((Var *) right)->varlevelsup == 0)
+	{
+		var = (Var *) right;
+		val = (Expr *) linitial(args);
+		opno = get_commutator(opno);
+		if (!OidIsValid(opno))
+			return false;
+	}
+	else
+		return false;
+
+	/* System columns don't exist on the remote side. */
+	if (var->varattno <= 0)
+		return false;
+
+	/*
+	 * The value must be computable before the scan starts.  It is sent as a
+	 * bound parameter, so it has to be of a type that we can bind, and the
+	 * same type as the column so that Cassandra sees the right encoding.
+	 */
+#if PG_VERSION_NUM < 140000
+	if (bms_is_member(baserel->relid, pull_varnos((Node *) val)) ||
+#else
+	if (bms_is_member(baserel->relid, pull_varnos(root, (Node *) val)) ||
+#endif
+		contain_volatile_functions((Node *) val) ||
+		contain_subplans((Node *) val))
+		return false;
+
+	vartype = var->vartype;
+	valtype = exprType((Node *) val);
+	if (is_array)
+		valtype = get_element_type(valtype);
+	if (!cassIsBindableType(valtype))
+		return false;
+	if (vartype != valtype &&
+		!((vartype == TEXTOID || vartype == VARCHAROID) &&
+		  (valtype == TEXTOID || valtype == VARCHAROID)))
+		return false;
+
+	/*
+	 * A timestamp column with fewer than three fractional digits rounds the
+	 * milliseconds stored in Cassandra, so only a local comparison sees the
+	 * value the way the query does.
+	 */
+	if ((vartype == TIMESTAMPOID || vartype == TIMESTAMPTZOID) &&
+		var->vartypmod >= 0 && var->vartypmod < 3)
+		return false;
+
+	/* Find out what the operator means for the column type. */
+	opclass = GetDefaultOpClass(vartype, BTREE_AM_OID);
+	if (!OidIsValid(opclass))
+		return false;
+	*strategy = get_op_opfamily_strategy(opno, get_opclass_family(opclass));
+	if (*strategy == InvalidStrategy)
+		return false;
+	if (is_array && *strategy != BTEqualStrategyNumber)
+		return false;
+
+#if PG_VERSION_NUM >= 120000
+	/* Cassandra compares text bytewise, like deterministic collations. */
+	if (OidIsValid(inputcollid) &&
+		!get_collation_isdeterministic(inputcollid))
+		return false;
+#endif
+
+	*attnum = var->varattno;
+	*value = val;
+	return true;
+}
+
+/*
+ * Emit a WHERE clause for the given remote conditions, each of which must
+ * have been accepted by cassIsKeyRestriction.  The values are emitted as
+ * bind markers and appended to *params_list, in marker order.
+ */
+static void
+cassAppendWhereClause(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel,
+					  List *remote_conds, List **params_list)
+{
+	ListCell   *lc;
+	bool		first = true;
+
+	foreach(lc, remote_conds)
+	{
+		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+		AttrNumber	attnum;
+		int			strategy;
+		Expr	   *value;
+
+		if (!cassIsKeyRestriction(root, baserel, ri->clause,
+								  &attnum, &strategy, &value))
+			elog(ERROR, "unexpected remote condition");
+
+		appendStringInfoString(buf, first ? " WHERE " : " AND ");
+		first = false;
+
+		cassDeparseColumnRef(buf, baserel->relid, attnum, root);
+		appendStringInfo(buf, " %s ?", cassStrategyOperators[strategy]);
+		*params_list = lappend(*params_list, value);
+	}
+}
+
+/*
+ * Emit a WHERE clause restricting a scan without remote conditions to the
+ * partitions whose token lies in a range, given by two bind markers: the
+ * excluded lower bound, then the included upper bound.
+ */
+void
+cassAppendTokenRangeClause(StringInfo buf, PlannerInfo *root,
+						   RelOptInfo *baserel, List *partition_attrs)
+{
+	StringInfoData token;
+	ListCell   *lc;
+
+	initStringInfo(&token);
+	appendStringInfoString(&token, "token(");
+	foreach(lc, partition_attrs)
+	{
+		if (lc != list_head(partition_attrs))
+			appendStringInfoString(&token, ", ");
+		cassDeparseColumnRef(&token, baserel->relid, lfirst_int(lc), root);
+	}
+	appendStringInfoChar(&token, ')');
+
+	appendStringInfo(buf, " WHERE %s > ? AND %s <= ?", token.data, token.data);
+	pfree(token.data);
+}
+
+/*
+ * Append an ORDER BY clause on the given column of the foreign table.
+ */
+void
+cassAppendOrderByClause(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel,
+						AttrNumber attnum, bool descending)
+{
+	appendStringInfoString(buf, " ORDER BY ");
+	cassDeparseColumnRef(buf, baserel->relid, attnum, root);
+	appendStringInfoString(buf, descending ? " DESC" : " ASC");
+}
+
 /*
  * Construct a simple SELECT statement that retrieves desired columns
  * of the specified foreign table, and append it to "buf".  The output
- * contains just "SELECT ... FROM tablename".
+ * contains "SELECT ... FROM tablename", followed by a WHERE clause for the
+ * remote_conds, if any.  With distinct, the columns must be those of the
+ * partition key, and each partition key is returned once.
  *
  * We also create an integer List of the columns being retrieved, which is
- * returned to *retrieved_attrs.
+ * returned to *retrieved_attrs, and a List of the expressions whose values
+ * are to be bound to the statement's parameters, returned to *params_list.
  */
 void
 cassDeparseSelectSql(StringInfo buf,
                  PlannerInfo *root,
                  RelOptInfo *baserel,
                  Bitmapset *attrs_used,
-                 List **retrieved_attrs)
+                 List *remote_conds,
+                 bool distinct,
+                 List **retrieved_attrs,
+                 List **params_list)
 {
 	RangeTblEntry *rte = planner_rt_fetch(baserel->relid, root);
 	Relation	rel;
@@ -221,12 +555,16 @@ cassDeparseSelectSql(StringInfo buf,
 	 * Core code already has some lock on each rel being planned, so we can
 	 * use NoLock here.
 	 */
+#if PG_VERSION_NUM < 120000
 	rel = heap_open(rte->relid, NoLock);
+#else
+	rel = table_open(rte->relid, NoLock);
+#endif
 
 	/*
 	 * Construct SELECT list
 	 */
-	appendStringInfoString(buf, "SELECT ");
+	appendStringInfoString(buf, distinct ? "SELECT DISTINCT " : "SELECT ");
 	cassDeparseTargetList(buf, root, baserel->relid, rel, attrs_used,
 	                  retrieved_attrs);
 
@@ -236,15 +574,258 @@ cassDeparseSelectSql(StringInfo buf,
 	appendStringInfoString(buf, " FROM ");
 	cassDeparseRelation(buf, rel);
 
+	/*
+	 * Construct WHERE clause
+	 */
+	*params_list = NIL;
+	cassAppendWhereClause(buf, root, baserel, remote_conds, params_list);
+
 	elog(DEBUG1, CSTAR_FDW_NAME ": built the statement: %s", buf->data);
 
+#if PG_VERSION_NUM < 120000
 	heap_close(rel, NoLock);
+#else
+	table_close(rel, NoLock);
+#endif
+}
+
+/*
+ * Describe how Cassandra computes an aggregate: the CQL function, the column
+ * it is applied to (NULL for count(*)), and the CQL type the column is cast
+ * to first, if any.  Returns false if Cassandra can't produce the result
+ * PostgreSQL would.
+ */
+static bool
+cassAggregateForm(RelOptInfo *baserel, Aggref *agg,
+				  const char **funcname, Var **arg, const char **cast)
+{
+	char	   *name;
+	Expr	   *expr;
+	Var		   *var;
+
+	/* Only plain aggregates over whole input rows. */
+	if (agg->aggdistinct != NIL || agg->aggorder != NIL ||
+		agg->aggfilter != NULL || agg->aggkind != AGGKIND_NORMAL ||
+		agg->aggsplit != AGGSPLIT_SIMPLE || agg->agglevelsup != 0 ||
+		agg->aggvariadic)
+		return false;
+
+	if (get_func_namespace(agg->aggfnoid) != PG_CATALOG_NAMESPACE)
+		return false;
+	name = get_func_name(agg->aggfnoid);
+
+	*arg = NULL;
+	*cast = NULL;
+
+	if (agg->aggstar)
+	{
+		if (strcmp(name, "count") != 0)
+			return false;
+		*funcname = "count";
+		return true;
+	}
+
+	/* The argument must be a column of the foreign table. */
+	if (list_length(agg->args) != 1)
+		return false;
+	expr = ((TargetEntry *) linitial(agg->args))->expr;
+	while (IsA(expr, RelabelType))
+		expr = ((RelabelType *) expr)->arg;
+	if (!IsA(expr, Var))
+		return false;
+	var = (Var *) expr;
+	if (var->varno != baserel->relid || var->varlevelsup != 0 ||
+		var->varattno <= 0)
+		return false;
+	*arg = var;
+
+	if (strcmp(name, "count") == 0)
+		*funcname = "count";
+	else if (strcmp(name, "min") == 0 || strcmp(name, "max") == 0)
+	{
+		/* Both sides must agree on which value is the smallest. */
+		if (!cassIsOrderedType(var->vartype) &&
+			!((var->vartype == TEXTOID || var->vartype == VARCHAROID) &&
+			  lc_collate_is_c(agg->inputcollid)))
+			return false;
+		*funcname = (strcmp(name, "min") == 0) ? "min" : "max";
+	}
+	else if (strcmp(name, "sum") == 0)
+	{
+		/* Cassandra sums in the argument type; widen like PostgreSQL. */
+		switch (var->vartype)
+		{
+			case INT2OID:
+			case INT4OID:
+				*cast = "bigint";
+				break;
+			case FLOAT4OID:
+			case FLOAT8OID:
+				break;
+			default:
+				return false;
+		}
+		*funcname = "sum";
+	}
+	else if (strcmp(name, "avg") == 0)
+	{
+		/* Cassandra averages integers in integer arithmetic. */
+		switch (var->vartype)
+		{
+			case FLOAT4OID:
+				*cast = "double";
+				break;
+			case FLOAT8OID:
+				break;
+			default:
+				return false;
+		}
+		*funcname = "avg";
+	}
+	else
+		return false;
+
+	return true;
+}
+
+/*
+ * Whether an aggregate over the foreign table can be computed by Cassandra.
+ */
+bool
+cassIsPushableAggregate(RelOptInfo *baserel, Aggref *agg)
+{
+	const char *funcname;
+	const char *cast;
+	Var		   *arg;
+
+	return cassAggregateForm(baserel, agg, &funcname, &arg, &cast);
+}
+
+/*
+ * Construct a SELECT statement computing the entries of tlist over the rows
+ * of the foreign table satisfying remote_conds.  The entries are aggregates
+ * accepted by cassIsPushableAggregate, or grouping columns.  group_attrs
+ * lists the primary key columns to GROUP BY, in key order, or is NIL to
+ * aggregate all the rows.
+ *
+ * Column i of the result holds the value of entry i of tlist, as noted in
+ * *retrieved_attrs.  Without grouping, entry i of *agg_counts tells whether
+ * it is a count, so that the scan knows the aggregates of no rows.
+ *
+ * Cassandra sums and averages no values to 0 rather than NULL, so each sum
+ * or avg is followed, after the entries of tlist, by a count of its
+ * argument; *empty_nulls lists the entries concerned, in the same order.
+ */
+void
+cassDeparseAggregateSql(StringInfo buf,
+						PlannerInfo *root,
+						RelOptInfo *baserel,
+						List *tlist,
+						List *group_attrs,
+						List *remote_conds,
+						List **retrieved_attrs,
+						List **params_list,
+						List **agg_counts,
+						List **empty_nulls)
+{
+	RangeTblEntry *rte = planner_rt_fetch(baserel->relid, root);
+	Relation	rel;
+	List	   *counted_attrs = NIL;
+	ListCell   *lc;
+	int			i = 0;
+
+#if PG_VERSION_NUM < 120000
+	rel = heap_open(rte->relid, NoLock);
+#else
+	rel = table_open(rte->relid, NoLock);
+#endif
+
+	*retrieved_attrs = NIL;
+	*agg_counts = NIL;
+	*empty_nulls = NIL;
+
+	appendStringInfoString(buf, "SELECT ");
+	foreach(lc, tlist)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+		const char *funcname;
+		const char *cast;
+		Var		   *arg;
+
+		if (i > 0)
+			appendStringInfoString(buf, ", ");
+		i++;
+		*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+
+		if (IsA(tle->expr, Var) && group_attrs != NIL)
+		{
+			cassDeparseColumnRef(buf, baserel->relid,
+								 ((Var *) tle->expr)->varattno, root);
+			continue;
+		}
+
+		if (!IsA(tle->expr, Aggref) ||
+			!cassAggregateForm(baserel, (Aggref *) tle->expr,
+							   &funcname, &arg, &cast))
+			elog(ERROR, "unexpected aggregate");
+
+		appendStringInfo(buf, "%s(", funcname);
+		if (arg == NULL)
+			appendStringInfoChar(buf, '*');
+		else if (cast)
+		{
+			appendStringInfoString(buf, "CAST(");
+			cassDeparseColumnRef(buf, baserel->relid, arg->varattno, root);
+			appendStringInfo(buf, " AS %s)", cast);
+		}
+		else
+			cassDeparseColumnRef(buf, baserel->relid, arg->varattno, root);
+		appendStringInfoChar(buf, ')');
+
+		if (group_attrs == NIL)
+			*agg_counts = lappend_int(*agg_counts,
+									  strcmp(funcname, "count") == 0);
+		if (strcmp(funcname, "sum") == 0 || strcmp(funcname, "avg") == 0)
+		{
+			*empty_nulls = lappend_int(*empty_nulls, i);
+			counted_attrs = lappend_int(counted_attrs, arg->varattno);
+		}
+	}
+
+	foreach(lc, counted_attrs)
+	{
+		appendStringInfoString(buf, ", count(");
+		cassDeparseColumnRef(buf, baserel->relid, lfirst_int(lc), root);
+		appendStringInfoChar(buf, ')');
+		*retrieved_attrs = lappend_int(*retrieved_attrs, 0);
+	}
+
+	appendStringInfoString(buf, " FROM ");
+	cassDeparseRelation(buf, rel);
+
+	*params_list = NIL;
+	cassAppendWhereClause(buf, root, baserel, remote_conds, params_list);
+
+	i = 0;
+	foreach(lc, group_attrs)
+	{
+		appendStringInfoString(buf, (i++ == 0) ? " GROUP BY " : ", ");
+		cassDeparseColumnRef(buf, baserel->relid, lfirst_int(lc), root);
+	}
+
+	elog(DEBUG1, CSTAR_FDW_NAME ": built the statement: %s", buf->data);
+
+#if PG_VERSION_NUM < 120000
+	heap_close(rel, NoLock);
+#else
+	table_close(rel, NoLock);
+#endif
 }
 
 /*
  * deparse remote INSERT statement
  *
- * The statement text is appended to buf.
+ * The statement text is appended to buf.  root may be NULL, as for COPY.
  */
 void
 cassDeparseInsertSql(StringInfo buf, PlannerInfo *root,
@@ -271,7 +852,7 @@ cassDeparseInsertSql(StringInfo buf, PlannerInfo *root,
 				appendStringInfoString(buf, ", ");
 			first = false;
 
-			cassDeparseColumnRef(buf, rtindex, attnum, root);
+			cassDeparseColumnName(buf, RelationGetRelid(rel), attnum);
 		}
 
 		appendStringInfoString(buf, ") VALUES (");
@@ -0,0 +1,80 @@
+--
+-- Setup
+--
+
+CREATE EXTENSION cassandra_fdw;
+
+CREATE SERVER cass_serv FOREIGN DATA WRAPPER cassandra_fdw
+    OPTIONS (host '127.0.0.1');
+
+CREATE USER MAPPING FOR public SERVER cass_serv
+    OPTIONS (username 'test', password 'test');
+
+--
+-- Option validation
+--
+
+-- Load balancing, driver and write options on the SERVER.
+
+CREATE SERVER cass_serv_opts FOREIGN DATA WRAPPER cassandra_fdw OPTIONS (
+    host '127.0.0.1',
+    token_aware 'true', local_dc 'dc1', used_hosts_per_remote_dc '1',
+    latency_aware 'off', whitelist '127.0.0.1', blacklist '127.0.0.2',
+    io_threads '2', core_connections '2',
+    connect_timeout '5000', request_timeout '12000',
+    batch_size '50', batch_type 'logged', write_concurrency '8',
+    copy_concurrency '32', copy_consistency 'QUORUM', copy_max_errors '0'
+);
+
+ALTER SERVER cass_serv_opts OPTIONS (SET batch_type 'unlogged');
+ALTER SERVER cass_serv_opts OPTIONS (DROP local_dc, DROP used_hosts_per_remote_dc);
+
+-- Invalid values.
+
+ALTER SERVER cass_serv_opts OPTIONS (SET token_aware 'maybe');
+ALTER SERVER cass_serv_opts OPTIONS (SET latency_aware '2');
+ALTER SERVER cass_serv_opts OPTIONS (ADD local_dc '');
+ALTER SERVER cass_serv_opts OPTIONS (ADD used_hosts_per_remote_dc '2');
+ALTER SERVER cass_serv_opts OPTIONS (ADD local_dc 'dc1', ADD used_hosts_per_remote_dc '-1');
+ALTER SERVER cass_serv_opts OPTIONS (SET io_threads '0');
+ALTER SERVER cass_serv_opts OPTIONS (SET core_connections '0');
+ALTER SERVER cass_serv_opts OPTIONS (SET connect_timeout 'soon');
+ALTER SERVER cass_serv_opts OPTIONS (SET request_timeout '0');
+ALTER SERVER cass_serv_opts OPTIONS (SET batch_size '0');
+ALTER SERVER cass_serv_opts OPTIONS (SET batch_type 'sometimes');
+ALTER SERVER cass_serv_opts OPTIONS (SET write_concurrency '0');
+ALTER SERVER cass_serv_opts OPTIONS (SET copy_concurrency '0');
+ALTER SERVER cass_serv_opts OPTIONS (SET copy_consistency 'MOST');
+ALTER SERVER cass_serv_opts OPTIONS (SET copy_max_errors '-1');
+
+-- Options of another object type.
+
+ALTER SERVER cass_serv_opts OPTIONS (ADD per_partition_limit '5');
+
+CREATE USER MAPPING FOR public SERVER cass_serv_opts
+    OPTIONS (username 'test', password 'test', batch_size '10');
+
+-- Write options on the FOREIGN TABLE.
+
+CREATE FOREIGN TABLE cass_opts (id int) SERVER cass_serv_opts OPTIONS (
+    schema_name 'example', table_name 'cass_opts', primary_key 'id',
+    batch_size '10', batch_type 'logged', write_concurrency '4',
+    copy_concurrency '16', copy_consistency 'LOCAL_QUORUM',
+    copy_max_errors '100'
+);
+
+ALTER FOREIGN TABLE cass_opts OPTIONS (SET batch_size '0');
+ALTER FOREIGN TABLE cass_opts OPTIONS (SET batch_size 'many');
+ALTER FOREIGN TABLE cass_opts OPTIONS (SET batch_type 'counter');
+ALTER FOREIGN TABLE cass_opts OPTIONS (SET write_concurrency '-4');
+ALTER FOREIGN TABLE cass_opts OPTIONS (SET copy_concurrency '0');
+ALTER FOREIGN TABLE cass_opts OPTIONS (SET copy_consistency 'SOME');
+ALTER FOREIGN TABLE cass_opts OPTIONS (SET copy_max_errors '-1');
+
+-- Driver options belong to the SERVER.
+
+ALTER FOREIGN TABLE cass_opts OPTIONS (ADD token_aware 'true');
+ALTER FOREIGN TABLE cass_opts OPTIONS (ADD request_timeout '1000');
+
+DROP FOREIGN TABLE cass_opts;
+DROP SERVER cass_serv_opts;
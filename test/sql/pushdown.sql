@@ -0,0 +1,224 @@
+--
+-- DDL
+--
+
+-- The Cassandra table behind the foreign table:
+--
+--   CREATE TABLE example.pushdown_readings (
+--       sensor_id int,
+--       ts timestamp,
+--       seq int,
+--       value double,
+--       note text,
+--       PRIMARY KEY ((sensor_id), ts, seq)
+--   ) WITH CLUSTERING ORDER BY (ts DESC, seq ASC);
+--
+-- The key is declared with table options, so that planning doesn't read
+-- the Cassandra schema and these EXPLAINs run without a cluster.
+
+DROP FOREIGN TABLE IF EXISTS pushdown_readings;
+
+CREATE FOREIGN TABLE pushdown_readings (
+    sensor_id int,
+    ts timestamp,
+    seq int,
+    value float8,
+    note text
+) SERVER cass_serv OPTIONS (
+    schema_name 'example', table_name 'pushdown_readings',
+    partition_key 'sensor_id', clustering_key 'ts DESC, seq'
+);
+
+DROP TABLE IF EXISTS pushdown_sensors;
+
+CREATE TABLE pushdown_sensors (
+    sensor_id int,
+    name text
+);
+
+INSERT INTO pushdown_sensors
+    SELECT g, 'sensor ' || g FROM generate_series(1, 1000) g;
+
+ANALYZE pushdown_sensors;
+
+--
+-- Partition key restrictions
+--
+
+-- Equality on the partition key is sent.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1;
+
+-- A restriction on another column stays local.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1 AND value > 10;
+
+-- A key compared with a value of another type stays local.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1::bigint;
+
+--
+-- Clustering key restrictions
+--
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings
+WHERE sensor_id = 1 AND ts >= '2020-01-01' AND ts < '2020-02-01';
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings
+WHERE sensor_id = 1 AND ts = '2020-01-01' AND seq > 5;
+
+-- Without the partition pinned, clustering restrictions stay local.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE ts >= '2020-01-01';
+
+--
+-- IN lists on the partition key
+--
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id IN (1, 2, 3);
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = ANY ('{4,5}'::int[]);
+
+--
+-- LIMIT and OFFSET
+--
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1 LIMIT 10;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1 LIMIT 10 OFFSET 5;
+
+-- A local restriction keeps the LIMIT local.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1 AND value > 10 LIMIT 10;
+
+--
+-- ORDER BY on the clustering key
+--
+
+-- In stored order, and entirely reversed.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1 ORDER BY ts DESC, seq;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1 ORDER BY ts, seq DESC
+LIMIT 3;
+
+-- Any other order is sorted locally.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1 ORDER BY ts, seq;
+
+--
+-- Aggregates and GROUP BY (Postgres 12+)
+--
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT count(*), min(ts), max(ts), sum(seq), avg(value)
+FROM pushdown_readings WHERE sensor_id = 1;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT sensor_id, count(*) FROM pushdown_readings GROUP BY sensor_id;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT ts, max(value) FROM pushdown_readings WHERE sensor_id = 1 GROUP BY ts;
+
+-- avg() of an integer column and a local restriction are computed locally.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT avg(seq) FROM pushdown_readings WHERE sensor_id = 1;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT count(*) FROM pushdown_readings WHERE sensor_id = 1 AND value > 10;
+
+--
+-- DISTINCT partition key (Postgres 12+)
+--
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT DISTINCT sensor_id FROM pushdown_readings;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT DISTINCT sensor_id FROM pushdown_readings WHERE value > 10;
+
+--
+-- per_partition_limit
+--
+
+ALTER FOREIGN TABLE pushdown_readings OPTIONS (ADD per_partition_limit '5');
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM pushdown_readings WHERE sensor_id = 1 LIMIT 10;
+
+-- Aggregates are then computed locally.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT count(*) FROM pushdown_readings WHERE sensor_id = 1;
+
+ALTER FOREIGN TABLE pushdown_readings OPTIONS (DROP per_partition_limit);
+
+--
+-- Joins on the partition key
+--
+
+SET enable_hashjoin = off;
+SET enable_mergejoin = off;
+SET enable_material = off;
+
+-- Parameterized scan, one partition per outer row.
+
+SET cassandra_fdw.enable_batch_join = off;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT s.name, r.ts, r.value
+FROM pushdown_sensors s JOIN pushdown_readings r ON r.sensor_id = s.sensor_id
+WHERE s.sensor_id < 10;
+
+-- Batched lookup join (Postgres 12+).
+
+RESET cassandra_fdw.enable_batch_join;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT s.name, r.ts, r.value
+FROM pushdown_sensors s JOIN pushdown_readings r ON r.sensor_id = s.sensor_id
+WHERE s.sensor_id < 10;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT s.name, r.ts, r.value
+FROM pushdown_sensors s LEFT JOIN pushdown_readings r
+    ON r.sensor_id = s.sensor_id
+WHERE s.sensor_id < 10;
+
+ALTER FOREIGN TABLE pushdown_readings OPTIONS (ADD join_batch_size '50');
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT s.name, r.ts, r.value
+FROM pushdown_sensors s JOIN pushdown_readings r ON r.sensor_id = s.sensor_id
+WHERE s.sensor_id < 10;
+
+ALTER FOREIGN TABLE pushdown_readings OPTIONS (DROP join_batch_size);
+
+RESET enable_hashjoin;
+RESET enable_mergejoin;
+RESET enable_material;
+
+--
+-- Cleanup
+--
+
+DROP TABLE pushdown_sensors;
+DROP FOREIGN TABLE pushdown_readings;
@@ -0,0 +1,54 @@
+--
+-- DDL
+--
+
+-- Planning scans by token range asks the cluster for its partitioner, so
+-- these EXPLAINs need a cluster using Murmur3Partitioner and the table
+-- described in pushdown.sql.
+
+DROP FOREIGN TABLE IF EXISTS token_range_readings;
+
+CREATE FOREIGN TABLE token_range_readings (
+    sensor_id int,
+    ts timestamp,
+    seq int,
+    value float8,
+    note text
+) SERVER cass_serv OPTIONS (
+    schema_name 'example', table_name 'pushdown_readings',
+    partition_key 'sensor_id', clustering_key 'ts DESC, seq',
+    token_ranges '8'
+);
+
+--
+-- Whole-table scans by token range
+--
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM token_range_readings;
+
+-- A scan pinned to partitions is not split.
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM token_range_readings WHERE sensor_id = 1;
+
+-- Parallel scan.
+
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT * FROM token_range_readings;
+
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+
+--
+-- Cleanup
+--
+
+DROP FOREIGN TABLE token_range_readings;
@@ -98,3 +98,128 @@ DELETE FROM write_type_mapping WHERE id IN (1, 2);
 DELETE FROM write_type_mapping WHERE double_value = 3.14159;
 
 SELECT COUNT(id) FROM write_type_mapping;
+
+--
+-- Batched INSERTs (Postgres 14+)
+--
+
+DELETE FROM write_type_mapping WHERE id >= 10;
+
+ALTER FOREIGN TABLE write_type_mapping OPTIONS (ADD batch_size '3');
+
+EXPLAIN (VERBOSE, COSTS OFF)
+INSERT INTO write_type_mapping (id, int_value) VALUES (10, 10);
+
+INSERT INTO write_type_mapping (id, int_value, text_value)
+    SELECT g, g, 'batch ' || g FROM generate_series(10, 17) g;
+
+SELECT id, int_value, text_value FROM write_type_mapping
+WHERE id IN (10, 11, 12, 13, 14, 15, 16, 17) ORDER BY id;
+
+-- Rows repeating a primary key within a batch: the last one inserted wins,
+-- whatever its value.
+
+INSERT INTO write_type_mapping (id, int_value, text_value)
+VALUES
+    (20, 3, 'first'),
+    (21, 1, 'other'),
+    (20, 2, 'second'),
+    (20, 1, 'third');
+
+SELECT id, int_value, text_value FROM write_type_mapping
+WHERE id IN (20, 21) ORDER BY id;
+
+-- The same with logged batches.
+
+ALTER FOREIGN TABLE write_type_mapping OPTIONS (ADD batch_type 'logged');
+
+INSERT INTO write_type_mapping (id, int_value, text_value)
+VALUES
+    (22, 2, 'first'),
+    (22, 1, 'second'),
+    (23, 1, 'other');
+
+SELECT id, int_value, text_value FROM write_type_mapping
+WHERE id IN (22, 23) ORDER BY id;
+
+ALTER FOREIGN TABLE write_type_mapping OPTIONS (DROP batch_type, DROP batch_size);
+
+--
+-- Writes in flight
+--
+
+ALTER FOREIGN TABLE write_type_mapping OPTIONS (ADD write_concurrency '4');
+
+INSERT INTO write_type_mapping (id, int_value, text_value)
+    SELECT g, g, 'window ' || g FROM generate_series(30, 49) g;
+
+SELECT COUNT(id), SUM(int_value) FROM write_type_mapping
+WHERE id BETWEEN 30 AND 49;
+
+UPDATE write_type_mapping SET int_value = int_value * 10
+WHERE id BETWEEN 30 AND 49;
+
+SELECT COUNT(id), SUM(int_value) FROM write_type_mapping
+WHERE id BETWEEN 30 AND 49;
+
+-- A DELETE and an INSERT of the same row in one statement keep their order.
+
+WITH d AS (DELETE FROM write_type_mapping WHERE id = 30)
+INSERT INTO write_type_mapping (id, int_value) VALUES (30, -1);
+
+SELECT id, int_value FROM write_type_mapping WHERE id = 30;
+
+-- Batches are sent through the window as well.
+
+ALTER FOREIGN TABLE write_type_mapping OPTIONS (ADD batch_size '4');
+
+INSERT INTO write_type_mapping (id, int_value, text_value)
+VALUES
+    (24, 1, 'first'),
+    (25, 1, 'other'),
+    (24, 2, 'second'),
+    (26, 1, 'other'),
+    (24, 3, 'third');
+
+SELECT id, int_value, text_value FROM write_type_mapping
+WHERE id IN (24, 25, 26) ORDER BY id;
+
+ALTER FOREIGN TABLE write_type_mapping OPTIONS (DROP batch_size, DROP write_concurrency);
+
+--
+-- COPY FROM
+--
+
+-- The notice reporting the rate varies from run to run.
+
+SET client_min_messages = warning;
+
+COPY write_type_mapping (id, int_value, text_value) FROM stdin;
+50	50	copy 50
+51	51	copy 51
+52	52	copy 52
+\.
+
+SELECT id, int_value, text_value FROM write_type_mapping
+WHERE id IN (50, 51, 52) ORDER BY id;
+
+ALTER FOREIGN TABLE write_type_mapping
+    OPTIONS (ADD copy_concurrency '2', ADD copy_consistency 'ONE', ADD copy_max_errors '0');
+
+COPY write_type_mapping (id, int_value, text_value) FROM stdin;
+53	53	copy 53
+54	54	copy 54
+53	-53	copy 53 again
+\.
+
+SELECT id, int_value, text_value FROM write_type_mapping
+WHERE id IN (53, 54) ORDER BY id;
+
+ALTER FOREIGN TABLE write_type_mapping
+    OPTIONS (DROP copy_concurrency, DROP copy_consistency, DROP copy_max_errors);
+
+RESET client_min_messages;
+
+DELETE FROM write_type_mapping WHERE id >= 10;
+
+SELECT COUNT(id) FROM write_type_mapping;